@@ -62,6 +62,9 @@ static const char rcsid[] = "$Id: d_main.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 #include "m_argv.h"
 #include "m_misc.h"
 #include "m_menu.h"
+#include "m_bench.h"
+#include "m_trace.h"
+#include "p_chksum.h"
 
 #include "i_system.h"
 #include "i_sound.h"
@@ -98,6 +101,8 @@ char*		wadfiles[MAXWADFILES];
 boolean		devparm;	// started game with -devparm
 boolean         nomonsters;	// checkparm of -nomonsters
 boolean         respawnparm;	// checkparm of -respawn
+compat_t	compatlevel;
+compat_t	defaultcompat;
 boolean         fastparm;	// checkparm of -fast
 
 boolean         drone;
@@ -201,13 +206,11 @@ void D_Display (void)
     static  boolean		fullscreen = false;
     static  gamestate_t		oldgamestate = -1;
     static  int			borderdrawcount;
-    int				nowtime;
-    int				tics;
-    int				wipestart;
+    static  boolean		wipe;
+    static  int			wipestart;
     int				y;
-    boolean			done;
-    boolean			wipe;
     boolean			redrawsbar;
+    long long			start = 0;
 
     if (nodrawers)
 	return;                    // for comparative timing / profiling
@@ -222,14 +225,14 @@ void D_Display (void)
 	borderdrawcount = 3;
     }
 
-    // save the current screen if about to wipe
+    // save the current screen if about to wipe,
+    // the game keeps running while it melts away
     if (gamestate != wipegamestate)
     {
 	wipe = true;
+	wipestart = gametic - 1;
 	wipe_StartScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
     }
-    else
-	wipe = false;
 
     if (gamestate == GS_LEVEL && gametic)
 	HU_Erase();
@@ -246,7 +249,11 @@ void D_Display (void)
 	    redrawsbar = true;
 	if (inhelpscreensstate && !inhelpscreens)
 	    redrawsbar = true;              // just put away the help screen
+	if (benchdemo)
+	    start = I_GetTimeUS ();
 	ST_Drawer (viewheight == 200, redrawsbar );
+	if (benchdemo)
+	    benchtime[bench_hud] += I_GetTimeUS () - start;
 	fullscreen = viewheight == 200;
 	break;
 
@@ -271,7 +278,13 @@ void D_Display (void)
 	R_RenderPlayerView (&players[displayplayer]);
 
     if (gamestate == GS_LEVEL && gametic)
+    {
+	if (benchdemo)
+	    start = I_GetTimeUS ();
 	HU_Drawer ();
+	if (benchdemo)
+	    benchtime[bench_hud] += I_GetTimeUS () - start;
+    }
     
     // clean up border stuff
     if (gamestate != oldgamestate && gamestate != GS_LEVEL)
@@ -287,7 +300,7 @@ void D_Display (void)
     // see if the border needs to be updated to the screen
     if (gamestate == GS_LEVEL && !automapactive && scaledviewwidth != 320)
     {
-	if (menuactive || menuactivestate || !viewactivestate)
+	if (menuactive || menuactivestate || !viewactivestate || wipe)
 	    borderdrawcount = 3;
 	if (borderdrawcount)
 	{
@@ -314,37 +327,25 @@ void D_Display (void)
     }
 
 
-    // menus go directly to the screen
-    M_Drawer ();          // menu is drawn even on top of everything
-    NetUpdate ();         // send out any new accumulation
-
-
-    // normal update
-    if (!wipe)
+    // the wipe goes over everything but the menu,
+    // and the next frame draws it all again
+    if (wipe)
     {
-	I_FinishUpdate ();              // page flip or blit buffer
-	return;
+	if (wipe_ScreenWipe (wipe_Melt, 0, 0, SCREENWIDTH, SCREENHEIGHT,
+			     gametic - wipestart))
+	    wipe = false;
+	wipestart = gametic;
     }
-    
-    // wipe update
-    wipe_EndScreen(0, 0, SCREENWIDTH, SCREENHEIGHT);
 
-    wipestart = I_GetTime () - 1;
+    // menus go directly to the screen
+    M_Drawer ();          // menu is drawn even on top of everything
+    NetUpdate ();         // send out any new accumulation
 
-    do
-    {
-	do
-	{
-	    nowtime = I_GetTime ();
-	    tics = nowtime - wipestart;
-	} while (!tics);
-	wipestart = nowtime;
-	done = wipe_ScreenWipe(wipe_Melt
-			       , 0, 0, SCREENWIDTH, SCREENHEIGHT, tics);
-	I_UpdateNoBlit ();
-	M_Drawer ();                            // menu is drawn even on top of wipes
-	I_FinishUpdate ();                      // page flip or blit buffer
-    } while (!done);
+    if (benchdemo)
+	start = I_GetTimeUS ();
+    I_FinishUpdate ();              // page flip or blit buffer
+    if (benchdemo)
+	benchtime[bench_finish] += I_GetTimeUS () - start;
 }
 
 
@@ -356,6 +357,8 @@ extern  boolean         demorecording;
 
 void D_DoomLoop (void)
 {
+    long long	start = 0;
+    
     if (demorecording)
 	G_BeginRecording ();
 		
@@ -367,6 +370,13 @@ void D_DoomLoop (void)
 	debugfile = fopen (filename,"w");
     }
 	
+    // a dedicated server only runs the game
+    if (netserver)
+    {
+	while (1)
+	    TryRunTics ();
+    }
+	
     I_InitGraphics ();
 
     while (1)
@@ -374,6 +384,13 @@ void D_DoomLoop (void)
 	// frame syncronous IO operations
 	I_StartFrame ();                
 	
+	if (benchdemo)
+	    M_BenchFrame ();
+
+	// seeking a demo runs its tics here, between frames
+	if (demoseektic != -1)
+	    G_DoDemoSeek ();
+	
 	// process one or more tics
 	if (singletics)
 	{
@@ -383,7 +400,11 @@ void D_DoomLoop (void)
 	    if (advancedemo)
 		D_DoAdvanceDemo ();
 	    M_Ticker ();
+	    if (benchdemo)
+		start = I_GetTimeUS ();
 	    G_Ticker ();
+	    if (benchdemo)
+		benchtime[bench_ticker] += I_GetTimeUS () - start;
 	    gametic++;
 	    maketic++;
 	}
@@ -391,11 +412,18 @@ void D_DoomLoop (void)
 	{
 	    TryRunTics (); // will run at least one tic
 	}
+
+	// show our own moves the other nodes haven't run yet
+	G_Predict ();
 		
 	S_UpdateSounds (players[consoleplayer].mo);// move positional sounds
 
 	// Update display, next frame, with current state.
+	TRACE_BEGIN ("D_Display");
 	D_Display ();
+	TRACE_END ();
+
+	G_EndPredict ();
 
 #ifndef SNDSERV
 	// Sound mixing for the buffer is snychronous.
@@ -802,6 +830,11 @@ void D_DoomMain (void)
     char                    file[256];
 
     FindResponseFile ();
+
+    // compare two -statelog files, no game needed
+    p = M_CheckParm ("-statediff");
+    if (p && p < myargc-2)
+	exit (P_ChecksumDiff (myargv[p+1], myargv[p+2]));
 	
     IdentifyVersion ();
 	
@@ -811,7 +844,13 @@ void D_DoomMain (void)
     nomonsters = M_CheckParm ("-nomonsters");
     respawnparm = M_CheckParm ("-respawn");
     fastparm = M_CheckParm ("-fast");
+    predict = M_CheckParm ("-predict");
     devparm = M_CheckParm ("-devparm");
+    if (M_CheckParm ("-fastsectors"))
+	defaultcompat = compat_metal;
+    else
+	defaultcompat = compat_vanilla;
+    compatlevel = defaultcompat;
     if (M_CheckParm ("-altdeath"))
 	deathmatch = 2;
     else if (M_CheckParm ("-deathmatch"))
@@ -959,6 +998,16 @@ void D_DoomMain (void)
 	D_AddFile (file);
 	printf("Playing demo %s.lmp.\n",myargv[p+1]);
     }
+
+    p = M_CheckParm ("-benchdemo");
+    if (p)
+    {
+	while (++p != myargc && myargv[p][0] != '-')
+	{
+	    sprintf (file,"%s.lmp", myargv[p]);
+	    D_AddFile (file);
+	}
+    }
     
     // get skill / episode / map from parms
     startskill = sk_medium;
@@ -1011,6 +1060,9 @@ void D_DoomMain (void)
     }
     
     // init subsystems
+    M_TraceInit ();
+    P_ChecksumInit ();
+    
     printf ("V_Init: allocate screens.\n");
     V_Init ();
 
@@ -1135,6 +1187,20 @@ void D_DoomMain (void)
 	autostart = true;
     }
 	
+    // seconds between demo snapshots, and where to start
+    p = M_CheckParm ("-demosnap");
+    if (p && p < myargc-1)
+	demosnaptics = atoi (myargv[p+1])*TICRATE;
+
+    p = M_CheckParm ("-demoseek");
+    if (p && p < myargc-1)
+	demoseektic = atoi (myargv[p+1])*TICRATE;
+	
+    // an offline sound render mixes a tic at a time,
+    //  so there is one tic a frame, as fast as they go
+    if (M_CheckParm ("-wavout"))
+	singletics = true;
+	
     p = M_CheckParm ("-playdemo");
     if (p && p < myargc-1)
     {
@@ -1150,6 +1216,13 @@ void D_DoomMain (void)
 	D_DoomLoop ();  // never returns
     }
 	
+    p = M_CheckParm ("-benchdemo");
+    if (p && p < myargc-1)
+    {
+	M_BenchInit (p);
+	D_DoomLoop ();  // never returns
+    }
+	
     p = M_CheckParm ("-loadgame");
     if (p && p < myargc-1)
     {
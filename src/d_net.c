@@ -26,20 +26,18 @@
 static const char rcsid[] = "$Id: d_net.c,v 1.3 1997/02/03 22:01:47 b1 Exp $";
 
 
+#include <stdlib.h>
+
 #include "m_menu.h"
+#include "m_argv.h"
 #include "i_system.h"
 #include "i_video.h"
 #include "i_net.h"
 #include "g_game.h"
+#include "m_trace.h"
 #include "doomdef.h"
 #include "doomstat.h"
 
-#define	NCMD_EXIT		0x80000000
-#define	NCMD_RETRANSMIT		0x40000000
-#define	NCMD_SETUP		0x20000000
-#define	NCMD_KILL		0x10000000	// kill game
-#define	NCMD_CHECKSUM	 	0x0fffffff
-
  
 doomcom_t*	doomcom;	
 doomdata_t*	netbuffer;		// points inside doomcom
@@ -69,11 +67,85 @@ int		resendcount[MAXNETNODES];
 int		nodeforplayer[MAXPLAYERS];
 
 int             maketic;
+int		gametime;
 int		lastnettic;
 int		skiptics;
 int		ticdup;		
 int		maxsend;	// BACKUPTICS/(2*ticdup)-1
 
+boolean		netserver;	// dedicated server for the clients
+boolean		netclient;	// playing on a dedicated server
+boolean		netspectator;	// a client the server runs no player for
+boolean		legacynodes;	// some node can't check the tic hash
+
+
+//
+// CLIENT/SERVER
+//
+// The server runs one tic of the game every I_GetTime tic,
+// with the next command each client has sent it, or an
+// empty one if none came in time. The commands it ran go
+// back to every client in NCMD_SERVER packets, so a slow
+// client only holds up itself.
+//
+// nettics[] counts the tics received from each node,
+// in the tics of the node that sent them.
+//
+// Clients that join past the players, up to -spectators
+// of them, get every tic too but run no player. Their
+// commands keep them from timing out and nothing else.
+//
+#define SERVERBACKUP	32		// tics kept for retransmits
+#define SERVERTIMEOUT	(10*TICRATE)	// drop clients silent this long
+#define SPECTATOR	15		// console player in a spectator's setup
+
+int		numspectators;
+
+ticcmd_t	clientcmds[MAXNETNODES][BACKUPTICS];	// not yet run
+int		clientnext[MAXNETNODES];	// next client tic to run
+int		lastheard[MAXNETNODES];		// I_GetTime of last packet
+
+ticcmd_t	servercmds[SERVERBACKUP][MAXPLAYERS];
+short		serverold[SERVERBACKUP][MAXPLAYERS];	// for older clients
+byte		servermask[SERVERBACKUP];	// playeringame bits
+byte		netmask[BACKUPTICS];		// same, on the client
+
+extern short	consistancy[MAXPLAYERS][BACKUPTICS];
+extern short	oldconsistancy[MAXPLAYERS][BACKUPTICS];
+
+
+//
+// PACKET FORMAT
+//
+// Setup packets offer the newest format a node knows
+// in a ticcmd older versions never look at, and the key
+// player or server answers with the one to use. Nodes
+// that offer nothing get NETFORMAT_LEGACY packets.
+// Answers also carry the compat level, plus one in the
+// chatchar, which older answers leave zero.  A node
+// that gets no answer can only be playing compat_vanilla.
+//
+#define FORMATMAGIC	0x4e46		// in consistancy of the offer
+
+int		nodeformat[MAXNETNODES];	// format to send each node
+
+// for the stats
+int		bytesout[MAXNETNODES];
+int		bytesin[MAXNETNODES];
+
+//
+// -netbench <seconds> runs the game that long and reports
+// how many tics it managed and how long TryRunTics sat
+// waiting for tics from other nodes, then quits.
+// With -loopback that needs no network to reproduce.
+//
+long long	netbench;		// microseconds, 0 if off
+long long	benchstart;
+int		benchtic;
+long long	stalltime;
+long long	maxstall;
+int		stalls;
+
 
 void D_ProcessEvents (void); 
 void G_BuildTiccmd (ticcmd_t *cmd); 
@@ -84,12 +156,23 @@ doomdata_t	reboundstore;
 
 
 
+//
+// NetbufferCmds
+//
+int NetbufferCmds (void)
+{
+    if (netbuffer->checksum & NCMD_SERVER)
+	return netbuffer->numtics * MAXPLAYERS;
+    
+    return netbuffer->numtics;
+}
+
 //
 //
 //
 int NetbufferSize (void)
 {
-    return (int)&(((doomdata_t *)0)->cmds[netbuffer->numtics]); 
+    return (int)&(((doomdata_t *)0)->cmds[NetbufferCmds ()]); 
 }
 
 //
@@ -115,25 +198,87 @@ unsigned NetbufferChecksum (void)
 }
 
 //
+// ExpandTicsFrom
+// Low byte of a tic number within 64 tics of near
 //
-//
-int ExpandTics (int low)
+int
+ExpandTicsFrom
+( int	low,
+  int	near )
 {
     int	delta;
 	
-    delta = low - (maketic&0xff);
+    delta = low - (near&0xff);
 	
     if (delta >= -64 && delta <= 64)
-	return (maketic&~0xff) + low;
+	return (near&~0xff) + low;
     if (delta > 64)
-	return (maketic&~0xff) - 256 + low;
+	return (near&~0xff) - 256 + low;
     if (delta < -64)
-	return (maketic&~0xff) + 256 + low;
+	return (near&~0xff) + 256 + low;
 		
-    I_Error ("ExpandTics: strange value %i at maketic %i",low,maketic);
+    I_Error ("ExpandTics: strange value %i at tic %i",low,near);
     return 0;
 }
 
+//
+//
+//
+int ExpandTics (int low)
+{
+    return ExpandTicsFrom (low, maketic);
+}
+
+
+
+//
+// SetFormat
+// Puts a format offer or answer in the netbuffer
+//
+void
+SetFormat
+( int		format,
+  boolean	answer )
+{
+    memset (&netbuffer->cmds[0], 0, sizeof(ticcmd_t));
+    netbuffer->cmds[0].consistancy = FORMATMAGIC;
+    netbuffer->cmds[0].angleturn = format;
+    netbuffer->cmds[0].buttons = answer;
+    if (answer)
+	netbuffer->cmds[0].chatchar = compatlevel+1;
+    netbuffer->numtics = 1;
+}
+
+//
+// GetFormat
+// Returns -1 if the setup packet has no offer or answer
+//
+int GetFormat (boolean answer)
+{
+    if (netbuffer->numtics < 1
+	|| netbuffer->cmds[0].consistancy != FORMATMAGIC
+	|| netbuffer->cmds[0].buttons != answer)
+	return -1;
+
+    if (netbuffer->cmds[0].angleturn > NETFORMAT)
+	return NETFORMAT;
+    return netbuffer->cmds[0].angleturn;
+}
+
+//
+// GetCompat
+// From an answer, compat_vanilla if it has none
+//
+compat_t GetCompat (void)
+{
+    int		level;
+
+    level = netbuffer->cmds[0].chatchar - 1;
+    if (level < 0 || level >= NUMCOMPATLEVELS)
+	return compat_vanilla;
+    return level;
+}
+
 
 
 //
@@ -144,7 +289,12 @@ HSendPacket
  (int	node,
   int	flags )
 {
-    netbuffer->checksum = NetbufferChecksum () | flags;
+    if (node && nodeformat[node] == NETFORMAT_DELTA)
+	flags |= NCMD_DELTA;
+    
+    // the flags decide the packet size
+    netbuffer->checksum = flags;
+    netbuffer->checksum |= NetbufferChecksum ();
 
     if (!node)
     {
@@ -182,7 +332,26 @@ HSendPacket
 	fprintf (debugfile,"\n");
     }
 
+    TRACE_BEGIN ("HSendPacket");
+    I_NetCmd ();
+    TRACE_END ();
+    bytesout[node] += doomcom->wirelength;
+}
+
+//
+// HFlushPackets
+// The driver may hold sent packets back
+// to hand them to the system together
+//
+void HFlushPackets (void)
+{
+    if (!netgame || demoplayback)
+	return;
+    
+    doomcom->command = CMD_FLUSH;
+    TRACE_BEGIN ("HFlushPackets");
     I_NetCmd ();
+    TRACE_END ();
 }
 
 //
@@ -249,6 +418,8 @@ boolean HGetPacket (void)
 	    fprintf (debugfile,"\n");
 	}
     }
+
+    bytesin[doomcom->remotenode] += doomcom->wirelength;
     return true;	
 }
 
@@ -258,6 +429,9 @@ boolean HGetPacket (void)
 //
 char    exitmsg[80];
 
+void ServerGetPackets (void);
+void ClientGetPackets (void);
+
 void GetPackets (void)
 {
     int		netconsole;
@@ -265,11 +439,31 @@ void GetPackets (void)
     ticcmd_t	*src, *dest;
     int		realend;
     int		realstart;
+
+    if (netserver)
+    {
+	ServerGetPackets ();
+	return;
+    }
+    if (netclient)
+    {
+	ClientGetPackets ();
+	return;
+    }
 				 
     while ( HGetPacket() )
     {
 	if (netbuffer->checksum & NCMD_SETUP)
+	{
+	    // the key player answers late format offers
+	    if (!consoleplayer && GetFormat (false) >= 0)
+	    {
+		netbuffer->player = VERSION;
+		SetFormat (nodeformat[doomcom->remotenode], true);
+		HSendPacket (doomcom->remotenode, NCMD_SETUP);
+	    }
 	    continue;		// extra setup packet
+	}
 			
 	netconsole = netbuffer->player & ~PL_DRONE;
 	netnode = doomcom->remotenode;
@@ -358,13 +552,365 @@ void GetPackets (void)
 }
 
 
+//
+// ServerGetPackets
+// Queues the commands the clients send
+//
+void ServerGetPackets (void)
+{
+    int		netnode;
+    ticcmd_t	*src;
+    int		realend;
+    int		realstart;
+
+    while (HGetPacket ())
+    {
+	netnode = doomcom->remotenode;
+	if (netnode >= doomcom->numnodes || !nodeingame[netnode])
+	    continue;		// not one of our clients
+	
+	if (netbuffer->checksum & NCMD_SETUP)
+	    continue;		// extra join request
+
+	lastheard[netnode] = I_GetTime ();
+	
+	// check for a client leaving, the player
+	// is taken out at the next tic
+	if (netbuffer->checksum & NCMD_EXIT)
+	{
+	    nodeingame[netnode] = false;
+	    continue;
+	}
+
+	// check for retransmit request, in server tics
+	if ( resendcount[netnode] <= 0 
+	     && (netbuffer->checksum & NCMD_RETRANSMIT) )
+	{
+	    resendto[netnode] = ExpandTicsFrom (netbuffer->retransmitfrom,
+						gametic);
+	    if (debugfile)
+		fprintf (debugfile,"retransmit from %i\n", resendto[netnode]);
+	    resendcount[netnode] = RESENDCOUNT;
+	}
+	else
+	    resendcount[netnode]--;
+
+	// the commands are in client tics
+	realstart = ExpandTicsFrom (netbuffer->starttic, nettics[netnode]);
+	realend = (realstart+netbuffer->numtics);
+
+	// check for out of order / duplicated packet		
+	if (realend <= nettics[netnode])
+	    continue;
+	
+	// check for a missed packet
+	if (realstart > nettics[netnode])
+	{
+	    if (debugfile)
+		fprintf (debugfile,
+			 "missed tics from %i (%i - %i)\n",
+			 netnode, realstart, nettics[netnode]);
+	    remoteresend[netnode] = true;
+	    continue;
+	}
+
+	remoteresend[netnode] = false;
+		
+	src = &netbuffer->cmds[nettics[netnode] - realstart];
+	while (nettics[netnode] < realend)
+	{
+	    clientcmds[netnode][nettics[netnode]%BACKUPTICS] = *src++;
+	    nettics[netnode]++;
+	}
+
+	// drop the oldest commands if the queue overflowed
+	if (clientnext[netnode] < nettics[netnode] - BACKUPTICS)
+	    clientnext[netnode] = nettics[netnode] - BACKUPTICS;
+    }
+}
+
+
+//
+// ServerSendPackets
+// Sends each client the tics it has not had yet.
+// A packet never spans a change of the players in game.
+//
+void ServerSendPackets (void)
+{
+    int		i;
+    int		j;
+    int		node;
+    int		realstart;
+    int		mask;
+
+    for (node=1 ; node<doomcom->numnodes ; node++)
+    {
+	if (!nodeingame[node])
+	    continue;
+	
+	realstart = resendto[node];
+	mask = servermask[realstart%SERVERBACKUP];
+	
+	for (i=0 ; i<BACKUPTICS && realstart+i < gametic ; i++)
+	{
+	    if (servermask[(realstart+i)%SERVERBACKUP] != mask)
+		break;
+	    for (j=0 ; j<MAXPLAYERS ; j++)
+	    {
+		netbuffer->cmds[i*MAXPLAYERS+j] =
+		    servercmds[(realstart+i)%SERVERBACKUP][j];
+		// older clients check the original value
+		if (nodeformat[node] == NETFORMAT_LEGACY)
+		    netbuffer->cmds[i*MAXPLAYERS+j].consistancy =
+			serverold[(realstart+i)%SERVERBACKUP][j];
+	    }
+	}
+	
+	netbuffer->starttic = realstart;
+	netbuffer->numtics = i;
+	netbuffer->player = mask;
+
+	if (realstart+i == gametic)
+	    resendto[node] = gametic - doomcom->extratics;
+	else
+	    resendto[node] = realstart+i;
+	
+	if (remoteresend[node])
+	{
+	    netbuffer->retransmitfrom = nettics[node];
+	    HSendPacket (node, NCMD_SERVER|NCMD_RETRANSMIT);
+	}
+	else
+	{
+	    netbuffer->retransmitfrom = 0;
+	    HSendPacket (node, NCMD_SERVER);
+	}
+    }
+    HFlushPackets ();
+}
+
+
+//
+// ServerRunTics
+// Runs the tics that are due with whatever
+// the clients have sent by now
+//
+void ServerRunTics (void)
+{
+    int		nowtime;
+    int		newtics;
+    int		i;
+    int		node;
+    int		buf;
+    int		slot;
+    int		mask;
+    ticcmd_t*	cmd;
+
+    GetPackets ();
+    
+    nowtime = I_GetTime ();
+    newtics = nowtime - gametime;
+    gametime = nowtime;
+
+    if (newtics <= 0)
+    {
+	I_Sleep (1);
+	return;
+    }
+
+    // don't try to catch up on a long stall
+    if (newtics > TICRATE)
+	newtics = TICRATE;
+
+    while (newtics--)
+    {
+	// drop clients that left, went silent
+	// or are too far behind to resend to
+	for (node=1 ; node<doomcom->numnodes ; node++)
+	{
+	    if (!nodeingame[node])
+		continue;
+	    if (nowtime - lastheard[node] > SERVERTIMEOUT
+		|| gametic - resendto[node] >= SERVERBACKUP)
+	    {
+		printf ("dropped node %i\n", node);
+		nodeingame[node] = false;
+	    }
+	}
+
+	buf = gametic%BACKUPTICS;
+	slot = gametic%SERVERBACKUP;
+	mask = 0;
+	
+	for (i=0 ; i<MAXPLAYERS ; i++)
+	{
+	    cmd = &netcmds[i][buf];
+	    node = nodeforplayer[i];
+	    
+	    if (playeringame[i] && !nodeingame[node])
+	    {
+		playeringame[i] = false;
+		printf ("player %i left the game\n", i+1);
+	    }
+
+	    if (!playeringame[i])
+	    {
+		memset (cmd, 0, sizeof(*cmd));
+		servercmds[slot][i] = *cmd;
+		continue;
+	    }
+	    mask |= 1<<i;
+	    
+	    if (clientnext[node] < nettics[node])
+	    {
+		*cmd = clientcmds[node][clientnext[node]%BACKUPTICS];
+		clientnext[node]++;
+
+		// keep a client's queue short
+		if (nettics[node] - clientnext[node] > BACKUPTICS/2)
+		    clientnext[node]++;
+	    }
+	    else
+	    {
+		// nothing in time, stand still
+		memset (cmd, 0, sizeof(*cmd));
+	    }
+
+	    // what the clients must have for this player
+	    cmd->consistancy = consistancy[i][buf];
+	    servercmds[slot][i] = *cmd;
+	    serverold[slot][i] = oldconsistancy[i][buf];
+	}
+	servermask[slot] = mask;
+
+	G_Ticker ();
+	gametic++;
+    }
+
+    ServerSendPackets ();
+}
+
+
+//
+// ClientGetPackets
+// Stores the tics the server has run
+//
+void ClientGetPackets (void)
+{
+    int		netnode;
+    ticcmd_t	*src;
+    int		realend;
+    int		realstart;
+    int		i;
+
+    while (HGetPacket ())
+    {
+	if (netbuffer->checksum & NCMD_SETUP)
+	    continue;		// extra setup packet
+
+	netnode = doomcom->remotenode;
+	if (netnode != 1)
+	    continue;
+
+	lastheard[netnode] = I_GetTime ();
+	
+	if (netbuffer->checksum & NCMD_KILL)
+	    I_Error ("Killed by network driver");
+	if (netbuffer->checksum & NCMD_EXIT)
+	    I_Error ("The server has left the game");
+
+	// check for retransmit request, in client tics
+	if ( resendcount[netnode] <= 0 
+	     && (netbuffer->checksum & NCMD_RETRANSMIT) )
+	{
+	    resendto[netnode] = ExpandTics (netbuffer->retransmitfrom);
+	    if (debugfile)
+		fprintf (debugfile,"retransmit from %i\n", resendto[netnode]);
+	    resendcount[netnode] = RESENDCOUNT;
+	}
+	else
+	    resendcount[netnode]--;
+
+	if (!(netbuffer->checksum & NCMD_SERVER))
+	    continue;
+
+	realstart = ExpandTicsFrom (netbuffer->starttic, nettics[netnode]);
+	realend = (realstart+netbuffer->numtics);
+
+	// don't overwrite tics that have not been run,
+	// the rest will be asked for again
+	if (realend > gametic + BACKUPTICS)
+	{
+	    realend = gametic + BACKUPTICS;
+	    remoteresend[netnode] = true;
+	}
+	
+	// check for out of order / duplicated packet		
+	if (realend <= nettics[netnode])
+	    continue;
+	
+	// check for a missed packet
+	if (realstart > nettics[netnode])
+	{
+	    if (debugfile)
+		fprintf (debugfile,
+			 "missed tics from server (%i - %i)\n",
+			 realstart, nettics[netnode]);
+	    remoteresend[netnode] = true;
+	    continue;
+	}
+
+	if (realend == realstart + netbuffer->numtics)
+	    remoteresend[netnode] = false;
+	
+	src = &netbuffer->cmds[(nettics[netnode] - realstart)*MAXPLAYERS];
+	while (nettics[netnode] < realend)
+	{
+	    for (i=0 ; i<MAXPLAYERS ; i++)
+		netcmds[i][nettics[netnode]%BACKUPTICS] = *src++;
+	    netmask[nettics[netnode]%BACKUPTICS] = netbuffer->player;
+	    nettics[netnode]++;
+	}
+    }
+}
+
+
+//
+// ClientSetPlayers
+// Takes out the players the server
+// no longer runs the tic with
+//
+void ClientSetPlayers (int mask)
+{
+    int		i;
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (playeringame[i] && !(mask & (1<<i)))
+	{
+	    playeringame[i] = false;
+	    strcpy (exitmsg, "Player 1 left the game");
+	    exitmsg[7] += i;
+	    players[consoleplayer].message = exitmsg;
+	}
+    }
+
+    // a spectator goes on watching someone still playing
+    if (netspectator && !playeringame[displayplayer])
+	for (i=0 ; i<MAXPLAYERS ; i++)
+	    if (playeringame[i])
+	    {
+		displayplayer = i;
+		break;
+	    }
+}
+
+
 //
 // NetUpdate
 // Builds ticcmds for console player,
 // sends out a packet
 //
-int      gametime;
-
 void NetUpdate (void)
 {
     int             nowtime;
@@ -439,6 +985,7 @@ void NetUpdate (void)
 		HSendPacket (i, 0);
 	    }
 	}
+    HFlushPackets ();
     
     // listen for other packets
   listen:
@@ -457,7 +1004,10 @@ void CheckAbort (void)
 	
     stoptic = I_GetTime () + 2; 
     while (I_GetTime() < stoptic) 
+    {
 	I_StartTic (); 
+	I_Sleep (I_MSToTic (stoptic));
+    }
 	
     I_StartTic ();
     for ( ; eventtail != eventhead 
@@ -470,16 +1020,227 @@ void CheckAbort (void)
 }
 
 
+//
+// ServerArbitrate
+// Takes the first clients to join as players 1 and up,
+// until every player has started sending tics
+//
+void ServerArbitrate (void)
+{
+    int		i;
+    int		node;
+    int		numclients;
+    boolean	gotinfo[MAXNETNODES];
+	
+    memset (gotinfo,0,sizeof(gotinfo));
+
+    i = M_CheckParm ("-spectators");
+    if (i && i<myargc-1)
+	numspectators = atoi (myargv[i+1]);
+    if (numspectators < 0
+	|| numspectators > MAXNETNODES-1-doomcom->numplayers)
+	I_Error ("-spectators: %i, 0 to %i allowed with %i players",
+		 numspectators, MAXNETNODES-1-doomcom->numplayers,
+		 doomcom->numplayers);
+    numclients = doomcom->numplayers + numspectators;
+    
+    printf ("waiting for %i players, %i spectators...\n",
+	    doomcom->numplayers, numspectators);
+    do
+    {
+	I_WaitVBL (1);
+	while (HGetPacket ())
+	{
+	    node = doomcom->remotenode;
+	    
+	    if (!(netbuffer->checksum & NCMD_SETUP))
+	    {
+		// a client that has the setup info
+		if (node < doomcom->numnodes)
+		    gotinfo[node] = true;
+		continue;
+	    }
+
+	    // join request, from a new address
+	    // if it is past the known nodes
+	    if (node == doomcom->numnodes)
+	    {
+		if (netbuffer->player != VERSION
+		    || doomcom->numnodes > numclients)
+		{
+		    netbuffer->numtics = 0;
+		    HSendPacket (node, NCMD_KILL);
+		    continue;
+		}
+		// an older client would take SPECTATOR
+		// for a player number
+		if (node > doomcom->numplayers && GetFormat (false) < 0)
+		{
+		    printf ("refused an older client as a spectator\n");
+		    netbuffer->numtics = 0;
+		    HSendPacket (node, NCMD_KILL);
+		    continue;
+		}
+		// a client too old to be told the compat
+		// level would play its own
+		if (GetFormat (false) < 0 && compatlevel != compat_vanilla)
+		{
+		    printf ("refused an older client, "
+			    "not with -fastsectors\n");
+		    netbuffer->numtics = 0;
+		    HSendPacket (node, NCMD_KILL);
+		    continue;
+		}
+		if (node > doomcom->numplayers)
+		    printf ("spectator %i joined\n", node-doomcom->numplayers);
+		else
+		    printf ("player %i joined\n", node);
+		doomcom->numnodes++;
+		nodeformat[node] = GetFormat (false);
+		if (nodeformat[node] < 0)
+		    nodeformat[node] = NETFORMAT_LEGACY;
+	    }
+	    
+	    netbuffer->retransmitfrom = startskill;
+	    if (deathmatch)
+		netbuffer->retransmitfrom |= (deathmatch<<6);
+	    if (nomonsters)
+		netbuffer->retransmitfrom |= 0x20;
+	    if (respawnparm)
+		netbuffer->retransmitfrom |= 0x10;
+	    netbuffer->starttic = startepisode * 64 + startmap;
+	    // console player and number of players
+	    if (node > doomcom->numplayers)
+		netbuffer->player = SPECTATOR | (doomcom->numplayers<<4);
+	    else
+		netbuffer->player = (node-1) | (doomcom->numplayers<<4);
+	    SetFormat (nodeformat[node], true);
+	    HSendPacket (node, NCMD_SETUP);
+	}
+	
+	for (i=1 ; i<=numclients ; i++)
+	    if (!gotinfo[i])
+		break;
+    } while (i <= numclients);
+
+    // start the clock now
+    gametime = I_GetTime ();
+    for (i=1 ; i<doomcom->numnodes ; i++)
+	lastheard[i] = gametime;
+}
+
+
+//
+// ClientArbitrate
+// Asks the server to join until it answers
+// with the game setup and our player number
+//
+void ClientArbitrate (void)
+{
+    printf ("joining server...\n");
+    while (1)
+    {
+	netbuffer->player = VERSION;
+	SetFormat (NETFORMAT, false);
+	HSendPacket (1, NCMD_SETUP);
+	HFlushPackets ();
+
+	CheckAbort ();
+	while (HGetPacket ())
+	{
+	    if (doomcom->remotenode != 1)
+		continue;
+	    if (netbuffer->checksum & NCMD_KILL)
+		I_Error ("The server refused to let us join");
+	    if (netbuffer->checksum & NCMD_SETUP)
+	    {
+		startskill = netbuffer->retransmitfrom & 15;
+		deathmatch = (netbuffer->retransmitfrom & 0xc0) >> 6;
+		nomonsters = (netbuffer->retransmitfrom & 0x20) > 0;
+		respawnparm = (netbuffer->retransmitfrom & 0x10) > 0;
+		startmap = netbuffer->starttic & 0x3f;
+		startepisode = netbuffer->starttic >> 6;
+		doomcom->consoleplayer = netbuffer->player & 15;
+		doomcom->numplayers = netbuffer->player >> 4;
+		if (doomcom->consoleplayer == SPECTATOR)
+		{
+		    // watch the first player
+		    netspectator = true;
+		    doomcom->consoleplayer = 0;
+		}
+		nodeformat[1] = GetFormat (true);
+		if (nodeformat[1] < 0)
+		    nodeformat[1] = NETFORMAT_LEGACY;
+		compatlevel = GetCompat ();
+		lastheard[1] = I_GetTime ();
+		return;
+	    }
+	}
+    }
+}
+
+
+//
+// AgreeFormat
+// A key player that offered a format waits for every
+// node to offer one back before it answers, so all
+// nodes send the same format or none waits forever.
+//
+void AgreeFormat (int keynode)
+{
+    int		i;
+    int		format;
+    
+    printf ("agreeing on a packet format...\n");
+    while (1)
+    {
+	netbuffer->player = doomcom->consoleplayer;
+	SetFormat (NETFORMAT, false);
+	HSendPacket (keynode, NCMD_SETUP);
+	HFlushPackets ();
+
+	CheckAbort ();
+	while (HGetPacket ())
+	{
+	    if (doomcom->remotenode != keynode
+		|| !(netbuffer->checksum & NCMD_SETUP))
+		continue;
+	    format = GetFormat (true);
+	    if (format < 0)
+		continue;
+	    for (i=1 ; i<doomcom->numnodes ; i++)
+		nodeformat[i] = format;
+	    compatlevel = GetCompat ();
+	    return;
+	}
+    }
+}
+
+
 //
 // D_ArbitrateNetStart
 //
 void D_ArbitrateNetStart (void)
 {
     int		i;
+    int		format;
     boolean	gotinfo[MAXNETNODES];
+    boolean	gotformat[MAXNETNODES];
 	
     autostart = true;
     memset (gotinfo,0,sizeof(gotinfo));
+    memset (gotformat,0,sizeof(gotformat));
+
+    if (netserver)
+    {
+	ServerArbitrate ();
+	return;
+    }
+    if (netclient)
+    {
+	ClientArbitrate ();
+	return;
+    }
 	
     if (doomcom->consoleplayer)
     {
@@ -500,6 +1261,12 @@ void D_ArbitrateNetStart (void)
 		respawnparm = (netbuffer->retransmitfrom & 0x10) > 0;
 		startmap = netbuffer->starttic & 0x3f;
 		startepisode = netbuffer->starttic >> 6;
+
+		// older key players offer no format
+		if (GetFormat (false) >= 0)
+		    AgreeFormat (doomcom->remotenode);
+		else
+		    compatlevel = compat_vanilla;
 		return;
 	    }
 	}
@@ -522,15 +1289,22 @@ void D_ArbitrateNetStart (void)
 		    netbuffer->retransmitfrom |= 0x10;
 		netbuffer->starttic = startepisode * 64 + startmap;
 		netbuffer->player = VERSION;
-		netbuffer->numtics = 0;
+		SetFormat (NETFORMAT, false);
 		HSendPacket (i, NCMD_SETUP);
 	    }
+	    HFlushPackets ();
 
 #if 1
 	    for(i = 10 ; i  &&  HGetPacket(); --i)
 	    {
 		if((netbuffer->player&0x7f) < MAXNETNODES)
+		{
 		    gotinfo[netbuffer->player&0x7f] = true;
+		    // older nodes start sending tics instead
+		    if ((netbuffer->checksum & NCMD_SETUP)
+			&& GetFormat (false) >= 0)
+			gotformat[netbuffer->player&0x7f] = true;
+		}
 	    }
 #else
 	    while (HGetPacket ())
@@ -543,6 +1317,25 @@ void D_ArbitrateNetStart (void)
 		if (!gotinfo[i])
 		    break;
 	} while (i < doomcom->numnodes);
+
+	// the newest format only if every node knows it
+	format = NETFORMAT;
+	for (i=1 ; i<doomcom->numnodes ; i++)
+	    if (!gotformat[i])
+		format = NETFORMAT_LEGACY;
+
+	// older nodes can't be told the compat level
+	if (format == NETFORMAT_LEGACY)
+	    compatlevel = compat_vanilla;
+	
+	for (i=1 ; i<doomcom->numnodes ; i++)
+	{
+	    netbuffer->player = VERSION;
+	    SetFormat (format, true);
+	    HSendPacket (i, NCMD_SETUP);
+	    nodeformat[i] = format;
+	}
+	HFlushPackets ();
     }
 }
 
@@ -570,9 +1363,11 @@ void D_CheckNetGame (void)
 	I_Error ("Doomcom buffer invalid!");
     
     netbuffer = &doomcom->data;
-    consoleplayer = displayplayer = doomcom->consoleplayer;
+    netserver = (doomcom->netmode == NET_SERVER);
+    netclient = (doomcom->netmode == NET_CLIENT);
     if (netgame)
 	D_ArbitrateNetStart ();
+    consoleplayer = displayplayer = doomcom->consoleplayer;
 
     printf ("startskill %i  deathmatch: %i  startmap: %i  startepisode: %i\n",
 	    startskill, deathmatch, startmap, startepisode);
@@ -587,10 +1382,91 @@ void D_CheckNetGame (void)
 	playeringame[i] = true;
     for (i=0 ; i<doomcom->numnodes ; i++)
 	nodeingame[i] = true;
+
+    // the server runs every player, clients only
+    // the tics from the server, neither sends to itself
+    if (netserver || netclient)
+	nodeingame[0] = false;
+    if (netserver)
+	for (i=0 ; i<doomcom->numplayers ; i++)
+	    nodeforplayer[i] = i+1;
+
+    // the tic hash only if every node we check against
+    // agreed on a newer format, the server sends each
+    // client the value it can check
+    if (!netserver)
+	for (i=1 ; i<doomcom->numnodes ; i++)
+	    if (nodeformat[i] == NETFORMAT_LEGACY)
+		legacynodes = true;
 	
-    printf ("player %i of %i (%i nodes)\n",
-	    consoleplayer+1, doomcom->numplayers, doomcom->numnodes);
+    if (netspectator)
+	printf ("spectator of %i players\n", doomcom->numplayers);
+    else
+	printf ("player %i of %i (%i nodes)\n",
+		consoleplayer+1, doomcom->numplayers, doomcom->numnodes);
+
+    i = M_CheckParm ("-netbench");
+    if (i && i<myargc-1)
+	netbench = atoi (myargv[i+1]) * 1000000LL;
+
+}
+
+
+//
+// NetStats
+// Prints what each node cost on the wire
+//
+void NetStats (void)
+{
+    int		i;
+    int		tics;
+
+    tics = gametic ? gametic : 1;
+    for (i=1 ; i<doomcom->numnodes ; i++)
+	printf ("node %i: %s packets, %i bytes out, %i in, "
+		"%.1f out %.1f in per tic\n",
+		i, nodeformat[i] == NETFORMAT_DELTA ? "delta" : "legacy",
+		bytesout[i], bytesin[i],
+		(double)bytesout[i]/tics, (double)bytesin[i]/tics);
+
+    G_PredictionStats ();
+}
 
+
+//
+// EndStall
+//
+void EndStall (long long start)
+{
+    long long	stall;
+
+    stall = I_GetTimeUS () - start;
+    stalltime += stall;
+    if (stall > maxstall)
+	maxstall = stall;
+    stalls++;
+}
+
+
+//
+// NetBenchReport
+// How well the tics kept up with the clock
+//
+void NetBenchReport (void)
+{
+    double	seconds;
+    int		tics;
+
+    seconds = (I_GetTimeUS () - benchstart) / 1000000.0;
+    tics = gametic - benchtic;
+    printf ("netbench: %i tics in %.1f s, %.2f tics/s of %i\n",
+	    tics, seconds, tics/seconds, TICRATE);
+    printf ("netbench: waited %.1f ms for tics (%.1f%%), "
+	    "%i waits, longest %.1f ms\n",
+	    stalltime/1000.0, stalltime/(seconds*10000.0),
+	    stalls, maxstall/1000.0);
+    I_LoopbackStats ();
+    I_Quit ();
 }
 
 
@@ -605,6 +1481,9 @@ void D_QuitNetGame (void)
 	
     if (debugfile)
 	fclose (debugfile);
+
+    if (netgame && M_CheckParm ("-netstats"))
+	NetStats ();
 		
     if (!netgame || !usergame || consoleplayer == -1 || demoplayback)
 	return;
@@ -617,6 +1496,7 @@ void D_QuitNetGame (void)
 	for (j=1 ; j<doomcom->numnodes ; j++)
 	    if (nodeingame[j])
 		HSendPacket (j, NCMD_EXIT);
+	HFlushPackets ();
 	I_WaitVBL (1);
     }
 }
@@ -643,6 +1523,14 @@ void TryRunTics (void)
     int		availabletics;
     int		counts;
     int		numplaying;
+    long long	stallstart;
+    boolean	waiting;
+    
+    if (netserver)
+    {
+	ServerRunTics ();
+	return;
+    }
     
     // get real tics		
     entertic = I_GetTime ()/ticdup;
@@ -683,7 +1571,8 @@ void TryRunTics (void)
 		 "=======real: %i  avail: %i  game: %i\n",
 		 realtics, availabletics,counts);
 
-    if (!demoplayback)
+    // a client just keeps up with the server
+    if (!demoplayback && !netclient)
     {	
 	// ideally nettics[0] should be 1 - 3 tics above lowtic
 	// if we are consistantly slower, speed up time
@@ -711,26 +1600,55 @@ void TryRunTics (void)
 	}
     }// demoplayback
 	
+    if (netbench && !benchstart)
+    {
+	benchstart = I_GetTimeUS ();
+	benchtic = gametic;
+    }
+    
     // wait for new tics if needed
+    stallstart = 0;
+    waiting = lowtic < gametic/ticdup + counts;
+    if (waiting)
+	TRACE_BEGIN ("TryRunTics wait");
     while (lowtic < gametic/ticdup + counts)	
     {
+	// sleep until our next tic is due or a packet comes
+	I_NetWait (I_MSToTic ((gametime+1)*ticdup));
 	NetUpdate ();   
 	lowtic = MAXINT;
 	
 	for (i=0 ; i<doomcom->numnodes ; i++)
 	    if (nodeingame[i] && nettics[i] < lowtic)
 		lowtic = nettics[i];
+
+	// a stall is waiting on the other
+	// nodes after our own tics are made
+	if (!stallstart
+	    && lowtic < gametic/ticdup + counts
+	    && maketic >= gametic/ticdup + counts)
+	    stallstart = I_GetTimeUS ();
 	
 	if (lowtic < gametic/ticdup)
 	    I_Error ("TryRunTics: lowtic < gametic");
+
+	if (netclient && I_GetTime () - lastheard[1] > SERVERTIMEOUT)
+	    I_Error ("Lost the connection to the server");
 				
 	// don't stay in here forever -- give the menu a chance to work
 	if (I_GetTime ()/ticdup - entertic >= 20)
 	{
+	    if (stallstart)
+		EndStall (stallstart);
+	    TRACE_END ();
 	    M_Ticker ();
 	    return;
 	} 
     }
+    if (stallstart)
+	EndStall (stallstart);
+    if (waiting)
+	TRACE_END ();
     
     // run the count * ticdup dics
     while (counts--)
@@ -741,6 +1659,8 @@ void TryRunTics (void)
 		I_Error ("gametic>lowtic");
 	    if (advancedemo)
 		D_DoAdvanceDemo ();
+	    if (netclient)
+		ClientSetPlayers (netmask[(gametic/ticdup)%BACKUPTICS]);
 	    M_Ticker ();
 	    G_Ticker ();
 	    gametic++;
@@ -764,4 +1684,7 @@ void TryRunTics (void)
 	}
 	NetUpdate ();	// check for new console commands
     }
+
+    if (netbench && I_GetTimeUS () - benchstart >= netbench)
+	NetBenchReport ();
 }
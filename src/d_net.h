@@ -41,8 +41,9 @@
 
 #define DOOMCOM_ID		0x12345678l
 
-// Max computers/players in a game.
-#define MAXNETNODES		8
+// Max computers in a game. Only a server has more
+//  than MAXPLAYERS, for its spectators.
+#define MAXNETNODES		32
 
 
 // Networking and tick handling related.
@@ -51,11 +52,50 @@
 typedef enum
 {
     CMD_SEND	= 1,
-    CMD_GET	= 2
+    CMD_GET	= 2,
+    CMD_FLUSH	= 3	// send what the driver has queued
 
 } command_t;
 
 
+//
+// Client/server play.
+// A dedicated server runs the game for up to
+//  MAXPLAYERS clients, each of which only talks
+//  to the server, its node 1. The server is node 0
+//  of its own game, the clients its nodes 1 and up.
+//
+typedef enum
+{
+    NET_PEER,		// original peer to peer lockstep
+    NET_SERVER,		// dedicated server, draws nothing
+    NET_CLIENT		// runs the tics a server sends
+
+} netmode_t;
+
+// Flags in doomdata_t checksum.
+#define	NCMD_EXIT		0x80000000
+#define	NCMD_RETRANSMIT		0x40000000
+#define	NCMD_SETUP		0x20000000
+#define	NCMD_KILL		0x10000000	// kill game
+#define	NCMD_CHECKSUM	 	0x03ffffff
+
+// Set in doomdata_t checksum for server tic packets,
+//  which carry the commands of all MAXPLAYERS
+//  players for each tic.
+#define	NCMD_SERVER		0x08000000
+
+// Set in doomdata_t checksum for packets sent in
+//  NETFORMAT_DELTA, where each ticcmd only has the
+//  fields that changed from the one before it.
+#define	NCMD_DELTA		0x04000000
+
+// Packet formats, agreed on in D_ArbitrateNetStart.
+#define	NETFORMAT_LEGACY	0	// byte swapped ticcmd_t
+#define	NETFORMAT_DELTA		1	// see NCMD_DELTA
+#define	NETFORMAT		NETFORMAT_DELTA	// newest we know
+
+
 //
 // Network packet data.
 //
@@ -67,9 +107,11 @@ typedef struct
     byte		retransmitfrom;
     
     byte		starttic;
+    // Bit mask of the players in game
+    //  for NCMD_SERVER packets.
     byte		player;
     byte		numtics;
-    ticcmd_t		cmds[BACKUPTICS];
+    ticcmd_t		cmds[BACKUPTICS*MAXPLAYERS];
 
 } doomdata_t;
 
@@ -91,6 +133,9 @@ typedef struct
     
     // Number of bytes in doomdata to be sent
     short		datalength;
+    // Bytes the last packet sent or got took
+    //  on the wire, set by the driver.
+    short		wirelength;
 
     // Info common to all nodes.
     // Console is allways node 0.
@@ -121,6 +166,9 @@ typedef struct
     // 1 = drone
     short		drone;		
 
+    // Is a netmode_t.
+    short		netmode;
+
     // The packet data to be sent.
     doomdata_t		data;
     
@@ -128,6 +176,9 @@ typedef struct
 
 
 
+// Number of ticcmds in the netbuffer packet.
+int NetbufferCmds (void);
+
 // Create any new ticcmds and broadcast to other players.
 void NetUpdate (void);
 
@@ -49,9 +49,26 @@
 extern  boolean	nomonsters;	// checkparm of -nomonsters
 extern  boolean	respawnparm;	// checkparm of -respawn
 extern  boolean	fastparm;	// checkparm of -fast
+extern  boolean	predict;	// checkparm of -predict
 
 extern  boolean	devparm;	// DEBUG: launched with -devparm
 
+// Changes to the game that play differently from the
+// original are only made above compat_vanilla.  All nodes
+// of a net game and a demo and its recording must agree,
+// so it is fixed at startup, sent with the game setup and
+// kept in demo headers, never taken from a node's own flags.
+typedef enum
+{
+    compat_vanilla,	// plays like the original
+    compat_metal,	// -fastsectors, P_ChangeSector walks thing lists
+    NUMCOMPATLEVELS
+
+} compat_t;
+
+extern  compat_t	compatlevel;	// the one in play
+extern  compat_t	defaultcompat;	// from the command line
+
 
 
 // -----------------------------------------------------
@@ -286,6 +303,20 @@ extern  int             nettics[MAXNETNODES];
 extern  ticcmd_t        netcmds[MAXPLAYERS][BACKUPTICS];
 extern	int		ticdup;
 
+// Client/server play, see netmode_t.
+extern	boolean		netserver;
+extern	boolean		netclient;
+extern	boolean		netspectator;
+extern	boolean		legacynodes;	// check the original consistancy
+
+// Set while G_Predict runs the console player
+// ahead of the game, see g_game.c.
+extern	boolean		predicting;
+
+// Set while G_DoDemoSeek runs a demo to where
+// it was asked to go, see g_game.c.
+extern	boolean		demoseeking;
+
 
 
 #endif
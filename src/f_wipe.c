@@ -26,6 +26,10 @@ static const char rcsid[] = "$Id: f_wipe.c,v 1.2 1997/02/03 22:45:09 b1 Exp $";
 
 
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "z_zone.h"
 #include "i_video.h"
 #include "v_video.h"
@@ -38,43 +42,25 @@ static const char rcsid[] = "$Id: f_wipe.c,v 1.2 1997/02/03 22:45:09 b1 Exp $";
 //
 //                       SCREEN WIPE PACKAGE
 //
+// The game keeps running under a wipe, so the new screen
+// is whatever was just drawn to screens[0], and each frame
+// draws what is left of the old one over it.
+//
 
 // when zero, stop the wipe
 static boolean	go = 0;
 
 static byte*	wipe_scr_start;
-static byte*	wipe_scr_end;
 static byte*	wipe_scr;
 
 
-void
-wipe_shittyColMajorXform
-( short*	array,
-  int		width,
-  int		height )
-{
-    int		x;
-    int		y;
-    short*	dest;
-
-    dest = (short*) Z_Malloc(width*height*2, PU_STATIC, 0);
-
-    for(y=0;y<height;y++)
-	for(x=0;x<width;x++)
-	    dest[x*height+y] = array[y*width+x];
-
-    memcpy(array, dest, width*height*2);
-
-    Z_Free(dest);
-
-}
-
 int
 wipe_initColorXForm
 ( int	width,
   int	height,
   int	ticks )
 {
+    wipe_scr = (byte *) Z_Malloc(width*height, PU_STATIC, 0);
     memcpy(wipe_scr, wipe_scr_start, width*height);
     return 0;
 }
@@ -92,7 +78,7 @@ wipe_doColorXForm
 
     changed = false;
     w = wipe_scr;
-    e = wipe_scr_end;
+    e = screens[0];
     
     while (w!=wipe_scr+width*height)
     {
@@ -121,6 +107,7 @@ wipe_doColorXForm
 	e++;
     }
 
+    memcpy(screens[0], wipe_scr, width*height);
     return !changed;
 
 }
@@ -131,6 +118,7 @@ wipe_exitColorXForm
   int	height,
   int	ticks )
 {
+    Z_Free(wipe_scr);
     return 0;
 }
 
@@ -145,14 +133,6 @@ wipe_initMelt
 {
     int i, r;
     
-    // copy start screen to main screen
-    memcpy(wipe_scr, wipe_scr_start, width*height);
-    
-    // makes this wipe faster (in theory)
-    // to have stuff in column-major format
-    wipe_shittyColMajorXform((short*)wipe_scr_start, width/2, height);
-    wipe_shittyColMajorXform((short*)wipe_scr_end, width/2, height);
-    
     // setup initial column positions
     // (y<0 => not ready to scroll yet)
     y = (int *) Z_Malloc(width*sizeof(int), PU_STATIC, 0);
@@ -168,6 +148,119 @@ wipe_initMelt
     return 0;
 }
 
+
+#ifdef __SSE2__
+//
+// wipe_meltBlock
+// Eight columns at once, straight from the row-major
+// screens.  The columns that have slid the same way read
+// the same row of the old screen, so each row takes one
+// load for every distance among the eight.
+//
+static void
+wipe_meltBlock
+( short*	start,
+  short*	dest,
+  int*		pos,
+  int		width,
+  int		height )
+{
+    __m128i	ys;
+    __m128i	masks[8];
+    __m128i	moved;
+    __m128i	pixels;
+    short	lane[8];
+    int		dist[8];
+    int		num;
+    int		last;
+    int		i;
+    int		j;
+    int		k;
+    int		row;
+
+    ys = _mm_packs_epi32(_mm_loadu_si128((__m128i *)pos),
+			 _mm_loadu_si128((__m128i *)(pos+4)));
+    ys = _mm_max_epi16(ys, _mm_setzero_si128());
+    ys = _mm_min_epi16(ys, _mm_set1_epi16(height));
+    _mm_storeu_si128((__m128i *)lane, ys);
+
+    // the distances in order, leaving out finished columns
+    num = 0;
+    for (i=0;i<8;i++)
+    {
+	if (lane[i] == height)
+	    continue;
+	for (j=0;j<num && dist[j]<lane[i];j++)
+	    ;
+	if (j<num && dist[j] == lane[i])
+	    continue;
+	for (k=num;k>j;k--)
+	    dist[k] = dist[k-1];
+	dist[j] = lane[i];
+	num++;
+    }
+
+    // rows above a column's distance keep the new screen
+    moved = _mm_setzero_si128();
+    for (k=0;k<num;k++)
+    {
+	masks[k] = _mm_cmpeq_epi16(ys, _mm_set1_epi16(dist[k]));
+	moved = _mm_or_si128(moved, masks[k]);
+	last = k+1 < num ? dist[k+1] : height;
+
+	for (row=dist[k];row<last;row++)
+	{
+	    pixels = _mm_andnot_si128(moved,
+			_mm_loadu_si128((__m128i *)&dest[row*width]));
+	    for (j=0;j<=k;j++)
+		pixels = _mm_or_si128(pixels, _mm_and_si128(masks[j],
+			_mm_loadu_si128((__m128i *)&start[(row-dist[j])*width])));
+	    _mm_storeu_si128((__m128i *)&dest[row*width], pixels);
+	}
+    }
+}
+#endif
+
+
+//
+// wipe_drawMelt
+// Slides each column of the old screen down
+// over the new one, by whole shorts
+//
+void
+wipe_drawMelt
+( int	width,
+  int	height )
+{
+    int		i;
+    int		j;
+    int		dy;
+    short*	s;
+    short*	d;
+
+    i = 0;
+#ifdef __SSE2__
+    for ( ;i+8<=width;i+=8)
+	wipe_meltBlock((short *)wipe_scr_start+i, (short *)screens[0]+i,
+		       y+i, width, height);
+#endif
+
+    for ( ;i<width;i++)
+    {
+	if (y[i] >= height)
+	    continue;
+	dy = y[i] < 0 ? 0 : y[i];
+	s = &((short *)wipe_scr_start)[i];
+	d = &((short *)screens[0])[dy*width+i];
+	for (j=height-dy;j;j--)
+	{
+	    *d = *s;
+	    s += width;
+	    d += width;
+	}
+    }
+}
+
 int
 wipe_doMelt
 ( int	width,
@@ -175,18 +268,14 @@ wipe_doMelt
   int	ticks )
 {
     int		i;
-    int		j;
     int		dy;
-    int		idx;
-    
-    short*	s;
-    short*	d;
     boolean	done = true;
 
     width/=2;
 
     while (ticks--)
     {
+	done = true;
 	for (i=0;i<width;i++)
 	{
 	    if (y[i]<0)
@@ -197,29 +286,16 @@ wipe_doMelt
 	    {
 		dy = (y[i] < 16) ? y[i]+1 : 8;
 		if (y[i]+dy >= height) dy = height - y[i];
-		s = &((short *)wipe_scr_end)[i*height+y[i]];
-		d = &((short *)wipe_scr)[y[i]*width+i];
-		idx = 0;
-		for (j=dy;j;j--)
-		{
-		    d[idx] = *(s++);
-		    idx += width;
-		}
 		y[i] += dy;
-		s = &((short *)wipe_scr_start)[i*height];
-		d = &((short *)wipe_scr)[y[i]*width+i];
-		idx = 0;
-		for (j=height-y[i];j;j--)
-		{
-		    d[idx] = *(s++);
-		    idx += width;
-		}
 		done = false;
 	    }
 	}
+	if (done)
+	    return true;
     }
 
-    return done;
+    wipe_drawMelt(width, height);
+    return false;
 
 }
 
@@ -233,28 +309,33 @@ wipe_exitMelt
     return 0;
 }
 
-int
-wipe_StartScreen
-( int	x,
-  int	y,
-  int	width,
-  int	height )
+static int (*wipes[])(int, int, int) =
 {
-    wipe_scr_start = screens[2];
-    I_ReadScreen(wipe_scr_start);
-    return 0;
-}
+    wipe_initColorXForm, wipe_doColorXForm, wipe_exitColorXForm,
+    wipe_initMelt, wipe_doMelt, wipe_exitMelt
+};
+
+// the one going, while go is set
+static int	wipeon;
 
 int
-wipe_EndScreen
+wipe_StartScreen
 ( int	x,
   int	y,
   int	width,
   int	height )
 {
-    wipe_scr_end = screens[3];
-    I_ReadScreen(wipe_scr_end);
-    V_DrawBlock(x, y, 0, width, height, wipe_scr_start); // restore start scr.
+    // a wipe can start over the last one,
+    // from what that had on the screen
+    if (go)
+    {
+	go = 0;
+	(*wipes[wipeon*3+2])(width, height, 0);
+    }
+
+    // not screens[2], a screen shot can come mid wipe
+    wipe_scr_start = screens[3];
+    I_ReadScreen(wipe_scr_start);
     return 0;
 }
 
@@ -268,11 +349,6 @@ wipe_ScreenWipe
   int	ticks )
 {
     int rc;
-    static int (*wipes[])(int, int, int) =
-    {
-	wipe_initColorXForm, wipe_doColorXForm, wipe_exitColorXForm,
-	wipe_initMelt, wipe_doMelt, wipe_exitMelt
-    };
 
     void V_MarkRect(int, int, int, int);
 
@@ -280,15 +356,13 @@ wipe_ScreenWipe
     if (!go)
     {
 	go = 1;
-	// wipe_scr = (byte *) Z_Malloc(width*height, PU_STATIC, 0); // DEBUG
-	wipe_scr = screens[0];
+	wipeon = wipeno;
 	(*wipes[wipeno*3])(width, height, ticks);
     }
 
     // do a piece of wipe-in
     V_MarkRect(0, 0, width, height);
     rc = (*wipes[wipeno*3+1])(width, height, ticks);
-    //  V_DrawBlock(x, y, 0, width, height, wipe_scr); // DEBUG
 
     // final stuff
     if (rc)
@@ -46,14 +46,10 @@ wipe_StartScreen
   int		height );
 
 
-int
-wipe_EndScreen
-( int		x,
-  int		y,
-  int		width,
-  int		height );
-
-
+// Advances the wipe by ticks and draws what is left
+// of the start screen over the new one in screens[0],
+// true once it is done.  Called every frame, with
+// the new screen drawn fresh each time.
 int
 wipe_ScreenWipe
 ( int		wipeno,
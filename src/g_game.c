@@ -35,11 +35,15 @@ rcsid[] = "$Id: g_game.c,v 1.8 1997/02/03 22:45:09 b1 Exp $";
 #include "m_argv.h"
 #include "m_misc.h"
 #include "m_menu.h"
+#include "m_bench.h"
+#include "m_trace.h"
+#include "m_stream.h"
 #include "m_random.h"
 #include "i_system.h"
 
 #include "p_setup.h"
 #include "p_saveg.h"
+#include "p_chksum.h"
 #include "p_tick.h"
 
 #include "d_main.h"
@@ -92,6 +96,12 @@ void	G_DoCompleted (void);
 void	G_DoVictory (void); 
 void	G_DoWorldDone (void); 
 void	G_DoSaveGame (void); 
+void	G_DemoSnapshot (void);
+void	G_FreeDemoSnapshots (void);
+void	G_AddDemoSum (void);
+void	G_WriteDemoSums (void);
+void	G_FlushDemo (void);
+void	G_CheckDemoSum (void);
  
  
 gameaction_t    gameaction; 
@@ -132,12 +142,28 @@ byte*		demobuffer;
 byte*		demo_p;
 byte*		demoend; 
 boolean         singledemo;            	// quit after playing a demo from cmdline 
+int		demotic;		// demo tics read so far
+int		demowritten;		// bytes recorded before demobuffer
+int		demoflushtic;		// gametic of the last G_FlushDemo
+int		demomaxsize;		// -maxdemo, or 0 for no end
+byte*		cutdemo;		// a demo without its end marker
+boolean		demoseeking;		// running tics to get to demoseektic
+
+// The hash of every tic goes after the end of a recorded
+// demo, see G_WriteDemoSums, and is checked on playback.
+unsigned*	recordsums;
+int		numrecordsums;
+int		maxrecordsums;
+byte*		demosums;		// in demobuffer, or NULL
+int		numdemosums;
+boolean		demosumfailed;
  
 boolean         precache = true;        // if true, load all graphics at start 
  
 wbstartstruct_t wminfo;               	// parms for world map / intermission 
  
 short		consistancy[MAXPLAYERS][BACKUPTICS]; 
+short		oldconsistancy[MAXPLAYERS][BACKUPTICS];	// for older nodes
  
 byte*		savebuffer;
  
@@ -207,8 +233,6 @@ int		savegameslot;
 char		savedescription[32]; 
  
  
-#define	BODYQUESIZE	32
-
 mobj_t*		bodyque[BODYQUESIZE]; 
 int		bodyqueslot; 
  
@@ -505,7 +529,8 @@ boolean G_Responder (event_t* ev)
 { 
     // allow spy mode changes even during the demo
     if (gamestate == GS_LEVEL && ev->type == ev_keydown 
-	&& ev->data1 == KEY_F12 && (singledemo || !deathmatch) )
+	&& ev->data1 == KEY_F12
+	&& (singledemo || !deathmatch || netspectator) )
     {
 	// spy mode 
 	do 
@@ -517,6 +542,21 @@ boolean G_Responder (event_t* ev)
 	return true; 
     }
     
+    // the arrows seek back and forth in demos
+    if (demoplayback && !timingdemo && ev->type == ev_keydown
+	&& (ev->data1 == KEY_LEFTARROW || ev->data1 == KEY_RIGHTARROW))
+    {
+	if (demoseektic == -1)
+	    demoseektic = demotic;
+	if (ev->data1 == KEY_LEFTARROW)
+	    demoseektic -= DEMOSEEKSTEP;
+	else
+	    demoseektic += DEMOSEEKSTEP;
+	if (demoseektic < 0)
+	    demoseektic = 0;
+	return true;
+    }
+    
     // any other key pops up menu if in demos
     if (gameaction == ga_nothing && !singledemo && 
 	(demoplayback || gamestate == GS_DEMOSCREEN) 
@@ -598,6 +638,128 @@ boolean G_Responder (event_t* ev)
  
  
  
+//
+// PREDICTION
+// With -predict the console player moves ahead of the
+// tics the other nodes have sent, with the commands
+// already made for it, so input shows without waiting
+// on the slowest node. G_EndPredict undoes the predicted
+// tics before the next real one, which then runs from
+// the state every node agrees on.
+//
+boolean		predict;		// checkparm of -predict
+boolean		predicting;		// running predicted tics
+boolean		predicted;		// the player is ahead
+playersnap_t	predictsnap;
+
+// where the latest prediction put the player, per tic
+typedef struct
+{
+    int		tic;			// gametic+1, 0 if none
+    fixed_t	x;
+    fixed_t	y;
+    fixed_t	z;
+    angle_t	angle;
+    
+} predictpos_t;
+
+predictpos_t	predictpos[BACKUPTICS];
+int		predictedtics;
+int		mispredictions;
+
+
+//
+// G_Predict
+//
+void G_Predict (void)
+{
+    player_t*		player;
+    predictpos_t*	pos;
+    int			tic;
+
+    if (!predict || !netgame || netserver || netclient
+	|| demoplayback || ticdup != 1
+	|| gamestate != GS_LEVEL || gameaction != ga_nothing || paused)
+	return;
+    
+    player = &players[consoleplayer];
+    if (player->playerstate != PST_LIVE || maketic <= gametic)
+	return;
+
+    P_SnapshotPlayer (player, &predictsnap);
+    predicted = true;
+    predicting = true;
+
+    for (tic = gametic ; tic < maketic ; tic++)
+    {
+	P_PredictPlayer (player, &localcmds[tic%BACKUPTICS]);
+
+	pos = &predictpos[tic%BACKUPTICS];
+	pos->tic = tic+1;
+	pos->x = player->mo->x;
+	pos->y = player->mo->y;
+	pos->z = player->mo->z;
+	pos->angle = player->mo->angle;
+    }
+    
+    predicting = false;
+}
+
+
+//
+// G_EndPredict
+// Called after the predicted frame is drawn
+//
+void G_EndPredict (void)
+{
+    if (!predicted)
+	return;
+
+    P_RestorePlayer (&predictsnap);
+    predicted = false;
+}
+
+
+//
+// G_CheckPrediction
+// Counts the tics the real game ran
+// somewhere the prediction did not
+//
+void G_CheckPrediction (void)
+{
+    predictpos_t*	pos;
+    mobj_t*		mo;
+
+    pos = &predictpos[gametic%BACKUPTICS];
+    if (pos->tic != gametic+1)
+	return;
+    pos->tic = 0;
+
+    mo = players[consoleplayer].mo;
+    predictedtics++;
+    if (mo->x != pos->x
+	|| mo->y != pos->y
+	|| mo->z != pos->z
+	|| mo->angle != pos->angle)
+	mispredictions++;
+}
+
+
+//
+// G_PredictionStats
+//
+void G_PredictionStats (void)
+{
+    if (!predictedtics)
+	return;
+
+    printf ("prediction: %i of %i tics missed, %.1f per minute\n",
+	    mispredictions, predictedtics,
+	    mispredictions * (60.0*TICRATE) / (gametic ? gametic : 1));
+}
+
+
+
 //
 // G_Ticker
 // Make ticcmd_ts for the players.
@@ -608,6 +770,8 @@ void G_Ticker (void)
     int		buf; 
     ticcmd_t*	cmd;
     
+    TRACE_BEGIN ("G_Ticker");
+
     // do player reborns if needed
     for (i=0 ; i<MAXPLAYERS ; i++) 
 	if (playeringame[i] && players[i].playerstate == PST_REBORN) 
@@ -651,6 +815,10 @@ void G_Ticker (void)
 	} 
     }
     
+    // keep the level now and then for seeking
+    if (demoplayback && gamestate == GS_LEVEL && demosnaptics > 0)
+	G_DemoSnapshot ();
+    
     // get commands, check consistancy,
     // and build new consistancy check
     buf = (gametic/ticdup)%BACKUPTICS; 
@@ -683,17 +851,26 @@ void G_Ticker (void)
 		if (gametic > BACKUPTICS 
 		    && consistancy[i][buf] != cmd->consistancy) 
 		{ 
-		    I_Error ("consistency failure (%i should be %i)",
-			     cmd->consistancy, consistancy[i][buf]); 
+		    I_Error ("consistency failure at tic %i (%i should be %i)",
+			     gametic, cmd->consistancy, consistancy[i][buf]); 
 		} 
 		if (players[i].mo) 
-		    consistancy[i][buf] = players[i].mo->x; 
+		    oldconsistancy[i][buf] = players[i].mo->x; 
 		else 
-		    consistancy[i][buf] = rndindex; 
+		    oldconsistancy[i][buf] = rndindex; 
+		// the whole level, not just where the player is,
+		// unless an older node checks the original value
+		if (legacynodes)
+		    consistancy[i][buf] = oldconsistancy[i][buf];
+		else
+		    consistancy[i][buf] = tichash ^ (tichash>>16); 
 	    } 
 	}
     }
     
+    if (demoplayback)
+	demotic++;
+    
     // check for special buttons
     for (i=0 ; i<MAXPLAYERS ; i++)
     {
@@ -727,7 +904,10 @@ void G_Ticker (void)
     switch (gamestate) 
     { 
       case GS_LEVEL: 
+	checksumming = netgame || demorecording || demosums || statelog;
 	P_Ticker (); 
+	if (predict)
+	    G_CheckPrediction ();
 	ST_Ticker (); 
 	AM_Ticker (); 
 	HU_Ticker ();            
@@ -745,6 +925,13 @@ void G_Ticker (void)
 	D_PageTicker (); 
 	break; 
     }        
+
+    if (demorecording)
+	G_AddDemoSum ();
+    if (demoplayback && demosums)
+	G_CheckDemoSum ();
+
+    TRACE_END ();
 } 
  
  
@@ -1345,6 +1532,7 @@ G_DeferedInitNew
 void G_DoNewGame (void) 
 {
     demoplayback = false; 
+    compatlevel = defaultcompat;
     netdemo = false;
     netgame = false;
     deathmatch = false;
@@ -1487,6 +1675,10 @@ G_InitNew
 // 
 #define DEMOMARKER		0x80
 
+// demos recorded with -fastsectors start with this instead
+// of VERSION, so the original game won't play them out of sync
+#define METALVERSION		(VERSION+128)
+
 
 void G_ReadDemoTiccmd (ticcmd_t* cmd) 
 { 
@@ -1507,12 +1699,17 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
 { 
     if (gamekeydown['q'])           // press q to end demo recording 
 	G_CheckDemoStatus (); 
+
+    // to disk at least once a second
+    if (demo_p > demoend - 16 || gametic - demoflushtic >= TICRATE)
+	G_FlushDemo ();
+
     *demo_p++ = cmd->forwardmove; 
     *demo_p++ = cmd->sidemove; 
     *demo_p++ = (cmd->angleturn+128)>>8; 
     *demo_p++ = cmd->buttons; 
     demo_p -= 4; 
-    if (demo_p > demoend - 16)
+    if (demomaxsize && demowritten + (demo_p - demobuffer) > demomaxsize - 16)
     {
 	// no more space 
 	G_CheckDemoStatus (); 
@@ -1521,6 +1718,106 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
 	
     G_ReadDemoTiccmd (cmd);         // make SURE it is exactly the same 
 } 
+
+
+//
+// G_FlushDemo
+// Hands what was recorded since the last flush to the
+// stream thread and carries on in its other buffer.
+//
+void G_FlushDemo (void)
+{
+    demowritten += demo_p - demobuffer;
+    demobuffer = demo_p = M_StreamSwap (demo_p - demobuffer);
+    demoend = demobuffer + STREAMBUFFER;
+    demoflushtic = gametic;
+}
+
+
+//
+// G_AddDemoSum
+// Keeps the hash of the tic just recorded.
+//
+void G_AddDemoSum (void)
+{
+    unsigned*	newsums;
+
+    if (numrecordsums == maxrecordsums)
+    {
+	maxrecordsums = maxrecordsums ? maxrecordsums*2 : 4096;
+	newsums = Z_Malloc (maxrecordsums*sizeof(*newsums), PU_STATIC, 0);
+	if (recordsums)
+	{
+	    memcpy (newsums, recordsums, numrecordsums*sizeof(*newsums));
+	    Z_Free (recordsums);
+	}
+	recordsums = newsums;
+    }
+    recordsums[numrecordsums++] = tichash;
+}
+
+
+//
+// G_PutLong
+//
+static byte* G_PutLong (byte* p, unsigned value)
+{
+    *p++ = value;
+    *p++ = value>>8;
+    *p++ = value>>16;
+    *p++ = value>>24;
+    return p;
+}
+
+
+//
+// G_WriteDemoSums
+// After the marker, where other ports stop reading:
+// "SUMS", the number of tics, and the hash of each,
+// all little endian.
+//
+void G_WriteDemoSums (void)
+{
+    int		i;
+
+    if (demo_p > demoend - 8)
+	G_FlushDemo ();
+    memcpy (demo_p, "SUMS", 4);
+    demo_p = G_PutLong (demo_p+4, numrecordsums);
+    for (i=0 ; i<numrecordsums ; i++)
+    {
+	if (demo_p > demoend - 4)
+	    G_FlushDemo ();
+	demo_p = G_PutLong (demo_p, recordsums[i]);
+    }
+}
+
+
+//
+// G_CheckDemoSum
+// Against the hash recorded for the tic just played.
+//
+void G_CheckDemoSum (void)
+{
+    static char	summessage[40];
+    byte*	p;
+    unsigned	sum;
+
+    if (demosumfailed || demotic > numdemosums)
+	return;
+
+    p = demosums + (demotic-1)*4;
+    sum = p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned)p[3]<<24);
+    if (sum == tichash)
+	return;
+
+    demosumfailed = true;
+    printf ("G_CheckDemoSum: out of sync at demo tic %i (%i:%.2i)\n",
+	    demotic, demotic/TICRATE/60, demotic/TICRATE%60);
+    sprintf (summessage, "DEMO OUT OF SYNC AT %i:%.2i",
+	     demotic/TICRATE/60, demotic/TICRATE%60);
+    players[consoleplayer].message = summessage;
+}
  
  
  
@@ -1530,17 +1827,17 @@ void G_WriteDemoTiccmd (ticcmd_t* cmd)
 void G_RecordDemo (char* name) 
 { 
     int             i; 
-    int				maxsize;
 	
     usergame = false; 
     strcpy (demoname, name); 
     strcat (demoname, ".lmp"); 
-    maxsize = 0x20000;
+    demomaxsize = 0;
     i = M_CheckParm ("-maxdemo");
     if (i && i<myargc-1)
-	maxsize = atoi(myargv[i+1])*1024;
-    demobuffer = Z_Malloc (maxsize,PU_STATIC,NULL); 
-    demoend = demobuffer + maxsize;
+	demomaxsize = atoi(myargv[i+1])*1024;
+    demobuffer = demo_p = M_StreamOpen (demoname);
+    demoend = demobuffer + STREAMBUFFER;
+    demowritten = 0;
 	
     demorecording = true; 
 } 
@@ -1551,8 +1848,12 @@ void G_BeginRecording (void)
     int             i; 
 		
     demo_p = demobuffer;
+    demoflushtic = gametic;
 	
-    *demo_p++ = VERSION;
+    if (compatlevel == compat_vanilla)
+	*demo_p++ = VERSION;
+    else
+	*demo_p++ = METALVERSION;
     *demo_p++ = gameskill; 
     *demo_p++ = gameepisode; 
     *demo_p++ = gamemap; 
@@ -1583,15 +1884,25 @@ void G_DoPlayDemo (void)
 { 
     skill_t skill; 
     int             i, episode, map; 
+    int		    lump;
+    int		    numplayers;
+    byte*	    p;
+    byte*	    end;
 	 
     gameaction = ga_nothing; 
-    demobuffer = demo_p = W_CacheLumpName (defdemoname, PU_STATIC); 
-    if ( *demo_p++ != VERSION)
+    lump = W_GetNumForName (defdemoname);
+    demobuffer = demo_p = W_CacheLumpNum (lump, PU_STATIC); 
+    if (*demo_p == VERSION)
+	compatlevel = compat_vanilla;
+    else if (*demo_p == METALVERSION)
+	compatlevel = compat_metal;
+    else
     {
       fprintf( stderr, "Demo is from a different game version!\n");
       gameaction = ga_nothing;
       return;
     }
+    demo_p++;
     
     skill = *demo_p++; 
     episode = *demo_p++; 
@@ -1602,14 +1913,57 @@ void G_DoPlayDemo (void)
     nomonsters = *demo_p++;
     consoleplayer = *demo_p++;
 	
+    numplayers = 0;
     for (i=0 ; i<MAXPLAYERS ; i++) 
+    {
 	playeringame[i] = *demo_p++; 
+	numplayers += playeringame[i];
+    }
     if (playeringame[1]) 
     { 
 	netgame = true; 
 	netdemo = true; 
     }
 
+    // count the tics, for seeking
+    end = demobuffer + W_LumpLength (lump);
+    demotics = 0;
+    for (p = demo_p ;
+	 numplayers && p + 4*numplayers <= end && *p != DEMOMARKER ;
+	 p += 4*numplayers)
+	demotics++;
+    demotic = 0;
+    G_FreeDemoSnapshots ();
+
+    // a recording cut short has no marker, end it after the last
+    // whole tic that made it to disk
+    if (p == end || *p != DEMOMARKER)
+    {
+	printf ("G_DoPlayDemo: %s was cut short, playing its %i tics\n",
+		defdemoname, demotics);
+	if (cutdemo)
+	    Z_Free (cutdemo);
+	Z_Malloc (p - demobuffer + 1, PU_STATIC, &cutdemo);
+	memcpy (cutdemo, demobuffer, p - demobuffer);
+	demo_p = cutdemo + (demo_p - demobuffer);
+	p = cutdemo + (p - demobuffer);
+	*p = DEMOMARKER;
+	end = p + 1;
+	Z_ChangeTag (demobuffer, PU_CACHE);
+	demobuffer = cutdemo;
+    }
+
+    // checksums after the end, see G_WriteDemoSums
+    demosums = NULL;
+    demosumfailed = false;
+    if (p + 9 <= end && *p == DEMOMARKER && !memcmp (p+1, "SUMS", 4))
+    {
+	numdemosums = p[5] | (p[6]<<8) | (p[7]<<16) | (p[8]<<24);
+	if (numdemosums > (end - p - 9) / 4)
+	    numdemosums = (end - p - 9) / 4;
+	demosums = p + 9;
+    }
+
     // don't spend a lot of time in loadlevel 
     precache = false;
     G_InitNew (skill, episode, map); 
@@ -1629,6 +1983,10 @@ void G_TimeDemo (char* name)
     timingdemo = true; 
     singletics = true; 
 
+    // snapshots would show in the timings
+    if (!M_CheckParm ("-demosnap"))
+	demosnaptics = 0;
+
     defdemoname = name; 
     gameaction = ga_playdemo; 
 } 
@@ -1648,9 +2006,32 @@ boolean G_CheckDemoStatus (void)
 { 
     int             endtime; 
 	 
+    if (demoplayback && demosums)
+    {
+	if (!demosumfailed)
+	    printf ("G_CheckDemoStatus: %i tics matched their checksums\n",
+		    demotic < numdemosums ? demotic : numdemosums);
+	demosums = NULL;
+    }
+	 
+    if (benchdemo)
+    {
+	// other players of the demo reach the marker too
+	if (demoplayback)
+	{
+	    Z_ChangeTag (demobuffer, PU_CACHE); 
+	    demoplayback = false; 
+	    G_FreeDemoSnapshots ();
+	    M_BenchDemoDone ();
+	}
+	return true;
+    }
+	 
     if (timingdemo) 
     { 
 	endtime = I_GetTime (); 
+	if (blastbench)
+	    P_BlastBenchReport ();
 	I_Error ("timed %i gametics in %i realtics",gametic 
 		 , endtime-starttime); 
     } 
@@ -1662,6 +2043,7 @@ boolean G_CheckDemoStatus (void)
 			 
 	Z_ChangeTag (demobuffer, PU_CACHE); 
 	demoplayback = false; 
+	G_FreeDemoSnapshots ();
 	netdemo = false;
 	netgame = false;
 	deathmatch = false;
@@ -1669,6 +2051,7 @@ boolean G_CheckDemoStatus (void)
 	respawnparm = false;
 	fastparm = false;
 	nomonsters = false;
+	compatlevel = defaultcompat;
 	consoleplayer = 0;
 	D_AdvanceDemo (); 
 	return true; 
@@ -1676,10 +2059,11 @@ boolean G_CheckDemoStatus (void)
  
     if (demorecording) 
     { 
-	*demo_p++ = DEMOMARKER; 
-	M_WriteFile (demoname, demobuffer, demo_p - demobuffer); 
-	Z_Free (demobuffer); 
 	demorecording = false; 
+	*demo_p++ = DEMOMARKER; 
+	G_WriteDemoSums ();
+	G_FlushDemo ();
+	M_StreamClose ();
 	I_Error ("Demo %s recorded",demoname); 
     } 
 	 
@@ -1688,3 +2072,180 @@ boolean G_CheckDemoStatus (void)
  
  
  
+
+
+
+//
+// DEMO SEEKING
+// While a demo plays, the level is kept every demosnaptics
+// demo tics, see P_ArchiveSnapshot.  A seek goes back to
+// the last snapshot before the target and runs the game
+// from there to it, without drawing or sounds.
+//
+typedef struct
+{
+    int		demotic;
+    int		demooffset;	// of demo_p in demobuffer
+    int		episode;
+    int		map;
+    byte*	data;
+    int		length;
+    
+} demosnap_t;
+
+int		demotics;		// in the whole demo
+int		demosnaptics = 10*TICRATE;
+int		demoseektic = -1;
+
+// when it is full every other snapshot goes and the rest
+// are kept twice as far apart, so a long demo still
+// has some to go back to but no more than this many
+#define MAXDEMOSNAPS	32
+
+demosnap_t	demosnaps[MAXDEMOSNAPS];
+int		numdemosnaps;
+int		demosnapgap;		// demosnaptics, doubled by thinning
+
+
+//
+// G_DemoSnapshot
+// Keeps the level if the last one kept is old enough.
+// Snapshots only go forward, a demo played again after
+// a rewind keeps none until it gets past the last.
+//
+void G_DemoSnapshot (void)
+{
+    demosnap_t*	snap;
+    int		i;
+
+    if (!demosnapgap)
+	demosnapgap = demosnaptics;
+    if (numdemosnaps
+	&& demotic < demosnaps[numdemosnaps-1].demotic + demosnapgap)
+	return;
+
+    if (numdemosnaps == MAXDEMOSNAPS)
+    {
+	for (i=0 ; i<MAXDEMOSNAPS/2 ; i++)
+	{
+	    free (demosnaps[i*2+1].data);
+	    demosnaps[i] = demosnaps[i*2];
+	}
+	numdemosnaps = MAXDEMOSNAPS/2;
+	demosnapgap *= 2;
+	if (demotic < demosnaps[numdemosnaps-1].demotic + demosnapgap)
+	    return;
+    }
+
+    snap = &demosnaps[numdemosnaps++];
+    snap->demotic = demotic;
+    snap->demooffset = demo_p - demobuffer;
+    snap->episode = gameepisode;
+    snap->map = gamemap;
+    snap->data = P_ArchiveSnapshot (&snap->length);
+}
+
+
+//
+// G_FreeDemoSnapshots
+//
+void G_FreeDemoSnapshots (void)
+{
+    int		i;
+
+    for (i=0 ; i<numdemosnaps ; i++)
+	free (demosnaps[i].data);
+    numdemosnaps = 0;
+    demosnapgap = 0;
+}
+
+
+//
+// G_RestoreDemoSnapshot
+//
+void G_RestoreDemoSnapshot (demosnap_t* snap)
+{
+    int		display;
+
+    // from another map, the intermission or the finale
+    if (gamestate != GS_LEVEL
+	|| gameepisode != snap->episode
+	|| gamemap != snap->map)
+    {
+	if (automapactive)
+	    AM_Stop ();
+	display = displayplayer;
+	gameepisode = snap->episode;
+	gamemap = snap->map;
+	G_DoLoadLevel ();
+	displayplayer = display;
+    }
+
+    P_UnArchiveSnapshot (snap->data);
+    demo_p = demobuffer + snap->demooffset;
+    demotic = snap->demotic;
+    gameaction = ga_nothing;
+}
+
+
+//
+// G_DoDemoSeek
+// Called between frames while demoseektic is set.
+//
+extern int	skiptics;
+
+void G_DoDemoSeek (void)
+{
+    static char	seekmessage[40];
+    demosnap_t*	snap;
+    int		target;
+    int		start;
+    int		i;
+
+    // -demoseek waits for the demo to start
+    if (!demoplayback)
+	return;
+
+    target = demoseektic;
+    demoseektic = -1;
+    if (target > demotics-1)
+	target = demotics-1;
+    if (target < 0)
+	target = 0;
+
+    snap = NULL;
+    for (i=numdemosnaps-1 ; i>=0 ; i--)
+    {
+	if (demosnaps[i].demotic <= target)
+	{
+	    snap = &demosnaps[i];
+	    break;
+	}
+    }
+
+    if (target < demotic && !snap)
+    {
+	printf ("G_DoDemoSeek: nothing kept to go back to\n");
+	return;
+    }
+
+    start = I_GetTime ();
+    demoseeking = true;
+
+    if (target < demotic || (snap && snap->demotic > demotic))
+	G_RestoreDemoSnapshot (snap);
+
+    while (demoplayback && demotic < target)
+	G_Ticker ();
+
+    demoseeking = false;
+
+    // no wipe, and don't play the time spent here
+    wipegamestate = gamestate;
+    skiptics += (I_GetTime () - start)/ticdup;
+
+    sprintf (seekmessage, "DEMO %i:%.2i OF %i:%.2i",
+	     demotic/TICRATE/60, demotic/TICRATE%60,
+	     demotics/TICRATE/60, demotics/TICRATE%60);
+    players[consoleplayer].message = seekmessage;
+}
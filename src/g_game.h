@@ -66,8 +66,25 @@ void G_SecretExitLevel (void);
 void G_WorldDone (void);
 
 void G_Ticker (void);
+
+// Moves the console player ahead for the display,
+// and back before the next tic, see -predict.
+void G_Predict (void);
+void G_EndPredict (void);
+void G_PredictionStats (void);
 boolean G_Responder (event_t*	ev);
 
+// Demo seeking, see G_DoDemoSeek.
+// The arrow keys seek by DEMOSEEKSTEP demo tics.
+#define DEMOSEEKSTEP	(10*TICRATE)
+
+extern int	demotic;	// demo tics read so far
+extern int	demotics;	// in the whole demo
+extern int	demosnaptics;	// between snapshots, 0 for none
+extern int	demoseektic;	// -1 when not seeking
+
+void G_DoDemoSeek (void);
+
 void G_ScreenShot (void);
 
 
@@ -0,0 +1,761 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	Reads MUS scores at 140 tics a second and plays their
+//	notes on the FM synthesizer with the GENMIDI patches,
+//	the way DMX drove an OPL3.  Everything but MUS_Init and
+//	MUS_Valid runs on the audio thread.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: i_mus.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "doomdef.h"
+#include "i_system.h"
+#include "i_opl.h"
+
+#ifdef __GNUG__
+#pragma implementation "i_mus.h"
+#endif
+#include "i_mus.h"
+
+
+#define MUS_TICRATE		140
+#define MUS_CHANNELS		16
+#define MUS_PERCUSSION		15
+
+#define GENMIDI_INSTRS		175
+#define GENMIDI_SIZE		36	// bytes of an instrument
+#define GENMIDI_FIXED		1	// plays one note whatever the key
+#define GENMIDI_DOUBLE		4	// plays both voices
+
+#define MIN_VOICES		6	// however far over budget
+
+enum
+{
+    mus_releasekey,
+    mus_presskey,
+    mus_pitchwheel,
+    mus_systemevent,
+    mus_changecontroller,
+    mus_measure,
+    mus_scoreend,
+    mus_unused
+};
+
+typedef struct
+{
+    byte	character;	// register 0x20
+    byte	attack;		// 0x60
+    byte	sustain;	// 0x80
+    byte	waveform;	// 0xe0
+    byte	scale;		// key scale level bits of 0x40
+    byte	level;		// total level of 0x40
+} genmidiop_t;
+
+typedef struct
+{
+    genmidiop_t	modulator;
+    byte	feedback;	// 0xc0
+    genmidiop_t	carrier;
+    short	baseoffset;	// added to the key
+} genmidivoice_t;
+
+typedef struct
+{
+    int			flags;
+    int			finetune;	// of the second voice
+    int			fixednote;
+    genmidivoice_t	voices[2];
+} genmidiinstr_t;
+
+typedef struct
+{
+    int		instrument;
+    int		volume;
+    int		pan;
+    int		bend;		// 128 is none
+    int		velocity;	// of the last key pressed
+} muschannel_t;
+
+typedef struct
+{
+    int			channel;	// -1 if free
+    int			note;		// key pressed, for its release
+    int			velocity;
+    genmidiinstr_t*	instr;
+    int			which;		// voice of the instrument
+    int			age;
+    boolean		keyon;
+} musvoice_t;
+
+
+static genmidiinstr_t	instrs[GENMIDI_INSTRS];
+static boolean		haveinstrs;
+static int		outrate = 22050;
+
+static byte*		score;
+static byte*		scoreend;
+static byte*		scorepos;
+static boolean		playing;
+static boolean		paused;
+static boolean		looping;
+static int		volume = 15;
+
+static long long	samplesleft;	// to the next event, 16.16
+static long long	samplespertic;	// 16.16
+
+static muschannel_t	muschannels[MUS_CHANNELS];
+static musvoice_t	voices[OPL_NUMCHANNELS];
+static int		numvoices = OPL_NUMCHANNELS;	// the budget's
+boolean			musbudget = true;
+static int		voiceage;
+
+static int		voltab[128];	// attenuation of a volume
+
+
+//
+// ReadOp
+//
+static byte* ReadOp (byte* p, genmidiop_t* op)
+{
+    op->character = *p++;
+    op->attack = *p++;
+    op->sustain = *p++;
+    op->waveform = *p++;
+    op->scale = *p++;
+    op->level = *p++;
+    return p;
+}
+
+
+//
+// MUS_Init
+//
+void MUS_Init (byte* genmidi, int length, int rate)
+{
+    genmidiinstr_t*	in;
+    genmidivoice_t*	v;
+    byte*		p;
+    int			i;
+    int			j;
+
+    outrate = rate;
+    samplespertic = ((long long)rate << 16) / MUS_TICRATE;
+    OPL_Init (rate);
+
+    // 0.75 dB steps of total level for a linear volume
+    voltab[0] = 63;
+    for (i=1 ; i<128 ; i++)
+    {
+	voltab[i] = (int)(-20 * log10 (i / 127.0) / 0.75 + 0.5);
+	if (voltab[i] > 63)
+	    voltab[i] = 63;
+    }
+
+    haveinstrs = false;
+    if (!genmidi || length < 8 + GENMIDI_INSTRS*GENMIDI_SIZE
+	|| memcmp (genmidi, "#OPL_II#", 8))
+    {
+	printf ("MUS_Init: no GENMIDI, no music\n");
+	return;
+    }
+
+    p = genmidi + 8;
+    for (i=0 ; i<GENMIDI_INSTRS ; i++)
+    {
+	in = &instrs[i];
+	in->flags = p[0] | (p[1]<<8);
+	in->finetune = p[2];
+	in->fixednote = p[3];
+	p += 4;
+	for (j=0 ; j<2 ; j++)
+	{
+	    v = &in->voices[j];
+	    p = ReadOp (p, &v->modulator);
+	    v->feedback = *p++;
+	    p = ReadOp (p, &v->carrier);
+	    p++;
+	    v->baseoffset = (short)(p[0] | (p[1]<<8));
+	    p += 2;
+	}
+    }
+    haveinstrs = true;
+}
+
+
+//
+// MUS_Valid
+//
+boolean MUS_Valid (byte* data, int length)
+{
+    int		scorelen;
+    int		scorestart;
+
+    if (length < 16 || memcmp (data, "MUS\x1a", 4))
+	return false;
+    scorelen = data[4] | (data[5]<<8);
+    scorestart = data[6] | (data[7]<<8);
+    return scorestart + scorelen <= length;
+}
+
+
+//
+// WriteOperator
+//
+static void
+WriteOperator
+( int		reg,
+  genmidiop_t*	op,
+  int		level )
+{
+    OPL_WriteReg (0x20 + reg, op->character);
+    OPL_WriteReg (0x40 + reg, (op->scale & 0xc0) | level);
+    OPL_WriteReg (0x60 + reg, op->attack);
+    OPL_WriteReg (0x80 + reg, op->sustain);
+    OPL_WriteReg (0xe0 + reg, op->waveform);
+}
+
+
+//
+// VoiceRegs
+// The first operator and channel registers of an OPL voice
+//
+static void VoiceRegs (int voice, int* opreg, int* chreg)
+{
+    static const int	opoffsets[9] =
+    {
+	0x00, 0x01, 0x02, 0x08, 0x09, 0x0a, 0x10, 0x11, 0x12
+    };
+
+    *opreg = ((voice/9) << 8) | opoffsets[voice%9];
+    *chreg = ((voice/9) << 8) | (voice%9);
+}
+
+
+//
+// SetVoiceVolume
+//
+static void SetVoiceVolume (int voice)
+{
+    musvoice_t*		vo;
+    genmidivoice_t*	gv;
+    int			opreg;
+    int			chreg;
+    int			att;
+    int			level;
+
+    vo = &voices[voice];
+    gv = &vo->instr->voices[vo->which];
+    VoiceRegs (voice, &opreg, &chreg);
+
+    att = voltab[vo->velocity * muschannels[vo->channel].volume / 127];
+    level = (gv->carrier.level & 0x3f) + att;
+    OPL_WriteReg (0x40 + opreg + 3,
+		  (gv->carrier.scale & 0xc0) | (level > 63 ? 63 : level));
+
+    // both are heard when they are added
+    if (gv->feedback & 1)
+    {
+	level = (gv->modulator.level & 0x3f) + att;
+	OPL_WriteReg (0x40 + opreg,
+		      (gv->modulator.scale & 0xc0) | (level > 63 ? 63 : level));
+    }
+}
+
+
+//
+// SetVoicePan
+// Hard left or right, as DMX did on an OPL3
+//
+static void SetVoicePan (int voice)
+{
+    musvoice_t*	vo;
+    int		opreg;
+    int		chreg;
+    int		pan;
+    int		sides;
+
+    vo = &voices[voice];
+    VoiceRegs (voice, &opreg, &chreg);
+    pan = muschannels[vo->channel].pan;
+    sides = pan < 48 ? 0x10 : pan > 96 ? 0x20 : 0x30;
+    OPL_WriteReg (0xc0 + chreg, vo->instr->voices[vo->which].feedback | sides);
+}
+
+
+//
+// SetVoicePitch
+//
+static void SetVoicePitch (int voice)
+{
+    musvoice_t*		vo;
+    double		key;
+    double		freq;
+    int			opreg;
+    int			chreg;
+    int			fnum;
+    int			block;
+
+    vo = &voices[voice];
+    VoiceRegs (voice, &opreg, &chreg);
+
+    if (vo->instr->flags & GENMIDI_FIXED)
+	key = vo->instr->fixednote;
+    else
+	key = vo->note + vo->instr->voices[vo->which].baseoffset;
+    key += (muschannels[vo->channel].bend - 128) / 64.0;
+    if (vo->which)
+	key += (vo->instr->finetune/2 - 64) / 32.0;
+
+    freq = 440 * pow (2, (key - 69) / 12);
+    for (block=0 ; block<7 ; block++)
+	if (freq * (1 << (20-block)) / OPL_RATE < 1023.5)
+	    break;
+    fnum = (int)(freq * (1 << (20-block)) / OPL_RATE + 0.5);
+    if (fnum > 1023)
+	fnum = 1023;
+
+    OPL_WriteReg (0xa0 + chreg, fnum & 0xff);
+    OPL_WriteReg (0xb0 + chreg,
+		  (vo->keyon ? 0x20 : 0) | (block << 2) | (fnum >> 8));
+}
+
+
+//
+// ReleaseVoice
+//
+static void ReleaseVoice (int voice)
+{
+    if (voices[voice].channel == -1 || !voices[voice].keyon)
+	return;
+    voices[voice].keyon = false;
+    SetVoicePitch (voice);
+}
+
+
+//
+// AllNotesOff
+//
+static void AllNotesOff (void)
+{
+    int		i;
+
+    for (i=0 ; i<OPL_NUMCHANNELS ; i++)
+	ReleaseVoice (i);
+}
+
+
+//
+// FindVoice
+// The oldest released voice, else the oldest playing one
+//
+static int FindVoice (void)
+{
+    int		best;
+    int		i;
+
+    best = -1;
+    for (i=0 ; i<numvoices ; i++)
+    {
+	if (voices[i].channel == -1)
+	    return i;
+	if (best == -1
+	    || (!voices[i].keyon && voices[best].keyon)
+	    || (voices[i].keyon == voices[best].keyon
+		&& voices[i].age < voices[best].age))
+	    best = i;
+    }
+    return best;
+}
+
+
+//
+// PressKey
+//
+static void
+PressKey
+( int		channel,
+  int		note,
+  int		velocity )
+{
+    genmidiinstr_t*	instr;
+    genmidivoice_t*	gv;
+    musvoice_t*		vo;
+    int			voice;
+    int			opreg;
+    int			chreg;
+    int			which;
+
+    if (channel == MUS_PERCUSSION)
+    {
+	if (note < 35 || note > 81)
+	    return;
+	instr = &instrs[128 + note - 35];
+    }
+    else
+	instr = &instrs[muschannels[channel].instrument];
+
+    for (which=0 ; which<2 ; which++)
+    {
+	if (which && !(instr->flags & GENMIDI_DOUBLE))
+	    break;
+
+	voice = FindVoice ();
+	vo = &voices[voice];
+	if (vo->keyon)
+	{
+	    vo->keyon = false;
+	    SetVoicePitch (voice);	// key off before the new patch
+	}
+
+	vo->channel = channel;
+	vo->note = note;
+	vo->velocity = velocity;
+	vo->instr = instr;
+	vo->which = which;
+	vo->age = voiceage++;
+
+	gv = &instr->voices[which];
+	VoiceRegs (voice, &opreg, &chreg);
+	WriteOperator (opreg, &gv->modulator, gv->modulator.level & 0x3f);
+	WriteOperator (opreg + 3, &gv->carrier, gv->carrier.level & 0x3f);
+	SetVoiceVolume (voice);
+	SetVoicePan (voice);
+
+	vo->keyon = true;
+	SetVoicePitch (voice);
+    }
+}
+
+
+//
+// ReleaseKey
+//
+static void ReleaseKey (int channel, int note)
+{
+    int		i;
+
+    for (i=0 ; i<OPL_NUMCHANNELS ; i++)
+	if (voices[i].channel == channel && voices[i].note == note)
+	    ReleaseVoice (i);
+}
+
+
+//
+// ChannelVoices
+// Calls func for each voice playing on channel
+//
+static void ChannelVoices (int channel, void (*func) (int))
+{
+    int		i;
+
+    for (i=0 ; i<OPL_NUMCHANNELS ; i++)
+	if (voices[i].channel == channel && voices[i].keyon)
+	    func (i);
+}
+
+
+//
+// ResetChannels
+//
+static void ResetChannels (void)
+{
+    int		i;
+
+    for (i=0 ; i<MUS_CHANNELS ; i++)
+    {
+	muschannels[i].instrument = 0;
+	muschannels[i].volume = 100;
+	muschannels[i].pan = 64;
+	muschannels[i].bend = 128;
+	muschannels[i].velocity = 127;
+    }
+}
+
+
+//
+// ReadEvent
+// Plays the next event of the score.  Returns the tics
+// to wait after it, or -1 when the score is over.
+// The score can't be trusted to hold an event's bytes.
+//
+#define NEED(n)		if (scoreend - scorepos < (n)) return -1
+
+static int ReadEvent (void)
+{
+    muschannel_t*	mc;
+    int			desc;
+    int			channel;
+    int			value;
+    int			ctrl;
+    int			delay;
+
+    if (scorepos >= scoreend)
+	return -1;
+
+    desc = *scorepos++;
+    channel = desc & 15;
+    mc = &muschannels[channel];
+
+    switch ((desc >> 4) & 7)
+    {
+      case mus_releasekey:
+	NEED (1);
+	ReleaseKey (channel, *scorepos++ & 127);
+	break;
+
+      case mus_presskey:
+	NEED (1);
+	value = *scorepos++;
+	if (value & 128)
+	{
+	    NEED (1);
+	    mc->velocity = *scorepos++ & 127;
+	}
+	PressKey (channel, value & 127, mc->velocity);
+	break;
+
+      case mus_pitchwheel:
+	NEED (1);
+	mc->bend = *scorepos++;
+	ChannelVoices (channel, SetVoicePitch);
+	break;
+
+      case mus_systemevent:
+	NEED (1);
+	value = *scorepos++;
+	if (value == 10 || value == 11)		// sounds or notes off
+	    ChannelVoices (channel, ReleaseVoice);
+	break;
+
+      case mus_changecontroller:
+	NEED (2);
+	ctrl = *scorepos++;
+	value = *scorepos++ & 127;
+	switch (ctrl)
+	{
+	  case 0:
+	    mc->instrument = value;
+	    break;
+	  case 3:
+	    mc->volume = value;
+	    ChannelVoices (channel, SetVoiceVolume);
+	    break;
+	  case 4:
+	    mc->pan = value;
+	    ChannelVoices (channel, SetVoicePan);
+	    break;
+	}
+	break;
+
+      case mus_measure:
+	break;
+
+      case mus_scoreend:
+	return -1;
+
+      default:
+	break;
+    }
+
+    if (!(desc & 128))
+	return 0;
+
+    delay = 0;
+    do
+    {
+	if (scorepos >= scoreend)
+	    return -1;
+	value = *scorepos++;
+	delay = (delay << 7) | (value & 127);
+    } while (value & 128);
+
+    return delay;
+}
+
+
+//
+// RunScore
+// Plays events until the next one is some time away
+//
+static void RunScore (void)
+{
+    int		delay;
+    int		events;
+
+    for (events=0 ; samplesleft <= 0 ; events++)
+    {
+	// a score that never waits is broken
+	if (events > 65536)
+	{
+	    MUS_Stop ();
+	    return;
+	}
+
+	delay = ReadEvent ();
+	if (delay == -1)
+	{
+	    if (!looping)
+	    {
+		MUS_Stop ();
+		return;
+	    }
+	    scorepos = score;
+	    continue;
+	}
+	samplesleft += delay * samplespertic;
+    }
+}
+
+
+//
+// MUS_Start
+//
+void MUS_Start (byte* data, int length, boolean looping_)
+{
+    int		scorelen;
+    int		scorestart;
+    int		i;
+
+    MUS_Stop ();
+    if (!haveinstrs)
+	return;
+
+    scorelen = data[4] | (data[5]<<8);
+    scorestart = data[6] | (data[7]<<8);
+    score = scorepos = data + scorestart;
+    scoreend = score + scorelen;
+
+    ResetChannels ();
+    for (i=0 ; i<OPL_NUMCHANNELS ; i++)
+	voices[i].channel = -1;
+    samplesleft = 0;
+    looping = looping_;
+    paused = false;
+    playing = true;
+}
+
+
+//
+// MUS_Stop
+//
+void MUS_Stop (void)
+{
+    if (!playing)
+	return;
+    AllNotesOff ();
+    playing = false;
+}
+
+
+//
+// MUS_Pause
+//
+void MUS_Pause (boolean pause)
+{
+    if (pause && playing && !paused)
+	AllNotesOff ();
+    paused = pause;
+}
+
+
+//
+// MUS_SetVolume
+//
+void MUS_SetVolume (int vol)
+{
+    volume = vol < 0 ? 0 : vol > 15 ? 15 : vol;
+}
+
+
+//
+// MUS_Playing
+//
+boolean MUS_Playing (void)
+{
+    return playing;
+}
+
+
+//
+// Budget
+// Fewer voices while over MUS_BUDGET, more when well under
+//
+static void Budget (long long us, int samples)
+{
+    long long	budget;
+    int		i;
+
+    budget = (long long)samples * 10000 * MUS_BUDGET / outrate;
+    if (us > budget && numvoices > MIN_VOICES)
+    {
+	numvoices--;
+	for (i=numvoices ; i<OPL_NUMCHANNELS ; i++)
+	    ReleaseVoice (i);
+    }
+    else if (us < budget/4 && numvoices < OPL_NUMCHANNELS)
+	numvoices++;
+}
+
+
+//
+// MUS_Render
+//
+void MUS_Render (int* mix, int samples, int shift)
+{
+    long long	start;
+    int		gain;
+    int		n;
+    int		total;
+
+    if (!haveinstrs || (!playing && !OPL_SoundingChannels ()))
+	return;
+
+    start = I_GetTimeUS ();
+    gain = (2 << shift) * volume / 15;
+    total = samples;
+
+    while (samples)
+    {
+	n = samples;
+	if (playing && !paused)
+	{
+	    RunScore ();
+	    if (playing && samplesleft < ((long long)n << 16))
+		n = (int)((samplesleft + 0xffff) >> 16);
+	}
+	if (n < 1)
+	    n = 1;
+
+	OPL_Render (mix, n, gain);
+	mix += n*2;
+	samples -= n;
+	if (playing && !paused)
+	    samplesleft -= (long long)n << 16;
+    }
+
+    if (musbudget)
+	Budget (I_GetTimeUS () - start, total);
+}
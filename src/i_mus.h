@@ -0,0 +1,66 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	MUS music played on the FM synthesizer.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __I_MUS__
+#define __I_MUS__
+
+#include "doomtype.h"
+
+
+// Takes the GENMIDI lump, copied, and the output rate.
+// Without GENMIDI nothing is heard.
+void MUS_Init (byte* genmidi, int length, int rate);
+
+// Checks that data is a MUS lump.
+boolean MUS_Valid (byte* data, int length);
+
+// The rest are for the thread that renders.
+
+// Plays a valid MUS lump, which is not copied.
+void MUS_Start (byte* data, int length, boolean looping);
+void MUS_Stop (void);
+void MUS_Pause (boolean paused);
+
+// Volume from 0 to 15.
+void MUS_SetVolume (int volume);
+
+// Adds samples of stereo output into mix, in the units of
+// the sound mixer, where 1<<shift is a 16 bit sample.
+// Polyphony is cut while rendering takes more than
+// MUS_BUDGET percent of the time the samples last.
+#define MUS_BUDGET	25
+
+// Cleared for an offline render, which must come
+// out the same however long it takes.
+extern boolean	musbudget;
+
+void MUS_Render (int* mix, int samples, int shift);
+
+boolean MUS_Playing (void);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
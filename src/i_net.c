@@ -23,6 +23,10 @@
 static const char
 rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
+#ifdef __linux__
+#define _GNU_SOURCE	// recvmmsg, sendmmsg
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -35,12 +39,18 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 #include <unistd.h>
 #include <netdb.h>
 #include <sys/ioctl.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <SDL.h>
+#endif
 #endif
 
 #include "i_system.h"
 #include "d_event.h"
 #include "d_net.h"
 #include "m_argv.h"
+#include "m_trace.h"
 
 #include "doomstat.h"
 
@@ -70,6 +80,365 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 void	NetSend (void);
 boolean NetListen (void);
 
+void	(*netget) (void);
+void	(*netsend) (void);
+
+
+//
+// LOOPBACK
+// -loopback <numnodes> plays a peer to peer game against
+// simulated nodes in this process, with no sockets.  Each
+// simulated node makes empty ticcmds on its own clock and
+// keeps to the tic protocol of d_net.c, so lost packets get
+// retransmitted as they would between real nodes.  Packets
+// both ways can be delayed (-netlatency <ms>), spread out
+// and reordered (-netjitter <ms>) and lost (-netloss <pct>).
+// This tests transport and throughput only.  The simulated
+// nodes never run the game and copy our own consistancy into
+// their ticcmds, so a desync can't show up here.
+//
+#define LOOPPACKETS	1024
+
+typedef struct
+{
+    long long	due;		// I_GetTimeUS when it arrives
+    int		from;
+    int		to;		// -1 for a free slot
+    int		length;
+    doomdata_t	data;
+} looppacket_t;
+
+typedef struct
+{
+    boolean	started;	// has had the setup packet
+    int		lasttime;
+    int		maketic;
+    int		nettics;	// tics had from node 0
+    int		resendto;
+    boolean	remoteresend;
+    ticcmd_t	cmds[BACKUPTICS];
+} loopnode_t;
+
+looppacket_t	looppackets[LOOPPACKETS];
+loopnode_t	loopnodes[MAXNETNODES];
+
+int		looplatency;	// all in microseconds
+int		loopjitter;
+int		looploss;	// lost per 1000 packets
+unsigned	looprandom = 1;
+
+int		loopsent;
+int		looplost;
+long long	loopdelay;
+
+extern short	consistancy[MAXPLAYERS][BACKUPTICS];
+
+unsigned NetbufferChecksum (void);
+int ExpandTicsFrom (int low, int near);
+
+
+//
+// LoopRandom
+// Not the game's random numbers,
+// those must stay in step
+//
+static int LoopRandom (void)
+{
+    looprandom = looprandom*1103515245 + 12345;
+    return (looprandom>>16) & 0x7fff;
+}
+
+
+//
+// LoopQueue
+//
+static void
+LoopQueue
+( int		from,
+  int		to,
+  doomdata_t*	data,
+  int		length )
+{
+    looppacket_t*	pkt;
+    int			i;
+    int			delay;
+
+    loopsent++;
+    if (LoopRandom () % 1000 < looploss)
+    {
+	looplost++;
+	return;
+    }
+
+    for (i=0 ; i<LOOPPACKETS ; i++)
+	if (looppackets[i].to == -1)
+	    break;
+    if (i == LOOPPACKETS)
+    {
+	looplost++;			// the network is full
+	return;
+    }
+    
+    delay = looplatency
+	+ (int)((long long)loopjitter * LoopRandom () / 0x7fff);
+    loopdelay += delay;
+    
+    pkt = &looppackets[i];
+    pkt->due = I_GetTimeUS () + delay;
+    pkt->from = from;
+    pkt->to = to;
+    pkt->length = length;
+    memcpy (&pkt->data, data, length);
+}
+
+
+//
+// LoopArrived
+// The first packet for node that is due, or NULL
+//
+static looppacket_t* LoopArrived (int node)
+{
+    looppacket_t*	best;
+    long long		now;
+    int			i;
+
+    now = I_GetTimeUS ();
+    best = NULL;
+    for (i=0 ; i<LOOPPACKETS ; i++)
+	if (looppackets[i].to == node
+	    && looppackets[i].due <= now
+	    && (!best || looppackets[i].due < best->due))
+	    best = &looppackets[i];
+    return best;
+}
+
+
+//
+// LoopNodeGet
+// What a simulated node does with a packet from node 0
+//
+static void
+LoopNodeGet
+( loopnode_t*	ln,
+  doomdata_t*	data )
+{
+    int		realstart;
+    int		realend;
+
+    if (data->checksum & NCMD_SETUP)
+    {
+	// start on our own clock
+	if (!ln->started)
+	    ln->lasttime = I_GetTime ();
+	ln->started = true;
+	return;
+    }
+    if (!ln->started || (data->checksum & (NCMD_EXIT|NCMD_KILL)))
+	return;
+
+    if (data->checksum & NCMD_RETRANSMIT)
+	ln->resendto = ExpandTicsFrom (data->retransmitfrom, ln->maketic);
+
+    realstart = ExpandTicsFrom (data->starttic, ln->nettics);
+    realend = realstart + data->numtics;
+
+    if (realend < ln->nettics)
+	return;			// duplicated
+    if (realstart > ln->nettics)
+    {
+	// out of order, ask for the missed tics
+	ln->remoteresend = true;
+	return;
+    }
+    ln->remoteresend = false;
+    ln->nettics = realend;
+}
+
+
+//
+// LoopNodeRun
+// Makes the tics that are due, like NetUpdate,
+// and sends them to node 0
+//
+static void LoopNodeRun (int node)
+{
+    loopnode_t*	ln;
+    doomdata_t	data;
+    ticcmd_t*	cmd;
+    int		nowtime;
+    int		newtics;
+    int		lowtic;
+    int		i;
+
+    ln = &loopnodes[node];
+    if (!ln->started)
+	return;
+
+    nowtime = I_GetTime ();
+    newtics = nowtime - ln->lasttime;
+    ln->lasttime = nowtime;
+    if (newtics <= 0)
+	return;
+
+    // keep ahead of the key player, as TryRunTics does
+    if (ln->maketic <= ln->nettics)
+	ln->lasttime--;
+
+    for (i=0 ; i<newtics ; i++)
+    {
+	// it runs a tic once it has the tic from node 0
+	lowtic = ln->nettics < ln->maketic ? ln->nettics : ln->maketic;
+	if (ln->maketic - lowtic >= BACKUPTICS/2-1)
+	    break;
+	cmd = &ln->cmds[ln->maketic%BACKUPTICS];
+	memset (cmd, 0, sizeof(*cmd));
+	// it runs no game, so it can only echo ours back
+	cmd->consistancy = consistancy[node][ln->maketic%BACKUPTICS];
+	ln->maketic++;
+    }
+
+    if (ln->maketic - ln->resendto > BACKUPTICS)
+	ln->resendto = ln->maketic - BACKUPTICS;
+    data.player = node;
+    data.starttic = ln->resendto;
+    data.numtics = ln->maketic - ln->resendto;
+    for (i=0 ; i<data.numtics ; i++)
+	data.cmds[i] = ln->cmds[(ln->resendto+i)%BACKUPTICS];
+    ln->resendto = ln->maketic;
+
+    data.checksum = 0;
+    data.retransmitfrom = 0;
+    if (ln->remoteresend)
+    {
+	data.checksum = NCMD_RETRANSMIT;
+	data.retransmitfrom = ln->nettics;
+    }
+    LoopQueue (node, 0, &data,
+	       (byte *)&data.cmds[data.numtics] - (byte *)&data);
+}
+
+
+//
+// LoopRun
+// Delivers what is due at the simulated
+// nodes and lets them catch up
+//
+static void LoopRun (void)
+{
+    looppacket_t*	pkt;
+    int			node;
+
+    for (node=1 ; node<doomcom->numnodes ; node++)
+    {
+	while ( (pkt = LoopArrived (node)) )
+	{
+	    LoopNodeGet (&loopnodes[node], &pkt->data);
+	    pkt->to = -1;
+	}
+	LoopNodeRun (node);
+    }
+}
+
+
+//
+// LoopSend
+//
+void LoopSend (void)
+{
+    LoopQueue (0, doomcom->remotenode, netbuffer, doomcom->datalength);
+    doomcom->wirelength = doomcom->datalength;
+    LoopRun ();
+}
+
+
+//
+// LoopGet
+//
+void LoopGet (void)
+{
+    looppacket_t*	pkt;
+
+    LoopRun ();
+
+    pkt = LoopArrived (0);
+    if (!pkt)
+    {
+	doomcom->remotenode = -1;		// no packet
+	return;
+    }
+    memcpy (netbuffer, &pkt->data, pkt->length);
+    netbuffer->checksum |= NetbufferChecksum ();
+    doomcom->remotenode = pkt->from;
+    doomcom->datalength = pkt->length;
+    doomcom->wirelength = pkt->length;
+    pkt->to = -1;
+}
+
+
+//
+// LoopbackInit
+// Returns false if this is not a loopback game
+//
+boolean LoopbackInit (void)
+{
+    int		i;
+    int		p;
+
+    p = M_CheckParm ("-loopback");
+    if (!p || p >= myargc-1)
+	return false;
+
+    doomcom->numnodes = atoi (myargv[p+1]);
+    if (doomcom->numnodes < 2 || doomcom->numnodes > MAXPLAYERS)
+	I_Error ("-loopback: %i nodes, 2 to %i allowed",
+		 doomcom->numnodes, MAXPLAYERS);
+
+    p = M_CheckParm ("-netlatency");
+    if (p && p<myargc-1)
+	looplatency = atoi (myargv[p+1]) * 1000;
+    p = M_CheckParm ("-netjitter");
+    if (p && p<myargc-1)
+	loopjitter = atoi (myargv[p+1]) * 1000;
+    p = M_CheckParm ("-netloss");
+    if (p && p<myargc-1)
+	looploss = (int)(atof (myargv[p+1]) * 10);
+
+    for (i=0 ; i<LOOPPACKETS ; i++)
+	looppackets[i].to = -1;
+
+    netsend = LoopSend;
+    netget = LoopGet;
+    netgame = true;
+
+    // we are the key player, the simulated nodes
+    // only know about tics they make themselves
+    doomcom->id = DOOMCOM_ID;
+    doomcom->netmode = NET_PEER;
+    doomcom->ticdup = 1;
+    doomcom->consoleplayer = 0;
+    doomcom->numplayers = doomcom->numnodes;
+
+    printf ("loopback game, %i nodes, %i ms latency, "
+	    "%i ms jitter, %.1f%% loss\n",
+	    doomcom->numnodes, looplatency/1000, loopjitter/1000,
+	    looploss/10.0);
+    return true;
+}
+
+
+//
+// I_LoopbackStats
+//
+void I_LoopbackStats (void)
+{
+    if (netsend != LoopSend)
+	return;
+    printf ("loopback: %i packets, %i lost, %.1f ms average delay\n",
+	    loopsent, looplost,
+	    loopsent > looplost
+	    ? loopdelay / 1000.0 / (loopsent - looplost) : 0.0);
+}
+
 
 //
 // NETWORKING
@@ -84,9 +453,6 @@ int			insocket;
 
 struct	sockaddr_in	sendaddress[MAXNETNODES];
 
-void	(*netget) (void);
-void	(*netsend) (void);
-
 
 //
 // UDPsocket
@@ -125,32 +491,507 @@ BindToLocalPort
 }
 
 
+//
+// DELTA PACKETS
+// A NETFORMAT_DELTA packet has the doomdata_t header
+// and then, for each ticcmd, a byte of DC_ flags for
+// the fields that differ from the ticcmd before it
+// (the same player's, in server packets), followed by
+// those fields. angleturn and consistancy are zigzag
+// varints, the rest single bytes.
+//
+#define DC_FORWARD	1
+#define DC_SIDE		2
+#define DC_ANGLE	4
+#define DC_CONSIST	8
+#define DC_CHAT		16
+#define DC_BUTTONS	32
+
+// header, then at worst a flag byte, three
+// bytes for each varint and the byte fields
+#define MAXWIRE		(8 + BACKUPTICS*MAXPLAYERS*11)
+
+typedef union
+{
+    doomdata_t	data;		// NETFORMAT_LEGACY
+    byte	bytes[MAXWIRE];
+    
+} wirepacket_t;
+
+// the last packet sent, so sending the same
+// one to several nodes only encodes it once
+doomdata_t	lastsent;
+int		lastsentsize = -1;
+wirepacket_t	wiresend;
+int		wiresendlength;
+
+static ticcmd_t	zerocmd;
+
+
+//
+// PutVarint
+//
+static byte* PutVarint (byte* p, int v)
+{
+    unsigned	u;
+
+    u = ((unsigned)v << 1) ^ (unsigned)(v >> 31);
+    while (u >= 0x80)
+    {
+	*p++ = u | 0x80;
+	u >>= 7;
+    }
+    *p++ = u;
+    return p;
+}
+
+
+//
+// GetVarint
+// Returns NULL if the varint runs past end
+//
+static byte*
+GetVarint
+( byte*		p,
+  byte*		end,
+  int*		v )
+{
+    unsigned	u;
+    int		shift;
+
+    u = 0;
+    for (shift = 0 ; shift < 21 ; shift += 7)
+    {
+	if (p == end)
+	    return NULL;
+	u |= (*p & 0x7f) << shift;
+	if (!(*p++ & 0x80))
+	{
+	    *v = (int)(u >> 1) ^ -(int)(u & 1);
+	    return p;
+	}
+    }
+    return NULL;
+}
+
+
+//
+// EncodeDelta
+// Returns the number of bytes put in out
+//
+int EncodeDelta (byte* out)
+{
+    int		c;
+    int		numcmds;
+    int		stride;
+    byte*	p;
+    byte*	flags;
+    ticcmd_t*	cmd;
+    ticcmd_t*	prev;
+
+    *(unsigned *)out = htonl(netbuffer->checksum);
+    out[4] = netbuffer->retransmitfrom;
+    out[5] = netbuffer->starttic;
+    out[6] = netbuffer->player;
+    out[7] = netbuffer->numtics;
+    p = out + 8;
+
+    stride = (netbuffer->checksum & NCMD_SERVER) ? MAXPLAYERS : 1;
+    numcmds = NetbufferCmds ();
+    for (c=0 ; c<numcmds ; c++)
+    {
+	cmd = &netbuffer->cmds[c];
+	prev = c < stride ? &zerocmd : &netbuffer->cmds[c-stride];
+
+	flags = p++;
+	*flags = 0;
+	if (cmd->forwardmove != prev->forwardmove)
+	{
+	    *flags |= DC_FORWARD;
+	    *p++ = cmd->forwardmove;
+	}
+	if (cmd->sidemove != prev->sidemove)
+	{
+	    *flags |= DC_SIDE;
+	    *p++ = cmd->sidemove;
+	}
+	if (cmd->angleturn != prev->angleturn)
+	{
+	    *flags |= DC_ANGLE;
+	    p = PutVarint (p, cmd->angleturn);
+	}
+	if (cmd->consistancy != prev->consistancy)
+	{
+	    *flags |= DC_CONSIST;
+	    p = PutVarint (p, cmd->consistancy);
+	}
+	if (cmd->chatchar != prev->chatchar)
+	{
+	    *flags |= DC_CHAT;
+	    *p++ = cmd->chatchar;
+	}
+	if (cmd->buttons != prev->buttons)
+	{
+	    *flags |= DC_BUTTONS;
+	    *p++ = cmd->buttons;
+	}
+    }
+
+    return p - out;
+}
+
+
+//
+// DecodeDelta
+// Returns false if the packet is malformed
+//
+boolean
+DecodeDelta
+( byte*		in,
+  int		length )
+{
+    int		c;
+    int		v;
+    int		numcmds;
+    int		stride;
+    int		flags;
+    byte*	p;
+    byte*	end;
+    ticcmd_t*	cmd;
+    ticcmd_t*	prev;
+
+    if (length < 8)
+	return false;
+    
+    netbuffer->checksum = ntohl(*(unsigned *)in);
+    netbuffer->retransmitfrom = in[4];
+    netbuffer->starttic = in[5];
+    netbuffer->player = in[6];
+    netbuffer->numtics = in[7];
+    p = in + 8;
+    end = in + length;
+
+    stride = (netbuffer->checksum & NCMD_SERVER) ? MAXPLAYERS : 1;
+    numcmds = NetbufferCmds ();
+    if (numcmds > BACKUPTICS*MAXPLAYERS)
+	return false;
+    
+    for (c=0 ; c<numcmds ; c++)
+    {
+	cmd = &netbuffer->cmds[c];
+	prev = c < stride ? &zerocmd : &netbuffer->cmds[c-stride];
+	*cmd = *prev;
+
+	if (p == end)
+	    return false;
+	flags = *p++;
+	if (flags & ~(DC_FORWARD|DC_SIDE|DC_ANGLE|DC_CONSIST|DC_CHAT|DC_BUTTONS))
+	    return false;
+	
+	if (flags & DC_FORWARD)
+	{
+	    if (p == end)
+		return false;
+	    cmd->forwardmove = *p++;
+	}
+	if (flags & DC_SIDE)
+	{
+	    if (p == end)
+		return false;
+	    cmd->sidemove = *p++;
+	}
+	if (flags & DC_ANGLE)
+	{
+	    if ( !(p = GetVarint (p, end, &v)) )
+		return false;
+	    cmd->angleturn = v;
+	}
+	if (flags & DC_CONSIST)
+	{
+	    if ( !(p = GetVarint (p, end, &v)) )
+		return false;
+	    cmd->consistancy = v;
+	}
+	if (flags & DC_CHAT)
+	{
+	    if (p == end)
+		return false;
+	    cmd->chatchar = *p++;
+	}
+	if (flags & DC_BUTTONS)
+	{
+	    if (p == end)
+		return false;
+	    cmd->buttons = *p++;
+	}
+    }
+    
+    return p == end;
+}
+
+
+//
+// EncodeLegacy
+// Byte swaps the netbuffer into out
+//
+void EncodeLegacy (doomdata_t* sw)
+{
+    int		c;
+    int		numcmds;
+    
+    sw->checksum = htonl(netbuffer->checksum);
+    sw->player = netbuffer->player;
+    sw->retransmitfrom = netbuffer->retransmitfrom;
+    sw->starttic = netbuffer->starttic;
+    sw->numtics = netbuffer->numtics;
+    numcmds = NetbufferCmds ();
+    for (c=0 ; c< numcmds ; c++)
+    {
+	sw->cmds[c].forwardmove = netbuffer->cmds[c].forwardmove;
+	sw->cmds[c].sidemove = netbuffer->cmds[c].sidemove;
+	sw->cmds[c].angleturn = htons(netbuffer->cmds[c].angleturn);
+	sw->cmds[c].consistancy = htons(netbuffer->cmds[c].consistancy);
+	sw->cmds[c].chatchar = netbuffer->cmds[c].chatchar;
+	sw->cmds[c].buttons = netbuffer->cmds[c].buttons;
+    }
+}
+
+
+//
+// BATCHED I/O
+// On Linux a thread sleeps in epoll_wait on the socket and
+// reads whatever has arrived with one recvmmsg, straight into
+// a single producer, single consumer ring that PacketGet
+// drains without a system call.  Sends are queued and go out
+// with one sendmmsg on CMD_FLUSH, or before the next CMD_GET.
+// -nonetbatch goes back to a recvfrom or sendto per packet.
+//
+#ifdef __linux__
+
+#define NETBATCH	32		// packets per recvmmsg or sendmmsg
+#define NETRINGSIZE	256		// must be a power of two
+
+typedef struct
+{
+    struct sockaddr_in	from;
+    int			length;
+    wirepacket_t	wire;
+} netpacket_t;
+
+netpacket_t	netring[NETRINGSIZE];
+SDL_atomic_t	netringhead;		// only the thread advances it
+SDL_atomic_t	netringtail;		// only PacketGet advances it
+boolean		netbatch;
+
+// I_NetWait sleeps on netcond until the thread adds packets
+SDL_mutex*	netlock;
+SDL_cond*	netcond;
+
+struct mmsghdr		sendmsgs[NETBATCH];
+struct iovec		sendiov[NETBATCH];
+struct sockaddr_in	sendtoaddress[NETBATCH];
+wirepacket_t		sendbufs[NETBATCH];
+int			numqueued;
+
+
+//
+// NetThread
+// Fills the ring until the socket would block, then
+// waits for more.  A full ring drops the packet, as
+// the socket buffer would have.
+//
+static int NetThread (void* unused)
+{
+    struct mmsghdr	msgs[NETBATCH];
+    struct iovec	iov[NETBATCH];
+    struct epoll_event	ev;
+    netpacket_t*	slot;
+    wirepacket_t	discard;
+    int			ep;
+    int			head;
+    int			room;
+    int			i;
+    int			n;
+
+    ep = epoll_create1 (0);
+    if (ep == -1)
+	I_Error ("NetThread: epoll_create1: %s", strerror(errno));
+    ev.events = EPOLLIN;
+    ev.data.fd = insocket;
+    if (epoll_ctl (ep, EPOLL_CTL_ADD, insocket, &ev) == -1)
+	I_Error ("NetThread: epoll_ctl: %s", strerror(errno));
+
+    M_TraceThread ("net");
+
+    while (1)
+    {
+	if (epoll_wait (ep, &ev, 1, -1) < 1)
+	    continue;
+
+	while (1)
+	{
+	    head = SDL_AtomicGet (&netringhead);
+	    room = NETRINGSIZE - (head - SDL_AtomicGet (&netringtail));
+	    if (!room)
+	    {
+		if (recv (insocket, &discard, sizeof(discard),
+			  MSG_DONTWAIT) == -1)
+		    break;
+		continue;
+	    }
+	    if (room > NETBATCH)
+		room = NETBATCH;
+
+	    memset (msgs, 0, room*sizeof(*msgs));
+	    for (i=0 ; i<room ; i++)
+	    {
+		slot = &netring[(head+i) & (NETRINGSIZE-1)];
+		iov[i].iov_base = &slot->wire;
+		iov[i].iov_len = sizeof(slot->wire);
+		msgs[i].msg_hdr.msg_name = &slot->from;
+		msgs[i].msg_hdr.msg_namelen = sizeof(slot->from);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	    }
+
+	    TRACE_BEGIN ("recvmmsg");
+	    n = recvmmsg (insocket, msgs, room, MSG_DONTWAIT, NULL);
+	    TRACE_END ();
+	    if (n < 1)
+		break;			// drained, wait again
+
+	    for (i=0 ; i<n ; i++)
+		netring[(head+i) & (NETRINGSIZE-1)].length = msgs[i].msg_len;
+
+	    // under the lock, so a waiter can't miss it
+	    SDL_LockMutex (netlock);
+	    SDL_AtomicSet (&netringhead, head+n);
+	    SDL_CondSignal (netcond);
+	    SDL_UnlockMutex (netlock);
+	}
+    }
+    return 0;
+}
+
+
+//
+// FlushPackets
+//
+void FlushPackets (void)
+{
+    int		sent;
+    int		c;
+
+    for (sent=0 ; sent<numqueued ; sent+=c)
+    {
+	c = sendmmsg (sendsocket, &sendmsgs[sent], numqueued-sent, 0);
+	// sendmmsg stops at the first message that fails,
+	// lose just that one, like a failed sendto
+	if (c < 1)
+	    c = 1;
+    }
+    numqueued = 0;
+}
+
+
+//
+// QueuePacket
+//
+void QueuePacket (void)
+{
+    struct mmsghdr*	msg;
+
+    if (numqueued == NETBATCH)
+	FlushPackets ();
+
+    memcpy (&sendbufs[numqueued], &wiresend, wiresendlength);
+    sendtoaddress[numqueued] = sendaddress[doomcom->remotenode];
+    sendiov[numqueued].iov_base = &sendbufs[numqueued];
+    sendiov[numqueued].iov_len = wiresendlength;
+
+    msg = &sendmsgs[numqueued];
+    memset (msg, 0, sizeof(*msg));
+    msg->msg_hdr.msg_name = &sendtoaddress[numqueued];
+    msg->msg_hdr.msg_namelen = sizeof(sendtoaddress[numqueued]);
+    msg->msg_hdr.msg_iov = &sendiov[numqueued];
+    msg->msg_hdr.msg_iovlen = 1;
+    numqueued++;
+}
+
+
+//
+// StartBatching
+//
+void StartBatching (void)
+{
+    if (M_CheckParm ("-nonetbatch"))
+	return;
+
+    netlock = SDL_CreateMutex ();
+    netcond = SDL_CreateCond ();
+    if (!netlock || !netcond)
+    {
+	printf ("StartBatching: %s, no batched I/O\n", SDL_GetError ());
+	return;
+    }
+
+    if (!SDL_CreateThread (NetThread, "net", NULL))
+    {
+	printf ("StartBatching: %s, no batched I/O\n", SDL_GetError ());
+	return;
+    }
+    netbatch = true;
+}
+
+#else
+
+void FlushPackets (void)
+{
+}
+
+void StartBatching (void)
+{
+}
+
+#endif // __linux__
+
+
 //
 // PacketSend
 //
 void PacketSend (void)
 {
     int		c;
-    doomdata_t	sw;
-				
-    // byte swap
-    sw.checksum = htonl(netbuffer->checksum);
-    sw.player = netbuffer->player;
-    sw.retransmitfrom = netbuffer->retransmitfrom;
-    sw.starttic = netbuffer->starttic;
-    sw.numtics = netbuffer->numtics;
-    for (c=0 ; c< netbuffer->numtics ; c++)
-    {
-	sw.cmds[c].forwardmove = netbuffer->cmds[c].forwardmove;
-	sw.cmds[c].sidemove = netbuffer->cmds[c].sidemove;
-	sw.cmds[c].angleturn = htons(netbuffer->cmds[c].angleturn);
-	sw.cmds[c].consistancy = htons(netbuffer->cmds[c].consistancy);
-	sw.cmds[c].chatchar = netbuffer->cmds[c].chatchar;
-	sw.cmds[c].buttons = netbuffer->cmds[c].buttons;
-    }
 		
+    // only encode again if the packet changed
+    if (doomcom->datalength != lastsentsize
+	|| memcmp (&lastsent, netbuffer, doomcom->datalength))
+    {
+	memcpy (&lastsent, netbuffer, doomcom->datalength);
+	lastsentsize = doomcom->datalength;
+	
+	if (netbuffer->checksum & NCMD_DELTA)
+	{
+	    wiresendlength = EncodeDelta (wiresend.bytes);
+	}
+	else
+	{
+	    EncodeLegacy (&wiresend.data);
+	    wiresendlength = doomcom->datalength;
+	}
+    }
+    doomcom->wirelength = wiresendlength;
+    
+#ifdef __linux__
+    if (netbatch)
+    {
+	QueuePacket ();
+	return;
+    }
+#endif
+
     //printf ("sending %i\n",gametic);		
-    c = sendto (sendsocket , &sw, doomcom->datalength
+    c = sendto (sendsocket , &wiresend, wiresendlength
 		,0,(void *)&sendaddress[doomcom->remotenode]
 		,sizeof(sendaddress[doomcom->remotenode]));
 	
@@ -160,68 +1001,134 @@ void PacketSend (void)
 
 
 //
-// PacketGet
+// PacketRead
+// Finds the node a received packet came from
+// and puts it in netbuffer.
 //
-void PacketGet (void)
+void
+PacketRead
+( struct sockaddr_in*	from,
+  wirepacket_t*		wire,
+  int			c )
 {
     int			i;
-    int			c;
-    struct sockaddr_in	fromaddress;
-    int			fromlen;
-    doomdata_t		sw;
-				
-    fromlen = sizeof(fromaddress);
-    c = recvfrom (insocket, &sw, sizeof(sw), 0
-		  , (struct sockaddr *)&fromaddress, &fromlen );
-    if (c == -1 )
-    {
-	if (errno != EWOULDBLOCK)
-	    I_Error ("GetPacket: %s",strerror(errno));
-	doomcom->remotenode = -1;		// no packet
-	return;
-    }
+    int			numcmds;
+    doomdata_t*		sw;
 
     {
 	static int first=1;
 	if (first)
-	    printf("len=%d:p=[0x%x 0x%x] \n", c, *(int*)&sw, *((int*)&sw+1));
+	    printf("len=%d:p=[0x%x 0x%x] \n", c, *(int*)wire, *((int*)wire+1));
 	first = 0;
     }
 
-    // find remote node number
+    // find remote node number, client/server
+    // nodes can share an address on other ports
     for (i=0 ; i<doomcom->numnodes ; i++)
-	if ( fromaddress.sin_addr.s_addr == sendaddress[i].sin_addr.s_addr )
+	if ( from->sin_addr.s_addr == sendaddress[i].sin_addr.s_addr
+	     && (doomcom->netmode == NET_PEER
+		 || from->sin_port == sendaddress[i].sin_port) )
 	    break;
 
     if (i == doomcom->numnodes)
     {
-	// packet is not from one of the players (new game broadcast)
-	doomcom->remotenode = -1;		// no packet
-	return;
+	if (doomcom->netmode != NET_SERVER || i == MAXNETNODES)
+	{
+	    // packet is not from one of the players (new game broadcast)
+	    doomcom->remotenode = -1;		// no packet
+	    return;
+	}
+	// maybe a client joining, the server can
+	// answer it as node numnodes
+	sendaddress[i] = *from;
     }
 	
     doomcom->remotenode = i;			// good packet from a game player
     doomcom->datalength = c;
+    doomcom->wirelength = c;
+
+    if (c >= 4 && (ntohl(wire->data.checksum) & NCMD_DELTA))
+    {
+	// the length it would have had, so HGetPacket
+	// checks delta packets the same way
+	if (DecodeDelta (wire->bytes, c))
+	    doomcom->datalength = (byte *)&netbuffer->cmds[NetbufferCmds ()]
+		- (byte *)netbuffer;
+	else
+	    doomcom->datalength = 0;
+	return;
+    }
 	
     // byte swap
-    netbuffer->checksum = ntohl(sw.checksum);
-    netbuffer->player = sw.player;
-    netbuffer->retransmitfrom = sw.retransmitfrom;
-    netbuffer->starttic = sw.starttic;
-    netbuffer->numtics = sw.numtics;
+    sw = &wire->data;
+    netbuffer->checksum = ntohl(sw->checksum);
+    netbuffer->player = sw->player;
+    netbuffer->retransmitfrom = sw->retransmitfrom;
+    netbuffer->starttic = sw->starttic;
+    netbuffer->numtics = sw->numtics;
 
-    for (c=0 ; c< netbuffer->numtics ; c++)
+    numcmds = NetbufferCmds ();
+    if (numcmds > BACKUPTICS*MAXPLAYERS)
+	numcmds = BACKUPTICS*MAXPLAYERS;	// bad length, dropped later
+    for (c=0 ; c< numcmds ; c++)
     {
-	netbuffer->cmds[c].forwardmove = sw.cmds[c].forwardmove;
-	netbuffer->cmds[c].sidemove = sw.cmds[c].sidemove;
-	netbuffer->cmds[c].angleturn = ntohs(sw.cmds[c].angleturn);
-	netbuffer->cmds[c].consistancy = ntohs(sw.cmds[c].consistancy);
-	netbuffer->cmds[c].chatchar = sw.cmds[c].chatchar;
-	netbuffer->cmds[c].buttons = sw.cmds[c].buttons;
+	netbuffer->cmds[c].forwardmove = sw->cmds[c].forwardmove;
+	netbuffer->cmds[c].sidemove = sw->cmds[c].sidemove;
+	netbuffer->cmds[c].angleturn = ntohs(sw->cmds[c].angleturn);
+	netbuffer->cmds[c].consistancy = ntohs(sw->cmds[c].consistancy);
+	netbuffer->cmds[c].chatchar = sw->cmds[c].chatchar;
+	netbuffer->cmds[c].buttons = sw->cmds[c].buttons;
     }
 }
 
 
+//
+// PacketGet
+//
+void PacketGet (void)
+{
+    int			c;
+    struct sockaddr_in	fromaddress;
+    int			fromlen;
+    wirepacket_t	wire;
+
+#ifdef __linux__
+    if (netbatch)
+    {
+	netpacket_t*	slot;
+	int		tail;
+
+	// anything we answer goes out before we look again
+	FlushPackets ();
+
+	tail = SDL_AtomicGet (&netringtail);
+	if (tail == SDL_AtomicGet (&netringhead))
+	{
+	    doomcom->remotenode = -1;		// no packet
+	    return;
+	}
+	slot = &netring[tail & (NETRINGSIZE-1)];
+	PacketRead (&slot->from, &slot->wire, slot->length);
+	SDL_AtomicSet (&netringtail, tail+1);
+	return;
+    }
+#endif
+				
+    fromlen = sizeof(fromaddress);
+    c = recvfrom (insocket, &wire, sizeof(wire), 0
+		  , (struct sockaddr *)&fromaddress, &fromlen );
+    if (c == -1 )
+    {
+	if (errno != EWOULDBLOCK)
+	    I_Error ("GetPacket: %s",strerror(errno));
+	doomcom->remotenode = -1;		// no packet
+	return;
+    }
+
+    PacketRead (&fromaddress, &wire, c);
+}
+
+
 
 int GetLocalAddress (void)
 {
@@ -273,6 +1180,9 @@ void I_InitNetwork (void)
     else
 	doomcom-> extratics = 0;
 		
+    if (LoopbackInit ())
+	return;
+		
     p = M_CheckParm ("-port");
     if (p && p<myargc-1)
     {
@@ -280,6 +1190,75 @@ void I_InitNetwork (void)
 	printf ("using alternate port %i\n",DOOMPORT);
     }
     
+    // dedicated server for the clients to join,
+    //  -server <numplayers>
+    i = M_CheckParm ("-server");
+    if (i && i<myargc-1)
+    {
+	netsend = PacketSend;
+	netget = PacketGet;
+	netgame = true;
+
+	doomcom->id = DOOMCOM_ID;
+	doomcom->netmode = NET_SERVER;
+	doomcom->ticdup = 1;
+	doomcom->consoleplayer = 0;
+	doomcom->numnodes = 1;	// grows as the clients join
+	doomcom->numplayers = atoi (myargv[i+1]);
+	if (doomcom->numplayers < 1 || doomcom->numplayers > MAXPLAYERS)
+	    I_Error ("-server: %i players, 1 to %i allowed",
+		     doomcom->numplayers, MAXPLAYERS);
+	
+	insocket = UDPsocket ();
+	BindToLocalPort (insocket,htons(DOOMPORT));
+	ioctl (insocket, FIONBIO, &trueval);
+
+	// answer clients on the port they sent from
+	sendsocket = insocket;
+	StartBatching ();
+	return;
+    }
+    
+    // client of a dedicated server,
+    //  -connect <host>
+    i = M_CheckParm ("-connect");
+    if (i && i<myargc-1)
+    {
+	netsend = PacketSend;
+	netget = PacketGet;
+	netgame = true;
+
+	doomcom->id = DOOMCOM_ID;
+	doomcom->netmode = NET_CLIENT;
+	doomcom->ticdup = 1;
+	doomcom->numnodes = 2;	// this node and the server
+	doomcom->numplayers = 1;	// until the server tells
+	
+	i++;
+	sendaddress[1].sin_family = AF_INET;
+	sendaddress[1].sin_port = htons(DOOMPORT);
+	if (myargv[i][0] == '.')
+	{
+	    sendaddress[1].sin_addr.s_addr = inet_addr (myargv[i]+1);
+	}
+	else
+	{
+	    hostentry = gethostbyname (myargv[i]);
+	    if (!hostentry)
+		I_Error ("gethostbyname: couldn't find %s", myargv[i]);
+	    sendaddress[1].sin_addr.s_addr = *(int *)hostentry->h_addr_list[0];
+	}
+
+	// any free port, so several clients
+	// and the server can share a host
+	insocket = UDPsocket ();
+	BindToLocalPort (insocket,0);
+	ioctl (insocket, FIONBIO, &trueval);
+	sendsocket = insocket;
+	StartBatching ();
+	return;
+    }
+    
     // parse network game options,
     //  -net <consoleplayer> <host> <host> ...
     i = M_CheckParm ("-net");
@@ -333,6 +1312,7 @@ void I_InitNetwork (void)
     ioctl (insocket, FIONBIO, &trueval);
 
     sendsocket = UDPsocket ();
+    StartBatching ();
 }
 
 
@@ -346,10 +1326,58 @@ void I_NetCmd (void)
     {
 	netget ();
     }
+    else if (doomcom->command == CMD_FLUSH)
+    {
+	FlushPackets ();
+    }
     else
 	I_Error ("Bad net cmd: %i\n",doomcom->command);
 }
 
+
+//
+// I_NetWait
+// Sleeps for up to ms milliseconds,
+// less if a packet comes in first
+//
+void I_NetWait (int ms)
+{
+    struct pollfd	pfd;
+
+    if (ms <= 0)
+	return;
+
+    // simulated packets come due on the clock,
+    // so look again every millisecond
+    if (netget == LoopGet)
+    {
+	I_Sleep (1);
+	return;
+    }
+
+    if (netget != PacketGet)
+    {
+	I_Sleep (ms);
+	return;
+    }
+
+#ifdef __linux__
+    if (netbatch)
+    {
+	SDL_LockMutex (netlock);
+	if (SDL_AtomicGet (&netringhead) == SDL_AtomicGet (&netringtail))
+	    SDL_CondWaitTimeout (netcond, netlock, ms);
+	SDL_UnlockMutex (netlock);
+	return;
+    }
+#endif
+
+    pfd.fd = insocket;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll (&pfd, 1, ms);
+}
+
 #else
 
 void I_InitNetwork (void)
@@ -360,6 +1388,9 @@ void I_InitNetwork (void)
     doomcom->ticdup = 1;
     doomcom->extratics = 0;
 
+    if (LoopbackInit ())
+	return;
+
     netgame = false;
     doomcom->id = DOOMCOM_ID;
     doomcom->numplayers = doomcom->numnodes = 1;
@@ -369,7 +1400,26 @@ void I_InitNetwork (void)
 
 void I_NetCmd (void)
 {
-    I_Error ("Network gaming not supported on Windows\n");
+    if (!netsend)
+	I_Error ("Network gaming not supported on Windows\n");
+    
+    if (doomcom->command == CMD_SEND)
+	netsend ();
+    else if (doomcom->command == CMD_GET)
+	netget ();
+}
+
+
+//
+// I_NetWait
+//
+void I_NetWait (int ms)
+{
+    if (ms <= 0)
+	return;
+    if (netget == LoopGet)
+	ms = 1;
+    I_Sleep (ms);
 }
 
 #endif // _WIN32
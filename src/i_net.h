@@ -36,6 +36,13 @@
 void I_InitNetwork (void);
 void I_NetCmd (void);
 
+// Sleeps for up to ms milliseconds, waking
+// early when a packet arrives.
+void I_NetWait (int ms);
+
+// Packet counts of a -loopback game.
+void I_LoopbackStats (void);
+
 
 #endif
 //-----------------------------------------------------------------------------
@@ -0,0 +1,484 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	An FM synthesizer that takes the register writes of an
+//	OPL2, in two banks for eighteen channels with the left
+//	and right bits of an OPL3, and renders straight at the
+//	output rate rather than the chip's 49716 Hz.
+//	Attenuation is kept in the chip's 0.1875 dB steps, and
+//	the operators, envelopes, key scaling, feedback and
+//	tremolo and vibrato follow the data sheet closely
+//	enough for the GENMIDI patches.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: i_opl.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <string.h>
+#include <math.h>
+
+#ifdef __GNUG__
+#pragma implementation "i_opl.h"
+#endif
+#include "i_opl.h"
+
+
+#define ENV_MAX		511		// silent, in 0.1875 dB steps
+#define ENV_SHIFT	16		// fraction bits of an envelope
+#define ATT_SIZE	1024
+
+enum
+{
+    env_off,
+    env_attack,
+    env_decay,
+    env_sustain,
+    env_release
+};
+
+typedef struct
+{
+    // registers
+    int		am;
+    int		vib;
+    int		egtyp;		// holds at the sustain level
+    int		ksr;
+    int		mult;
+    int		ksl;
+    int		tl;
+    int		ar;
+    int		dr;
+    int		sl;
+    int		rr;
+    int		wave;
+
+    unsigned	phase;		// 32 bits a cycle
+    unsigned	inc;		// a sample
+    int		state;
+    int		env;		// attenuation, ENV_SHIFT fraction bits
+    int		attack;		// ENV_SHIFT fraction of env a sample
+    int		decay;
+    int		release;
+    int		sustain;	// level, in env units
+    int		kslatt;
+    int		out[2];		// last two, for feedback
+
+} oploperator_t;
+
+typedef struct
+{
+    oploperator_t	op[2];
+    int			fnum;
+    int			block;
+    int			keyon;
+    int			feedback;
+    int			additive;	// both operators heard
+    int			left;
+    int			right;
+
+} oplchannel_t;
+
+
+static oplchannel_t	channels[OPL_NUMCHANNELS];
+static int		outrate = 44100;
+static int		amdepth;	// tremolo of 4.8 dB, else 1 dB
+static int		vibdepth;	// vibrato of 14 cents, else 7
+
+static int		waves[4][1024];
+static int		atttab[ATT_SIZE];	// 16.16 amplitude
+
+static const int	multx2[16] =
+{
+    1, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 20, 24, 24, 30, 30
+};
+
+static const int	kslrom[16] =
+{
+    0, 32, 40, 45, 48, 51, 53, 55, 56, 58, 59, 60, 61, 62, 63, 64
+};
+
+static const int	kslshift[4] = { 8, 1, 2, 0 };
+
+// The low frequency oscillators, a step a sample.
+static unsigned		amphase;
+static unsigned		amstep;
+static unsigned		vibphase;
+static unsigned		vibstep;
+
+
+//
+// OPL_Init
+//
+void OPL_Init (int rate)
+{
+    double	s;
+    int		i;
+
+    outrate = rate;
+    amdepth = vibdepth = 0;
+    memset (channels, 0, sizeof(channels));
+    for (i=0 ; i<OPL_NUMCHANNELS ; i++)
+    {
+	channels[i].op[0].env = channels[i].op[1].env = ENV_MAX<<ENV_SHIFT;
+	channels[i].left = channels[i].right = 1;
+    }
+
+    for (i=0 ; i<1024 ; i++)
+    {
+	s = sin ((i+0.5) * 2*3.14159265358979 / 1024) * 4084;
+	waves[0][i] = (int)s;
+	waves[1][i] = i < 512 ? (int)s : 0;
+	waves[2][i] = (int)fabs (s);
+	waves[3][i] = i & 256 ? 0 : (int)fabs (s);
+    }
+
+    for (i=0 ; i<ATT_SIZE ; i++)
+	atttab[i] = (int)(65536 * pow (10, -i*0.1875/20));
+    atttab[ATT_SIZE-1] = 0;
+
+    // 3.7 Hz tremolo and 6.1 Hz vibrato, as on the chip
+    amphase = vibphase = 0;
+    amstep = (unsigned)(3.7 * 4294967296.0 / rate);
+    vibstep = (unsigned)(6.1 * 4294967296.0 / rate);
+}
+
+
+//
+// EnvelopeRate
+// The rate, 0 to 63, from a 4 bit rate and the key scaling
+//
+static int EnvelopeRate (oplchannel_t* ch, oploperator_t* op, int r)
+{
+    int		ksv;
+    int		rate;
+
+    if (!r)
+	return 0;
+    ksv = (ch->block<<1) | ((ch->fnum>>9)&1);
+    rate = 4*r + (op->ksr ? ksv : ksv>>2);
+    return rate > 63 ? 63 : rate;
+}
+
+
+//
+// UpdateOperator
+// Everything worked out from the registers
+//
+static void UpdateOperator (oplchannel_t* ch, oploperator_t* op)
+{
+    double	t;
+    int		rate;
+    int		ksl;
+
+    op->inc = (unsigned)(((long long)(ch->fnum << ch->block) * multx2[op->mult]
+			  * 2048 * OPL_RATE) / outrate);
+
+    ksl = (kslrom[ch->fnum>>6] << 2) - ((8 - ch->block) << 5);
+    op->kslatt = ksl < 0 ? 0 : ksl >> kslshift[op->ksl];
+
+    op->sustain = (op->sl == 15 ? 31 : op->sl) << 4;
+
+    // the data sheet's times over the full 96 dB, which
+    // halve every four steps of rate
+    rate = EnvelopeRate (ch, op, op->ar);
+    if (rate >= 60)
+	op->attack = -1;		// at once
+    else if (!rate)
+	op->attack = 0;
+    else
+    {
+	t = 2.826 * pow (2, -(rate-4)/4.0) * outrate;
+	op->attack = (int)((1 - pow (ENV_MAX, -1/t)) * 65536) + 1;
+    }
+
+    rate = EnvelopeRate (ch, op, op->dr);
+    t = 39.28 * pow (2, -(rate-4)/4.0) * outrate;
+    op->decay = rate ? (int)((ENV_MAX<<ENV_SHIFT) / t) + 1 : 0;
+
+    rate = EnvelopeRate (ch, op, op->rr);
+    t = 39.28 * pow (2, -(rate-4)/4.0) * outrate;
+    op->release = rate ? (int)((ENV_MAX<<ENV_SHIFT) / t) + 1 : 0;
+}
+
+
+//
+// KeyOn
+//
+static void KeyOn (oplchannel_t* ch, int on)
+{
+    int		i;
+
+    if (on == ch->keyon)
+	return;
+    ch->keyon = on;
+
+    for (i=0 ; i<2 ; i++)
+    {
+	if (on)
+	{
+	    ch->op[i].phase = 0;
+	    ch->op[i].state = env_attack;
+	}
+	else if (ch->op[i].state != env_off)
+	    ch->op[i].state = env_release;
+    }
+}
+
+
+//
+// OPL_WriteReg
+//
+void OPL_WriteReg (int reg, int value)
+{
+    static const int	slots[32] =
+    {
+	0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1,
+	12, 13, 14, 15, 16, 17, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+    };
+    oplchannel_t*	ch;
+    oploperator_t*	op;
+    int			bank;
+    int			slot;
+    int			c;
+
+    bank = (reg >> 8) & 1;
+    reg &= 0xff;
+
+    if (reg == 0xbd)
+    {
+	amdepth = (value >> 7) & 1;
+	vibdepth = (value >> 6) & 1;
+	return;
+    }
+
+    if (reg >= 0xa0 && reg <= 0xc8)
+    {
+	c = reg & 0x0f;
+	if (c > 8)
+	    return;
+	ch = &channels[bank*9 + c];
+
+	switch (reg & 0xf0)
+	{
+	  case 0xa0:
+	    ch->fnum = (ch->fnum & 0x300) | value;
+	    break;
+	  case 0xb0:
+	    ch->fnum = (ch->fnum & 0xff) | ((value & 3) << 8);
+	    ch->block = (value >> 2) & 7;
+	    KeyOn (ch, (value >> 5) & 1);
+	    break;
+	  case 0xc0:
+	    ch->additive = value & 1;
+	    ch->feedback = (value >> 1) & 7;
+	    ch->left = (value >> 4) & 1;
+	    ch->right = (value >> 5) & 1;
+	    if (!ch->left && !ch->right)
+		ch->left = ch->right = 1;	// as an OPL2
+	    return;
+	}
+	UpdateOperator (ch, &ch->op[0]);
+	UpdateOperator (ch, &ch->op[1]);
+	return;
+    }
+
+    if (reg < 0x20 || (reg >= 0xa0 && reg < 0xe0) || reg >= 0xf6)
+	return;
+
+    slot = slots[reg & 0x1f];
+    if (slot == -1)
+	return;
+    ch = &channels[bank*9 + (slot/6)*3 + slot%3];
+    op = &ch->op[(slot%6)/3];
+
+    switch (reg & 0xe0)
+    {
+      case 0x20:
+	op->am = (value >> 7) & 1;
+	op->vib = (value >> 6) & 1;
+	op->egtyp = (value >> 5) & 1;
+	op->ksr = (value >> 4) & 1;
+	op->mult = value & 15;
+	break;
+      case 0x40:
+	op->ksl = (value >> 6) & 3;
+	op->tl = value & 63;
+	break;
+      case 0x60:
+	op->ar = value >> 4;
+	op->dr = value & 15;
+	break;
+      case 0x80:
+	op->sl = value >> 4;
+	op->rr = value & 15;
+	break;
+      case 0xe0:
+	op->wave = value & 3;
+	break;
+    }
+    UpdateOperator (ch, op);
+}
+
+
+//
+// StepEnvelope
+//
+static inline void StepEnvelope (oploperator_t* op)
+{
+    switch (op->state)
+    {
+      case env_attack:
+	if (op->attack == -1)
+	    op->env = 0;
+	else
+	    op->env -= (int)(((long long)op->env * op->attack) >> 16);
+	if (op->env < (1<<ENV_SHIFT))
+	{
+	    op->env = 0;
+	    op->state = env_decay;
+	}
+	break;
+
+      case env_decay:
+	op->env += op->decay;
+	if (op->env >= op->sustain<<ENV_SHIFT)
+	{
+	    op->env = op->sustain<<ENV_SHIFT;
+	    op->state = op->egtyp ? env_sustain : env_release;
+	}
+	break;
+
+      case env_release:
+	op->env += op->release;
+	if (op->env >= ENV_MAX<<ENV_SHIFT)
+	{
+	    op->env = ENV_MAX<<ENV_SHIFT;
+	    op->state = env_off;
+	}
+	break;
+    }
+}
+
+
+//
+// OperatorOutput
+// Phase modulation is in 1/1024 of a cycle
+//
+static inline int
+OperatorOutput
+( oploperator_t*	op,
+  int			mod,
+  int			trem,
+  int			vib )
+{
+    int		att;
+    int		out;
+
+    att = (op->env >> ENV_SHIFT) + (op->tl << 2) + op->kslatt;
+    if (op->am)
+	att += trem;
+    if (att >= ATT_SIZE)
+	att = ATT_SIZE-1;
+
+    out = (waves[op->wave][((op->phase + ((unsigned)mod << 22)) >> 22)]
+	   * atttab[att]) >> 16;
+
+    op->phase += op->inc;
+    if (op->vib)
+	op->phase += (int)(((long long)op->inc * vib) >> 16);
+    StepEnvelope (op);
+    return out;
+}
+
+
+//
+// OPL_Render
+//
+void OPL_Render (int* mix, int samples, int gain)
+{
+    oplchannel_t*	ch;
+    oploperator_t*	op0;
+    oploperator_t*	op1;
+    int			trem;
+    int			vib;
+    int			tri;
+    int			mod;
+    int			out;
+    int			i;
+    int			c;
+
+    for (i=0 ; i<samples ; i++)
+    {
+	// triangle tremolo, down to 4.8 or 1 dB
+	tri = amphase >> 23;				// 0-511
+	tri = tri < 256 ? tri : 511 - tri;		// 0-255
+	trem = amdepth ? tri * 26 >> 8 : tri * 5 >> 8;
+
+	// triangle vibrato of 7 or 14 cents, as a 16.16 change of step
+	tri = vibphase >> 22;				// 0-1023
+	tri = (tri < 512 ? tri : 1023 - tri) - 256;	// -256-255
+	vib = vibdepth ? tri * 530 >> 8 : tri * 265 >> 8;
+	amphase += amstep;
+	vibphase += vibstep;
+
+	for (c=0 ; c<OPL_NUMCHANNELS ; c++)
+	{
+	    ch = &channels[c];
+	    op0 = &ch->op[0];
+	    op1 = &ch->op[1];
+	    if (op1->state == env_off
+		&& (!ch->additive || op0->state == env_off))
+		continue;
+
+	    mod = ch->feedback
+		? (op0->out[0] + op0->out[1]) >> (9 - ch->feedback) : 0;
+	    op0->out[1] = op0->out[0];
+	    op0->out[0] = OperatorOutput (op0, mod, trem, vib);
+
+	    if (ch->additive)
+		out = op0->out[0] + OperatorOutput (op1, 0, trem, vib);
+	    else
+		out = OperatorOutput (op1, op0->out[0], trem, vib);
+
+	    out *= gain;
+	    if (ch->left)
+		mix[i*2] += out;
+	    if (ch->right)
+		mix[i*2+1] += out;
+	}
+    }
+}
+
+
+//
+// OPL_SoundingChannels
+//
+int OPL_SoundingChannels (void)
+{
+    int		count;
+    int		c;
+
+    count = 0;
+    for (c=0 ; c<OPL_NUMCHANNELS ; c++)
+	if (channels[c].op[1].state != env_off
+	    || (channels[c].additive && channels[c].op[0].state != env_off))
+	    count++;
+    return count;
+}
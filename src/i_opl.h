@@ -0,0 +1,51 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	Software FM synthesizer with the registers of an OPL3
+//	in two operator mode.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __I_OPL__
+#define __I_OPL__
+
+
+#define OPL_RATE		49716	// the chip's own, in Hz
+#define OPL_NUMCHANNELS		18	// nine in each register bank
+
+
+// Output at rate Hz, and all registers cleared.
+void OPL_Init (int rate);
+
+// The second bank is at 0x100, as on an OPL3.
+void OPL_WriteReg (int reg, int value);
+
+// Adds samples of stereo output times gain into mix.
+// Costs a little for each channel that is sounding.
+void OPL_Render (int* mix, int samples, int gain);
+
+// Channels whose envelopes have not finished.
+int OPL_SoundingChannels (void);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
@@ -42,12 +42,18 @@ rcsid[] = "$Id: i_unix.c,v 1.5 1997/02/03 22:45:10 b1 Exp $";
 
 #include <SDL.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "z_zone.h"
 
 #include "i_system.h"
 #include "i_sound.h"
+#include "i_mus.h"
 #include "m_argv.h"
 #include "m_misc.h"
+#include "m_trace.h"
 #include "w_wad.h"
 
 #include "doomdef.h"
@@ -62,104 +68,602 @@ char* sndserver_filename = "sndserver";
 
 
 // Needed for calling the actual sound output.
+// The device runs at snd_samplerate with buffers of
+// snd_samplecount, and the mixer works through them
+// SAMPLECOUNT at most at a time.
 #define SAMPLERATE		22050
 #define SAMPLECOUNT		512
-#define NUM_CHANNELS		8
+#define NUM_CHANNELS		8	// voices unless snd_channels says
+#define MAX_CHANNELS		128
 
 static SDL_AudioDeviceID audio_device = 0;
 static SDL_AudioSpec audio_spec;
 
+int snd_samplerate = SAMPLERATE;
+int snd_samplecount = SAMPLECOUNT;	// frames, a power of two
+
+// How the callback keeps up, written by the audio thread.
+// An underrun is a callback that took longer than the
+// audio it made lasts, so the device ran dry.
+static SDL_atomic_t audio_callbacks;
+static SDL_atomic_t audio_mix_us;	// wraps, read as a difference
+static SDL_atomic_t audio_max_us;	// taken and cleared
+static SDL_atomic_t audio_underruns;
+static SDL_atomic_t audio_period_us;	// of the last callback
+
 typedef struct
 {
     unsigned char* data;
     int length;
     int position;
+    unsigned int frac;		// 16.16 with position
+    unsigned int step;		// source samples per output sample
+    int samplerate;
+    int left_gain;		// see I_SetChannelParams
+    int right_gain;
+    int left_now;		// 16.16, gliding to the gains
+    int right_now;
+    int left_delta;
+    int right_delta;
+    int ramp;			// samples left of the glide
     int active;
     int loop;
     int volume;
     int separation;
     int pitch;
     int sfx_id;
+    int serial;
 } channel_t;
 
-static channel_t channels[NUM_CHANNELS];
+// Owned by the audio thread.
+static channel_t channels[MAX_CHANNELS];
+
+// The game thread never touches channels[] or waits on the
+// audio thread: it sends commands through a single producer,
+// single consumer ring that the callback drains before each
+// mix, and the callback publishes the serial of each sound
+// it has finished in channel_done.
+#define SOUND_RING_SIZE		256	// a power of two
+
+typedef enum
+{
+    sound_start,
+    sound_stop,
+    sound_update,
+    music_play,
+    music_stop,
+    music_pause,
+    music_resume,
+    music_volume_set,
+    music_unregister
+} sound_cmd_type_t;
 
-// Sound effects data
 typedef struct
 {
-    unsigned char* data;
+    sound_cmd_type_t type;
+    int channel;		// or song handle
+    int serial;
+    int sfx_id;
+    int volume;
+    int separation;
+    int pitch;
+    unsigned char* data;	// of the sound, for sound_start
     int length;
     int samplerate;
+} sound_cmd_t;
+
+static sound_cmd_t sound_ring[SOUND_RING_SIZE];
+static SDL_atomic_t sound_ring_head;	// only the game thread advances it
+static SDL_atomic_t sound_ring_tail;	// only the callback advances it
+static int sound_ring_dropped;
+
+static SDL_atomic_t channel_done[MAX_CHANNELS];
+static SDL_atomic_t mix_voices;		// how many the callback mixes
+
+// The positional sounds are all moved once a frame, in one
+// block rather than a ring command each.  The game fills the
+// back block and swaps it with the middle one; the callback
+// swaps the middle one to the front when it is fresh, so each
+// side only ever touches a block the other one cannot.
+#define PARAMS_FRESH		4
+
+typedef struct
+{
+    int count;
+    int channel[MAX_CHANNELS];
+    int serial[MAX_CHANNELS];
+    int volume[MAX_CHANNELS];
+    int separation[MAX_CHANNELS];
+    int pitch[MAX_CHANNELS];
+} sound_params_t;
+
+static sound_params_t params_blocks[3];
+static int params_back = 0;		// the game thread's
+static int params_front = 2;		// the callback's
+static SDL_atomic_t params_middle;	// the other, maybe PARAMS_FRESH
+
+// Owned by the game thread.
+static int num_voices = NUM_CHANNELS;
+static int channel_serial[MAX_CHANNELS];	// of the last sound started
+static int channel_live[MAX_CHANNELS];		// not stopped since
+static int channel_priority[MAX_CHANNELS];	// higher is less important
+static int channel_volume[MAX_CHANNELS];
+static int channel_sfx[MAX_CHANNELS];		// whose data it plays
+
+// Sound effects are loaded when first played, and those
+// played last are kept, up to snd_cachesize KB.  Past that
+// the least recently played ones that no channel can still
+// be reading go to PU_CACHE, so the zone may purge them,
+// which clears data.  Linked sounds use the data of the
+// one they link to.  Owned by the game thread; the audio
+// thread gets the data with each sound_start.
+typedef struct
+{
+    unsigned char* data;	// zone block, with this as its user
+    int length;
+    int samplerate;
+    int pinned;			// PU_STATIC, counted in sound_cache_used
+    int failed;			// not a sound lump, never retried
+    int lastused;
+    int free_after;		// sound_ring_tail that is done with it
 } sound_t;
 
 static sound_t sounds[NUMSFX];
-static int lengths[NUMSFX];
+
+int snd_cachesize = 512;		// KB, 0 for no limit
+static int sound_cache_used;
+static int sound_cache_clock;
 
 static int music_volume = 15;
 
-static SDL_mutex* audio_mutex = NULL;
+// Registered songs, copied so the lump can go.  A song
+// that is unregistered is freed once the audio thread
+// has read past the command that let go of it.
+#define MAX_SONGS		4
+
+typedef struct
+{
+    unsigned char* data;
+    int length;
+    int retiring;		// 1 until the unregister is queued, then 2
+    int free_after;		// sound_ring_tail to wait for
+    int playing;
+} song_t;
+
+static song_t songs[MAX_SONGS];
+static int audio_song = -1;	// the one the audio thread plays
+
+// The device rate and the step for each pitch, 128 being
+// the sound's own rate and 64 either side an octave.
+static int mix_rate = SAMPLERATE;
+static unsigned int pitch_step[256];
+
+// Each channel is resampled into mix_mono in units of 1/128
+// of an 8 bit sample, then added into mix_buffer with its
+// left and right gains, and the sum is saturated once.
+#define MIX_SHIFT		7
+
+static Sint16 mix_mono[SAMPLECOUNT];
+static Sint32 mix_buffer[SAMPLECOUNT * 2];
+
+static int audio_ready = 0;
+
+// -wavout <file>: no device, the callback is run once a
+// frame for the tics that ran, a fixed number of samples
+// each, and what it mixes goes to a WAV file, or raw PCM
+// if the name ends in .raw.
+static FILE* wav_file;
+static char* wav_name;
+static int wav_raw;
+static int wav_tic;			// gametic mixed up to
+static unsigned int wav_samples;	// stereo samples written
 
 //
-// Audio callback - called by SDL to fill the audio buffer
+// Queue a command for the audio thread.
+// A full ring drops it rather than wait.
 //
-static void I_AudioCallback(void* userdata, Uint8* stream, int len)
+static int I_QueueSoundCmd(sound_cmd_t* cmd)
 {
-    int i, c;
-    Sint16* output = (Sint16*)stream;
-    int samples = len / 4;
+    int head = SDL_AtomicGet(&sound_ring_head);
 
-    memset(stream, 0, len);
-    
-    if (!audio_mutex) return;
-    
-    SDL_LockMutex(audio_mutex);
+    if (head - SDL_AtomicGet(&sound_ring_tail) == SOUND_RING_SIZE)
+    {
+        sound_ring_dropped++;
+        return 0;
+    }
+
+    sound_ring[head & (SOUND_RING_SIZE - 1)] = *cmd;
+    SDL_AtomicSet(&sound_ring_head, head + 1);
+    return 1;
+}
+
+//
+// Step and gains from a channel's volume, separation
+// and pitch.  A gain of 256 would be a volume of 40 at
+// full separation, like the old mixer.  With ramp the
+// gains glide there over RAMP_SAMPLES, so a moving sound
+// does not click each time it is updated.
+//
+#define RAMP_SAMPLES		256
 
-    for (c = 0; c < NUM_CHANNELS; c++)
+static void I_SetChannelParams(channel_t* chan, int ramp)
+{
+    int pitch = chan->pitch;
+    int volume = chan->volume;
+    int sep = chan->separation;
+
+    if (pitch < 0) pitch = 0;
+    if (pitch > 255) pitch = 255;
+    if (volume < 0) volume = 0;
+    if (volume > 127) volume = 127;
+    if (sep < 0) sep = 0;
+    if (sep > 255) sep = 255;
+
+    chan->step = (unsigned int)(((long long)chan->samplerate
+                                 * pitch_step[pitch]) / mix_rate);
+    if (!chan->step)
+        chan->step = 1;
+    chan->left_gain = volume * (255 - sep) * 256 / (40 * 255);
+    chan->right_gain = volume * sep * 256 / (40 * 255);
+
+    if (!ramp)
     {
-        channel_t* chan = &channels[c];
-        
-        if (!chan->active || !chan->data)
-            continue;
-            
-        for (i = 0; i < samples && chan->position < chan->length; i++)
-        {
-            int sample = chan->data[chan->position];
+        chan->left_now = chan->left_gain << 16;
+        chan->right_now = chan->right_gain << 16;
+        chan->ramp = 0;
+        return;
+    }
+    chan->left_delta = ((chan->left_gain << 16) - chan->left_now) / RAMP_SAMPLES;
+    chan->right_delta = ((chan->right_gain << 16) - chan->right_now) / RAMP_SAMPLES;
+    chan->ramp = RAMP_SAMPLES;
+}
 
-            Sint16 sample_16 = (Sint16)((sample - 128) << 8);
+//
+// Resample one channel into mix_mono, with linear
+// interpolation, and return how many samples it made
+//
+static int I_ResampleChannel(channel_t* chan, int samples)
+{
+    const unsigned char* data = chan->data;
+    unsigned int pos = chan->position;
+    unsigned int frac = chan->frac;
+    unsigned int step = chan->step;
+    unsigned int last = chan->length - 1;
+    int i;
 
-            sample_16 = (sample_16 * chan->volume) / 40;
+    for (i = 0; i < samples && pos < last; i++)
+    {
+        int s0 = data[pos];
+        int s1 = data[pos + 1];
+
+        mix_mono[i] = ((s0 - 128) << MIX_SHIFT)
+                    + (s1 - s0) * (int)(frac >> (16 - MIX_SHIFT));
+        frac += step;
+        pos += frac >> 16;
+        frac &= 0xffff;
+    }
 
-            int left_vol = 255 - chan->separation;
-            int right_vol = chan->separation;
+    // the last sample has nothing after it
+    for ( ; i < samples && pos == last; i++)
+    {
+        mix_mono[i] = (data[pos] - 128) << MIX_SHIFT;
+        frac += step;
+        pos += frac >> 16;
+        frac &= 0xffff;
+    }
+
+    chan->position = pos;
+    chan->frac = frac;
+    return i;
+}
+
+//
+// Add mix_mono into mix with a channel's gains
+//
+static void I_AccumulateChannel(channel_t* chan, Sint32* mix, int samples)
+{
+    int left = chan->left_gain;
+    int right = chan->right_gain;
+    int i = 0;
 
-            int left_sample = output[i * 2] + ((sample_16 * left_vol) / 255);
-            int right_sample = output[i * 2 + 1] + ((sample_16 * right_vol) / 255);
+    // glide first, then the gains are steady
+    if (chan->ramp)
+    {
+        int n = chan->ramp < samples ? chan->ramp : samples;
+        int left_now = chan->left_now;
+        int right_now = chan->right_now;
 
-            if (left_sample > 32767) left_sample = 32767;
-            if (left_sample < -32768) left_sample = -32768;
-            if (right_sample > 32767) right_sample = 32767;
-            if (right_sample < -32768) right_sample = -32768;
-            
-            output[i * 2] = (Sint16)left_sample;
-            output[i * 2 + 1] = (Sint16)right_sample;
-            
-            chan->position++;
+        for ( ; i < n; i++)
+        {
+            mix[i * 2] += mix_mono[i] * (left_now >> 16);
+            mix[i * 2 + 1] += mix_mono[i] * (right_now >> 16);
+            left_now += chan->left_delta;
+            right_now += chan->right_delta;
         }
 
-        if (chan->position >= chan->length)
+        chan->ramp -= n;
+        if (!chan->ramp)
+        {
+            left_now = left << 16;
+            right_now = right << 16;
+        }
+        chan->left_now = left_now;
+        chan->right_now = right_now;
+    }
+
+#ifdef __SSE2__
+    // 16 bit gains in the low half of each lane, so
+    // madd of a duplicated sample gives sample*gain
+    __m128i gains = _mm_set_epi32(right, left, right, left);
+
+    for ( ; i + 4 <= samples; i += 4)
+    {
+        __m128i m = _mm_loadl_epi64((__m128i*)&mix_mono[i]);
+        __m128i pairs = _mm_unpacklo_epi16(m, m);
+        __m128i lo = _mm_unpacklo_epi32(pairs, pairs);
+        __m128i hi = _mm_unpackhi_epi32(pairs, pairs);
+        __m128i* out = (__m128i*)&mix[i * 2];
+
+        _mm_storeu_si128(out, _mm_add_epi32(_mm_loadu_si128(out),
+                                            _mm_madd_epi16(lo, gains)));
+        _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1),
+                                                _mm_madd_epi16(hi, gains)));
+    }
+#endif
+
+    for ( ; i < samples; i++)
+    {
+        mix[i * 2] += mix_mono[i] * left;
+        mix[i * 2 + 1] += mix_mono[i] * right;
+    }
+}
+
+//
+// Saturate mix_buffer into the output, once
+//
+static void I_SaturateMix(Sint16* output, int samples)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    for ( ; i + 4 <= samples; i += 4)
+    {
+        __m128i a = _mm_loadu_si128((__m128i*)&mix_buffer[i * 2]);
+        __m128i b = _mm_loadu_si128((__m128i*)&mix_buffer[i * 2 + 4]);
+
+        a = _mm_srai_epi32(a, MIX_SHIFT);
+        b = _mm_srai_epi32(b, MIX_SHIFT);
+        _mm_storeu_si128((__m128i*)&output[i * 2], _mm_packs_epi32(a, b));
+    }
+#endif
+
+    for (i *= 2; i < samples * 2; i++)
+    {
+        int sample = mix_buffer[i] >> MIX_SHIFT;
+
+        if (sample > 32767) sample = 32767;
+        if (sample < -32768) sample = -32768;
+        output[i] = (Sint16)sample;
+    }
+}
+
+//
+// Mix up to SAMPLECOUNT stereo samples of numchans channels
+// into mix_buffer.  A channel that ends publishes its serial
+// in done, if given.
+//
+static void I_MixChannels(channel_t* chans, int numchans,
+                          SDL_atomic_t* done, int samples)
+{
+    int c, i, n;
+
+    memset(mix_buffer, 0, samples * 2 * sizeof(*mix_buffer));
+
+    for (c = 0; c < numchans; c++)
+    {
+        channel_t* chan = &chans[c];
+
+        if (!chan->active || !chan->data)
+            continue;
+
+        for (i = 0; i < samples; i += n)
         {
-            if (chan->loop)
+            n = chan->length > 0 ? I_ResampleChannel(chan, samples - i) : 0;
+            I_AccumulateChannel(chan, &mix_buffer[i * 2], n);
+            if (i + n == samples)
+                break;
+
+            if (chan->loop && chan->length > 0)
             {
                 chan->position = 0;
+                chan->frac = 0;
+                continue;
             }
-            else
+            chan->active = 0;
+            if (done)
+                SDL_AtomicSet(&done[c], chan->serial);
+            break;
+        }
+    }
+}
+
+//
+// Apply the queued commands, on the audio thread
+//
+static void I_RunSoundCmds(void)
+{
+    int tail = SDL_AtomicGet(&sound_ring_tail);
+    int head = SDL_AtomicGet(&sound_ring_head);
+
+    for ( ; tail != head; tail++)
+    {
+        sound_cmd_t* cmd = &sound_ring[tail & (SOUND_RING_SIZE - 1)];
+        channel_t* chan = &channels[cmd->channel & (MAX_CHANNELS - 1)];
+
+        switch (cmd->type)
+        {
+          case sound_start:
+            chan->data = cmd->data;
+            chan->length = cmd->length;
+            chan->samplerate = cmd->samplerate;
+            chan->position = 0;
+            chan->frac = 0;
+            chan->active = 1;
+            chan->loop = 0;
+            chan->volume = cmd->volume;
+            chan->separation = cmd->separation;
+            chan->pitch = cmd->pitch;
+            chan->sfx_id = cmd->sfx_id;
+            chan->serial = cmd->serial;
+            I_SetChannelParams(chan, 0);
+            break;
+
+          case sound_stop:
+            if (chan->active && chan->serial == cmd->serial)
             {
                 chan->active = 0;
+                SDL_AtomicSet(&channel_done[cmd->channel], chan->serial);
+            }
+            break;
+
+          case sound_update:
+            if (chan->active && chan->serial == cmd->serial)
+            {
+                chan->volume = cmd->volume;
+                chan->separation = cmd->separation;
+                chan->pitch = cmd->pitch;
+                I_SetChannelParams(chan, 1);
+            }
+            break;
+
+          case music_play:
+            MUS_Start(songs[cmd->channel].data, songs[cmd->channel].length,
+                      cmd->volume);
+            audio_song = cmd->channel;
+            break;
+
+          case music_stop:
+          case music_unregister:
+            if (audio_song == cmd->channel)
+            {
+                MUS_Stop();
+                audio_song = -1;
             }
+            break;
+
+          case music_pause:
+          case music_resume:
+            if (audio_song == cmd->channel)
+                MUS_Pause(cmd->type == music_pause);
+            break;
+
+          case music_volume_set:
+            MUS_SetVolume(cmd->volume);
+            break;
         }
     }
+
+    SDL_AtomicSet(&sound_ring_tail, tail);
+}
+
+//
+// Take the newest parameter block, if there is one
+// the callback has not seen, on the audio thread.
+// A sound restarted since it was made keeps its own.
+//
+static void I_RunSoundParams(void)
+{
+    sound_params_t* block;
+    int i;
+
+    if (!(SDL_AtomicGet(&params_middle) & PARAMS_FRESH))
+        return;
+
+    params_front = SDL_AtomicSet(&params_middle, params_front)
+                 & ~PARAMS_FRESH;
+    block = &params_blocks[params_front];
+
+    for (i = 0; i < block->count; i++)
+    {
+        channel_t* chan = &channels[block->channel[i]];
+
+        if (!chan->active || chan->serial != block->serial[i])
+            continue;
+        chan->volume = block->volume[i];
+        chan->separation = block->separation[i];
+        chan->pitch = block->pitch[i];
+        I_SetChannelParams(chan, 1);
+    }
+}
+
+//
+// Audio callback - called by SDL to fill the audio buffer
+//
+static void I_AudioCallback(void* userdata, Uint8* stream, int len)
+{
+    int i, n;
+    Sint16* output = (Sint16*)stream;
+    int samples = len / 4;
+    long long start;
+    int us, period, max;
+
+    if (!audio_ready)
+    {
+        memset(stream, 0, len);
+        return;
+    }
     
-    SDL_UnlockMutex(audio_mutex);
+    M_TraceThread("audio");
+    TRACE_BEGIN("I_AudioCallback");
+    start = I_GetTimeUS();
+
+    I_RunSoundCmds();
+    I_RunSoundParams();
+
+    for (i = 0; i < samples; i += n)
+    {
+        n = samples - i;
+        if (n > SAMPLECOUNT)
+            n = SAMPLECOUNT;
+        I_MixChannels(channels, SDL_AtomicGet(&mix_voices), channel_done, n);
+        MUS_Render(mix_buffer, n, MIX_SHIFT);
+        I_SaturateMix(output + i * 2, n);
+    }
+
+    us = (int)(I_GetTimeUS() - start);
+    period = (int)((long long)samples * 1000000 / mix_rate);
+    SDL_AtomicAdd(&audio_callbacks, 1);
+    SDL_AtomicAdd(&audio_mix_us, us);
+    SDL_AtomicSet(&audio_period_us, period);
+    if (us > period)
+        SDL_AtomicAdd(&audio_underruns, 1);
+    do
+    {
+        max = SDL_AtomicGet(&audio_max_us);
+    } while (us > max && !SDL_AtomicCAS(&audio_max_us, max, us));
+
+    TRACE_END();
+}
+
+//
+// How the callback has kept up since the last call
+//
+void I_GetSoundStats(soundstats_t* stats)
+{
+    static int last_callbacks, last_mix_us, last_underruns;
+    int callbacks = SDL_AtomicGet(&audio_callbacks);
+    int mix_us = SDL_AtomicGet(&audio_mix_us);
+    int underruns = SDL_AtomicGet(&audio_underruns);
+
+    stats->callbacks = callbacks - last_callbacks;
+    stats->mix_us = (unsigned int)mix_us - (unsigned int)last_mix_us;
+    stats->max_us = SDL_AtomicSet(&audio_max_us, 0);
+    stats->underruns = underruns - last_underruns;
+    stats->period_us = SDL_AtomicGet(&audio_period_us);
+
+    last_callbacks = callbacks;
+    last_mix_us = mix_us;
+    last_underruns = underruns;
 }
 
 //
@@ -191,12 +695,14 @@ static int I_LoadSound(int sfx_id, char* sfxname)
     }
 
     samplerate = sfx[2] | (sfx[3] << 8);
+    if (!samplerate)
+        samplerate = 11025;
     samples = sfx[4] | (sfx[5] << 8) | (sfx[6] << 16) | (sfx[7] << 24);
 
     if (samples > size - 8)
         samples = size - 8;
 
-    sounds[sfx_id].data = (unsigned char*)Z_Malloc(samples, PU_STATIC, 0);
+    Z_Malloc(samples, PU_STATIC, &sounds[sfx_id].data);
     sounds[sfx_id].length = samples;
     sounds[sfx_id].samplerate = samplerate;
 
@@ -204,49 +710,290 @@ static int I_LoadSound(int sfx_id, char* sfxname)
     
     Z_Free(sfx);
     
-    lengths[sfx_id] = samples;
-    
     return 1;
 }
 
 //
-// Find a free channel
+// Can the audio thread still be reading a sound's data
+//
+static int I_SoundInUse(int sfx_id)
+{
+    int i;
+
+    if (SDL_AtomicGet(&sound_ring_tail) - sounds[sfx_id].free_after < 0)
+        return 1;
+
+    for (i = 0; i < num_voices; i++)
+    {
+        if (channel_sfx[i] == sfx_id && I_SoundIsPlaying(i))
+            return 1;
+    }
+
+    return 0;
+}
+
+//
+// Let the zone have the least recently played sounds
+// until the cache is back under snd_cachesize, all but
+// keep, which is about to play
+//
+static void I_TrimSoundCache(int keep)
+{
+    int best;
+    int i;
+
+    while (snd_cachesize > 0 && sound_cache_used > snd_cachesize * 1024)
+    {
+        best = -1;
+        for (i = 1; i < NUMSFX; i++)
+        {
+            if (!sounds[i].pinned || i == keep)
+                continue;
+            if (best != -1 && sounds[i].lastused >= sounds[best].lastused)
+                continue;
+            if (!I_SoundInUse(i))
+                best = i;
+        }
+
+        // all playing, so it stays over for now
+        if (best == -1)
+            return;
+
+        Z_ChangeTag(sounds[best].data, PU_CACHE);
+        sounds[best].pinned = 0;
+        sound_cache_used -= sounds[best].length;
+    }
+}
+
+//
+// Make sure a sound is loaded and kept, loading it
+// from the WAD the first time or after a purge
+//
+static int I_CacheSound(int sfx_id)
+{
+    sound_t* sound = &sounds[sfx_id];
+
+    sound->lastused = ++sound_cache_clock;
+    if (sound->pinned)
+        return 1;
+    if (sound->failed)
+        return 0;
+
+    if (sound->data)
+    {
+        Z_ChangeTag(sound->data, PU_STATIC);
+    }
+    else if (!I_LoadSound(sfx_id, S_sfx[sfx_id].name))
+    {
+        fprintf(stderr, "I_CacheSound: ds%s is not a sound\n",
+                S_sfx[sfx_id].name);
+        sound->failed = 1;
+        return 0;
+    }
+
+    sound->pinned = 1;
+    sound_cache_used += sound->length;
+    I_TrimSoundCache(sfx_id);
+    return 1;
+}
+
+//
+// Find a free channel, as the game thread sees them
 //
 static int I_FindFreeChannel(void)
 {
     int i;
     
-    for (i = 0; i < NUM_CHANNELS; i++)
+    for (i = 0; i < num_voices; i++)
     {
-        if (!channels[i].active)
+        if (!I_SoundIsPlaying(i))
             return i;
     }
     
-    // No free channel, stop the oldest one
-    return 0;
+    return -1;
 }
 
 //
-// Initialize sound
+// Find the voice to give up for a sound of this priority:
+// the least important one, the quietest of those, as long
+// as it is no more important than the new sound.
 //
-void I_InitSound(void)
+static int I_FindStealChannel(int priority)
 {
-    SDL_AudioSpec desired;
+    int best = -1;
     int i;
-    
+
+    for (i = 0; i < num_voices; i++)
+    {
+        if (channel_priority[i] < priority)
+            continue;
+        if (best == -1
+            || channel_priority[i] > channel_priority[best]
+            || (channel_priority[i] == channel_priority[best]
+                && channel_volume[i] < channel_volume[best]))
+            best = i;
+    }
+
+    return best;
+}
+
+//
+// The pitch steps
+//
+static void I_InitPitchSteps(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+        pitch_step[i] = (unsigned int)(pow(2.0, (i - 128) / 64.0) * 65536.0);
+}
+
+//
+// -mixbench: time the mixer on noise at 11025 Hz with
+// varied pitch, volume and separation, a quarter of the
+// channels moving each block, and quit
+//
+#define MIX_BENCH_SECONDS	2
+
+static void I_MixBench(void)
+{
+    static const int counts[] = { 8, 32, 128 };
+    static Sint16 output[SAMPLECOUNT * 2];
+    channel_t* chans;
+    unsigned char* noise;
+    long long start, elapsed;
+    int numchans, blocks, b, c, k;
+    int length = 11025;
+
+    noise = (unsigned char*)malloc(length);
+    chans = (channel_t*)calloc(128, sizeof(channel_t));
+    if (!noise || !chans)
+        I_Error("I_MixBench: no memory");
+
+    srand(1);
+    for (c = 0; c < length; c++)
+        noise[c] = rand() & 0xff;
+
+    for (k = 0; k < 3; k++)
+    {
+        numchans = counts[k];
+        for (c = 0; c < numchans; c++)
+        {
+            memset(&chans[c], 0, sizeof(channel_t));
+            chans[c].data = noise;
+            chans[c].length = length - c * 37;
+            chans[c].samplerate = 11025;
+            chans[c].active = 1;
+            chans[c].loop = 1;
+            chans[c].volume = 15 + c % 100;
+            chans[c].separation = (c * 53) & 0xff;
+            chans[c].pitch = 112 + c % 32;
+            I_SetChannelParams(&chans[c], 0);
+        }
+
+        // about MIX_BENCH_SECONDS of audio at each count
+        blocks = MIX_BENCH_SECONDS * mix_rate / SAMPLECOUNT;
+        start = I_GetTimeUS();
+        for (b = 0; b < blocks; b++)
+        {
+            for (c = b & 3; c < numchans; c += 4)
+            {
+                chans[c].separation = (chans[c].separation + 31) & 0xff;
+                I_SetChannelParams(&chans[c], 1);
+            }
+            I_MixChannels(chans, numchans, NULL, SAMPLECOUNT);
+            I_SaturateMix(output, SAMPLECOUNT);
+        }
+        elapsed = I_GetTimeUS() - start;
+
+        printf("mixbench: %3d channels, %.2f ns per channel sample, "
+               "%.1f ns per output sample, %.1f%% of real time\n",
+               numchans,
+               elapsed * 1000.0 / ((double)blocks * SAMPLECOUNT * numchans),
+               elapsed * 1000.0 / ((double)blocks * SAMPLECOUNT),
+               elapsed / 10000.0 / MIX_BENCH_SECONDS);
+    }
+
+    free(chans);
+    free(noise);
+}
+
+//
+// -musbench [lump]: time the synthesizer playing a song,
+// D_E1M1 or D_RUNNIN by default, and quit
+//
+#define MUS_BENCH_SECONDS	120
+
+static void I_MusBench(int p)
+{
+    static Sint16 output[SAMPLECOUNT * 2];
+    unsigned char* mus;
+    char* name;
+    long long start, blockstart, elapsed, worst;
+    int lump, blocks, b;
+
+    if (p < myargc - 1 && myargv[p + 1][0] != '-')
+        name = myargv[p + 1];
+    else if (W_CheckNumForName("D_E1M1") != -1)
+        name = "D_E1M1";
+    else
+        name = "D_RUNNIN";
+
+    lump = W_GetNumForName(name);
+    mus = (unsigned char*)W_CacheLumpNum(lump, PU_STATIC);
+    if (!MUS_Valid(mus, W_LumpLength(lump)))
+        I_Error("I_MusBench: %s is not a MUS lump", name);
+
+    I_InitMusic();
+    MUS_Start(mus, W_LumpLength(lump), 1);
+
+    blocks = MUS_BENCH_SECONDS * mix_rate / SAMPLECOUNT;
+    worst = 0;
+    start = I_GetTimeUS();
+    for (b = 0; b < blocks; b++)
+    {
+        blockstart = I_GetTimeUS();
+        memset(mix_buffer, 0, sizeof(mix_buffer));
+        MUS_Render(mix_buffer, SAMPLECOUNT, MIX_SHIFT);
+        I_SaturateMix(output, SAMPLECOUNT);
+        elapsed = I_GetTimeUS() - blockstart;
+        if (elapsed > worst)
+            worst = elapsed;
+    }
+    elapsed = I_GetTimeUS() - start;
+
+    printf("musbench: %s, %d s at %d Hz, %.0f us per second of audio, "
+           "%.2f%% of real time, worst callback %.1f%% of its %.1f ms\n",
+           name, MUS_BENCH_SECONDS, mix_rate,
+           elapsed / (double)MUS_BENCH_SECONDS,
+           elapsed / 10000.0 / MUS_BENCH_SECONDS,
+           worst * 100.0 / (SAMPLECOUNT * 1000000.0 / mix_rate),
+           SAMPLECOUNT * 1000.0 / mix_rate);
+
+    Z_Free(mus);
+}
+
+//
+// Open the SDL audio device, with the callback
+// paused until the sound module is ready
+//
+static int I_OpenAudioDevice(void)
+{
+    SDL_AudioSpec desired;
+
     fprintf(stderr, "I_InitSound: ");
 
     if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
     {
         fprintf(stderr, "SDL_InitSubSystem(AUDIO) failed: %s\n", SDL_GetError());
-        return;
+        return 0;
     }
 
     SDL_zero(desired);
-    desired.freq = SAMPLERATE;
+    desired.freq = snd_samplerate;
     desired.format = AUDIO_S16SYS;
     desired.channels = 2;
-    desired.samples = SAMPLECOUNT;
+    desired.samples = snd_samplecount;
     desired.callback = I_AudioCallback;
     desired.userdata = NULL;
 
@@ -255,52 +1002,213 @@ void I_InitSound(void)
     if (audio_device == 0)
     {
         fprintf(stderr, "SDL_OpenAudioDevice failed: %s\n", SDL_GetError());
-        return;
+        return 0;
     }
     
     fprintf(stderr, "configured audio device (freq=%d, channels=%d, samples=%d)\n",
             audio_spec.freq, audio_spec.channels, audio_spec.samples);
+    mix_rate = audio_spec.freq;
+    return 1;
+}
+
+//
+// The WAV header, for wav_samples of 16 bit stereo
+//
+static void I_WriteWavHeader(void)
+{
+    byte header[44];
+    unsigned int bytes = wav_samples * 4;
+
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\1\0\2\0", 24);
+    memcpy(header + 36, "data", 4);
+    header[4] = (36 + bytes) & 0xff;
+    header[5] = ((36 + bytes) >> 8) & 0xff;
+    header[6] = ((36 + bytes) >> 16) & 0xff;
+    header[7] = ((36 + bytes) >> 24) & 0xff;
+    header[24] = mix_rate & 0xff;
+    header[25] = (mix_rate >> 8) & 0xff;
+    header[26] = (mix_rate >> 16) & 0xff;
+    header[27] = (mix_rate >> 24) & 0xff;
+    header[28] = (mix_rate * 4) & 0xff;
+    header[29] = ((mix_rate * 4) >> 8) & 0xff;
+    header[30] = ((mix_rate * 4) >> 16) & 0xff;
+    header[31] = ((mix_rate * 4) >> 24) & 0xff;
+    header[32] = 4;			// bytes a sample
+    header[33] = 0;
+    header[34] = 16;			// bits a channel
+    header[35] = 0;
+    header[40] = bytes & 0xff;
+    header[41] = (bytes >> 8) & 0xff;
+    header[42] = (bytes >> 16) & 0xff;
+    header[43] = (bytes >> 24) & 0xff;
+
+    fseek(wav_file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), wav_file);
+    fseek(wav_file, 0, SEEK_END);
+}
+
+//
+// Start an offline render to name, in place of the device
+//
+static int I_OpenWav(char* name)
+{
+    int len = strlen(name);
 
-    audio_mutex = SDL_CreateMutex();
-    if (!audio_mutex)
+    wav_file = fopen(name, "wb");
+    if (!wav_file)
     {
-        fprintf(stderr, "Failed to create audio mutex\n");
+        fprintf(stderr, "I_InitSound: couldn't write %s\n", name);
+        return 0;
+    }
+
+    wav_name = name;
+    wav_raw = len > 4 && !strcasecmp(name + len - 4, ".raw");
+    wav_tic = gametic;
+    wav_samples = 0;
+
+    // the render must not depend on how fast it goes
+    musbudget = false;
+
+    if (!wav_raw)
+        I_WriteWavHeader();
+    fprintf(stderr, "I_InitSound: mixing to %s, %d Hz 16 bit stereo\n",
+            name, mix_rate);
+    return 1;
+}
+
+//
+// Mix the tics that ran since the last call
+//
+static void I_RenderWav(void)
+{
+    static Sint16 output[SAMPLECOUNT * 2];
+    int samples, n, i;
+
+    for ( ; wav_tic < gametic; wav_tic++)
+    {
+        samples = (int)((long long)(wav_tic + 1) * mix_rate / TICRATE
+                        - (long long)wav_tic * mix_rate / TICRATE);
+
+        for ( ; samples > 0; samples -= n)
+        {
+            n = samples < SAMPLECOUNT ? samples : SAMPLECOUNT;
+            I_AudioCallback(NULL, (Uint8*)output, n * 4);
+            for (i = 0; i < n * 2; i++)
+                output[i] = SDL_SwapLE16(output[i]);
+            fwrite(output, 4, n, wav_file);
+            wav_samples += n;
+        }
+    }
+}
+
+//
+// Finish the -wavout file.  Called on quitting,
+// and by I_Error, as a timedemo ends with one.
+//
+void I_CloseWav(void)
+{
+    if (!wav_file)
         return;
+
+    if (!wav_raw)
+        I_WriteWavHeader();
+    fclose(wav_file);
+    wav_file = NULL;
+
+    fprintf(stderr, "I_CloseWav: wrote %.1f s to %s\n",
+            wav_samples / (double)mix_rate, wav_name);
+}
+
+//
+// Initialize sound
+//
+void I_InitSound(void)
+{
+    int i;
+
+    if (snd_samplerate < 8000) snd_samplerate = 8000;
+    if (snd_samplerate > 192000) snd_samplerate = 192000;
+    for (i = 32; i < snd_samplecount && i < 16384; i *= 2)
+        ;
+    snd_samplecount = i;
+    mix_rate = snd_samplerate;
+    
+    I_InitPitchSteps();
+
+    if (M_CheckParm("-mixbench"))
+    {
+        I_MixBench();
+        exit(0);
+    }
+
+    i = M_CheckParm("-musbench");
+    if (i)
+    {
+        I_MusBench(i);
+        exit(0);
+    }
+
+    i = M_CheckParm("-wavout");
+    if (i && i < myargc - 1)
+    {
+        if (!I_OpenWav(myargv[i + 1]))
+            return;
     }
+    else if (!I_OpenAudioDevice())
+        return;
 
-    for (i = 0; i < NUM_CHANNELS; i++)
+    for (i = 0; i < MAX_CHANNELS; i++)
     {
         memset(&channels[i], 0, sizeof(channel_t));
+        SDL_AtomicSet(&channel_done[i], 0);
+        channel_serial[i] = 0;
+        channel_live[i] = 0;
     }
+    SDL_AtomicSet(&mix_voices, num_voices);
+    SDL_AtomicSet(&params_middle, 1);
+    SDL_AtomicSet(&sound_ring_head, 0);
+    SDL_AtomicSet(&sound_ring_tail, 0);
 
     for (i = 0; i < NUMSFX; i++)
     {
         memset(&sounds[i], 0, sizeof(sound_t));
     }
+    sound_cache_used = 0;
 
-    fprintf(stderr, "I_InitSound: ");
-    
-    for (i = 1; i < NUMSFX; i++)
-    {
-        if (!S_sfx[i].link)
-        {
-            I_LoadSound(i, S_sfx[i].name);
-        }
-        else
-        {
-            int link_id = S_sfx[i].link - S_sfx;
-            sounds[i] = sounds[link_id];
-            lengths[i] = lengths[link_id];
-        }
-    }
-    
-    fprintf(stderr, "pre-cached all sound data\n");
+    if (snd_cachesize > 0)
+        fprintf(stderr, "I_InitSound: sounds load when played, %d KB kept\n",
+                snd_cachesize);
+    else
+        fprintf(stderr, "I_InitSound: sounds load when played, all kept\n");
 
-    SDL_PauseAudioDevice(audio_device, 0);
+    I_InitMusic();
+
+    audio_ready = 1;
+    if (audio_device)
+        SDL_PauseAudioDevice(audio_device, 0);
     
     fprintf(stderr, "I_InitSound: sound module ready\n");
 }
 
+//
+// Print the callback times since the last stats were taken
+//
+static void I_PrintSoundStats(void)
+{
+    soundstats_t stats;
+
+    I_GetSoundStats(&stats);
+    if (!stats.callbacks)
+        return;
+
+    fprintf(stderr, "I_ShutdownSound: %d callbacks of %.1f ms, "
+            "mix avg %.0f us, max %d us (%.0f%%), %d underruns\n",
+            stats.callbacks, stats.period_us / 1000.0,
+            (double)stats.mix_us / stats.callbacks, stats.max_us,
+            stats.period_us ? stats.max_us * 100.0 / stats.period_us : 0.0,
+            stats.underruns);
+}
+
 //
 // Shutdown sound
 //
@@ -314,22 +1222,24 @@ void I_ShutdownSound(void)
         SDL_CloseAudioDevice(audio_device);
         audio_device = 0;
     }
+    I_CloseWav();
     
-    if (audio_mutex)
+    if (sound_ring_dropped)
     {
-        SDL_DestroyMutex(audio_mutex);
-        audio_mutex = NULL;
+        fprintf(stderr, "I_ShutdownSound: %d sound commands dropped\n",
+                sound_ring_dropped);
     }
+    I_PrintSoundStats();
+    audio_ready = 0;
     
-    // Free sound data
+    // Free sound data, which clears the pointers
     for (i = 0; i < NUMSFX; i++)
     {
-        if (sounds[i].data && (!S_sfx[i].link || i == S_sfx[i].link - S_sfx))
-        {
+        if (sounds[i].data)
             Z_Free(sounds[i].data);
-            sounds[i].data = NULL;
-        }
+        sounds[i].pinned = 0;
     }
+    sound_cache_used = 0;
     
     SDL_QuitSubSystem(SDL_INIT_AUDIO);
 }
@@ -339,41 +1249,53 @@ void I_ShutdownSound(void)
 //
 int I_StartSound(int id, int vol, int sep, int pitch, int priority)
 {
+    sound_cmd_t cmd;
+    int sfx_id;
     int channel;
     
-    (void)priority;
-    (void)pitch;
-    
     if (id < 1 || id >= NUMSFX)
     {
         fprintf(stderr, "I_StartSound: invalid sound id %d\n", id);
         return -1;
     }
     
-    if (!sounds[id].data)
-    {
-        fprintf(stderr, "I_StartSound: sound %d not loaded\n", id);
+    if (!audio_ready)
         return -1;
-    }
-    
-    if (!audio_mutex)
+
+    if (S_sfx[id].link)
+        sfx_id = S_sfx[id].link - S_sfx;
+    else
+        sfx_id = id;
+    if (!I_CacheSound(sfx_id))
         return -1;
-    
-    SDL_LockMutex(audio_mutex);
 
     channel = I_FindFreeChannel();
+    if (channel == -1)
+        channel = I_FindStealChannel(priority);
+    if (channel == -1)
+        return -1;
 
-    channels[channel].data = sounds[id].data;
-    channels[channel].length = sounds[id].length;
-    channels[channel].position = 0;
-    channels[channel].active = 1;
-    channels[channel].loop = 0;
-    channels[channel].volume = vol;
-    channels[channel].separation = sep;
-    channels[channel].pitch = pitch;
-    channels[channel].sfx_id = id;
-    
-    SDL_UnlockMutex(audio_mutex);
+    cmd.type = sound_start;
+    cmd.channel = channel;
+    cmd.serial = channel_serial[channel] + 1;
+    cmd.sfx_id = id;
+    cmd.volume = vol;
+    cmd.separation = sep;
+    cmd.pitch = pitch;
+    cmd.data = sounds[sfx_id].data;
+    cmd.length = sounds[sfx_id].length;
+    cmd.samplerate = sounds[sfx_id].samplerate;
+    if (!I_QueueSoundCmd(&cmd))
+        return -1;
+
+    // a stolen voice goes on reading the old sound until then
+    if (channel_live[channel])
+        sounds[channel_sfx[channel]].free_after = SDL_AtomicGet(&sound_ring_head);
+    channel_sfx[channel] = sfx_id;
+    channel_serial[channel] = cmd.serial;
+    channel_live[channel] = 1;
+    channel_priority[channel] = priority;
+    channel_volume[channel] = vol;
     
     return channel;
 }
@@ -383,35 +1305,45 @@ int I_StartSound(int id, int vol, int sep, int pitch, int priority)
 //
 void I_StopSound(int handle)
 {
-    if (handle < 0 || handle >= NUM_CHANNELS)
+    sound_cmd_t cmd;
+
+    if (handle < 0 || handle >= num_voices)
         return;
     
-    if (!audio_mutex)
+    if (!audio_ready || !channel_live[handle])
         return;
-    
-    SDL_LockMutex(audio_mutex);
-    channels[handle].active = 0;
-    SDL_UnlockMutex(audio_mutex);
+
+    cmd.type = sound_stop;
+    cmd.channel = handle;
+    cmd.serial = channel_serial[handle];
+
+    // if the ring is full it plays out, and is live until done
+    if (!I_QueueSoundCmd(&cmd))
+        return;
+    sounds[channel_sfx[handle]].free_after = SDL_AtomicGet(&sound_ring_head);
+    channel_live[handle] = 0;
 }
 
 //
 // Check if sound is playing
+// Without waiting for the audio thread: a sound plays
+// until it is stopped or the callback says it is done.
 //
 int I_SoundIsPlaying(int handle)
 {
-    int result = 0;
-    
-    if (handle < 0 || handle >= NUM_CHANNELS)
+    if (handle < 0 || handle >= num_voices)
         return 0;
     
-    if (!audio_mutex)
+    if (!audio_ready || !channel_live[handle])
         return 0;
+
+    if (SDL_AtomicGet(&channel_done[handle]) == channel_serial[handle])
+    {
+        channel_live[handle] = 0;
+        return 0;
+    }
     
-    SDL_LockMutex(audio_mutex);
-    result = channels[handle].active;
-    SDL_UnlockMutex(audio_mutex);
-    
-    return result;
+    return 1;
 }
 
 //
@@ -419,23 +1351,61 @@ int I_SoundIsPlaying(int handle)
 //
 void I_UpdateSoundParams(int handle, int vol, int sep, int pitch)
 {
-    (void)pitch;
-    
-    if (handle < 0 || handle >= NUM_CHANNELS)
+    sound_cmd_t cmd;
+
+    if (handle < 0 || handle >= num_voices)
         return;
     
-    if (!audio_mutex)
+    if (!I_SoundIsPlaying(handle))
         return;
-    
-    SDL_LockMutex(audio_mutex);
-    
-    if (channels[handle].active)
+
+    channel_volume[handle] = vol;
+
+    cmd.type = sound_update;
+    cmd.channel = handle;
+    cmd.serial = channel_serial[handle];
+    cmd.volume = vol;
+    cmd.separation = sep;
+    cmd.pitch = pitch;
+    I_QueueSoundCmd(&cmd);
+}
+
+//
+// Update many sounds at once, for the callback to take
+// as one block.  Those no longer playing are left out.
+//
+void I_UpdateSoundBlock(int count, int* handles, int* vols, int* seps,
+                        int* pitches)
+{
+    sound_params_t* block;
+    int i;
+
+    if (!audio_ready)
+        return;
+
+    block = &params_blocks[params_back];
+    block->count = 0;
+    for (i = 0; i < count; i++)
     {
-        channels[handle].volume = vol;
-        channels[handle].separation = sep;
+        int handle = handles[i];
+        int n = block->count;
+
+        if (!I_SoundIsPlaying(handle))
+            continue;
+
+        channel_volume[handle] = vols[i];
+        block->channel[n] = handle;
+        block->serial[n] = channel_serial[handle];
+        block->volume[n] = vols[i];
+        block->separation[n] = seps[i];
+        block->pitch[n] = pitches[i];
+        block->count++;
     }
-    
-    SDL_UnlockMutex(audio_mutex);
+
+    if (!block->count)
+        return;
+    params_back = SDL_AtomicSet(&params_middle, params_back | PARAMS_FRESH)
+                & ~PARAMS_FRESH;
 }
 
 //
@@ -447,12 +1417,28 @@ void I_SetSfxVolume(int volume)
 }
 
 
-void I_SetChannels(void)
+//
+// Sets the number of voices, and returns how many
+// there are, which is how many channels s_sound.c
+// should keep.
+//
+int I_SetChannels(int numchannels)
 {
+    if (numchannels < 1)
+        numchannels = 1;
+    if (numchannels > MAX_CHANNELS)
+        numchannels = MAX_CHANNELS;
+
+    // s_sound.c sets it up before any sound starts
+    num_voices = numchannels;
+    SDL_AtomicSet(&mix_voices, numchannels);
+    return numchannels;
 }
 
 void I_UpdateSound(void)
 {
+    if (wav_file)
+        I_RenderWav();
 }
 
 void I_SubmitSound(void)
@@ -469,54 +1455,185 @@ int I_GetSfxLumpNum(sfxinfo_t* sfx)
 //
 // MUSIC API.
 //
+//
+// Load the GENMIDI patches.  Called by I_InitSound,
+// before the callback runs.
+//
 void I_InitMusic(void)
 {
-    fprintf(stderr, "I_InitMusic: music not implemented (SDL2 only)\n");
+    int lump = W_CheckNumForName("GENMIDI");
+    unsigned char* genmidi;
+
+    if (lump == -1)
+    {
+        MUS_Init(NULL, 0, mix_rate);
+        return;
+    }
+
+    genmidi = (unsigned char*)W_CacheLumpNum(lump, PU_STATIC);
+    MUS_Init(genmidi, W_LumpLength(lump), mix_rate);
+    Z_Free(genmidi);
+}
+
+//
+// Queue a music command, if there is anything to hear it
+//
+static int I_QueueMusicCmd(sound_cmd_type_t type, int handle, int value)
+{
+    sound_cmd_t cmd;
+
+    if (!audio_ready)
+        return 1;
+
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = type;
+    cmd.channel = handle;
+    cmd.volume = value;
+    return I_QueueSoundCmd(&cmd);
+}
+
+//
+// Free the songs the audio thread is done with
+//
+static void I_FreeSongs(int all)
+{
+    int i;
+
+    for (i = 0; i < MAX_SONGS; i++)
+    {
+        if (!songs[i].data || !songs[i].retiring)
+            continue;
+        if (!all && audio_ready)
+        {
+            // let go, but the ring may have been full
+            if (songs[i].retiring == 1)
+            {
+                if (!I_QueueMusicCmd(music_unregister, i, 0))
+                    continue;
+                songs[i].retiring = 2;
+                songs[i].free_after = SDL_AtomicGet(&sound_ring_head);
+            }
+            if (SDL_AtomicGet(&sound_ring_tail) - songs[i].free_after < 0)
+                continue;
+        }
+        Z_Free(songs[i].data);
+        memset(&songs[i], 0, sizeof(song_t));
+    }
+}
+
+//
+// Is handle a song that can be played
+//
+static int I_ValidSong(int handle)
+{
+    return handle >= 0 && handle < MAX_SONGS
+        && songs[handle].data && !songs[handle].retiring;
 }
 
 void I_ShutdownMusic(void)
 {
+    int i;
+
+    // the device is closed by now
+    for (i = 0; i < MAX_SONGS; i++)
+        songs[i].retiring = 1;
+    I_FreeSongs(1);
 }
 
 void I_SetMusicVolume(int volume)
 {
     music_volume = volume;
+    I_QueueMusicCmd(music_volume_set, 0, volume);
 }
 
 void I_PlaySong(int handle, int looping)
 {
-    (void)handle;
-    (void)looping;
+    if (!I_ValidSong(handle))
+        return;
+    if (I_QueueMusicCmd(music_play, handle, looping))
+        songs[handle].playing = 1;
 }
 
 void I_PauseSong(int handle)
 {
-    (void)handle;
+    if (I_ValidSong(handle))
+        I_QueueMusicCmd(music_pause, handle, 0);
 }
 
 void I_ResumeSong(int handle)
 {
-    (void)handle;
+    if (I_ValidSong(handle))
+        I_QueueMusicCmd(music_resume, handle, 0);
 }
 
 void I_StopSong(int handle)
 {
-    (void)handle;
+    if (!I_ValidSong(handle))
+        return;
+    I_QueueMusicCmd(music_stop, handle, 0);
+    songs[handle].playing = 0;
 }
 
 void I_UnRegisterSong(int handle)
 {
-    (void)handle;
+    if (!I_ValidSong(handle))
+        return;
+
+    // queued from I_FreeSongs, now or once the ring has room
+    songs[handle].retiring = 1;
+    songs[handle].playing = 0;
+    I_FreeSongs(0);
 }
 
-int I_RegisterSong(void* data)
+//
+// Copy a MUS lump, whose length is in its header.
+// Returns -1 for anything else.
+//
+int I_RegisterSong(void* data, int size)
 {
-    (void)data;
-    return 0;
+    unsigned char* mus = (unsigned char*)data;
+    int length;
+    int i;
+
+    I_FreeSongs(0);
+
+    if (size < 16 || memcmp(mus, "MUS\x1a", 4))
+    {
+        fprintf(stderr, "I_RegisterSong: not a MUS lump\n");
+        return -1;
+    }
+
+    // the header is not to be trusted past the end of the lump
+    length = (mus[4] | (mus[5] << 8)) + (mus[6] | (mus[7] << 8));
+    if (length > size)
+    {
+        fprintf(stderr, "I_RegisterSong: MUS lump is %i bytes, header "
+                "says %i\n", size, length);
+        return -1;
+    }
+    if (!MUS_Valid(mus, length))
+        return -1;
+
+    for (i = 0; i < MAX_SONGS; i++)
+    {
+        if (!songs[i].data)
+            break;
+    }
+    if (i == MAX_SONGS)
+    {
+        fprintf(stderr, "I_RegisterSong: too many songs\n");
+        return -1;
+    }
+
+    songs[i].data = (unsigned char*)Z_Malloc(length, PU_STATIC, 0);
+    memcpy(songs[i].data, mus, length);
+    songs[i].length = length;
+    songs[i].retiring = 0;
+    songs[i].playing = 0;
+    return i;
 }
 
 int I_QrySongPlaying(int handle)
 {
-    (void)handle;
-    return 0;
-}
\ No newline at end of file
+    return I_ValidSong(handle) && songs[handle].playing;
+}
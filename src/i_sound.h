@@ -47,13 +47,30 @@ void I_SubmitSound(void);
 // ... shut down and relase at program termination.
 void I_ShutdownSound(void);
 
+// Finishes the -wavout file, if there is one.
+void I_CloseWav(void);
+
+// How the audio callback kept up, since the last call.
+typedef struct
+{
+    int		callbacks;
+    unsigned	mix_us;		// all of them
+    int		max_us;
+    int		underruns;	// took longer than their audio lasts
+    int		period_us;	// audio a callback makes
+
+} soundstats_t;
+
+void I_GetSoundStats (soundstats_t* stats);
+
 
 //
 //  SFX I/O
 //
 
-// Initialize channels?
-void I_SetChannels();
+// Sets the number of voices mixed at once, up to 128,
+// and returns the number there are.
+int I_SetChannels(int numchannels);
 
 // Get raw data lump index for sound descriptor.
 int I_GetSfxLumpNum (sfxinfo_t* sfxinfo );
@@ -86,6 +103,17 @@ I_UpdateSoundParams
   int		sep,
   int		pitch );
 
+// The same for count channels at once, cheaper
+//  than a call for each, as all the sounds that
+//  move are updated every tic.
+void
+I_UpdateSoundBlock
+( int		count,
+  int*		handles,
+  int*		vols,
+  int*		seps,
+  int*		pitches );
+
 
 //
 //  MUSIC I/O
@@ -97,8 +125,9 @@ void I_SetMusicVolume(int volume);
 // PAUSE game handling.
 void I_PauseSong(int handle);
 void I_ResumeSong(int handle);
-// Registers a song handle to song data.
-int I_RegisterSong(void *data);
+// Registers a song handle to song data,
+// a lump of size bytes.
+int I_RegisterSong(void *data, int size);
 // Called by anything that wishes to start music.
 //  plays a song, and when the song is done,
 //  starts playing it again in an endless loop.
@@ -32,11 +32,14 @@ rcsid[] = "$Id: m_bbox.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
 
 #include "doomdef.h"
 #include "m_misc.h"
+#include "m_argv.h"
 #include "i_video.h"
 #include "i_sound.h"
 
 #include "d_net.h"
 #include "g_game.h"
+#include "m_trace.h"
+#include "p_chksum.h"
 
 #ifdef __GNUG__
 #pragma implementation "i_system.h"
@@ -83,19 +86,67 @@ byte* I_ZoneBase (int*	size)
 // I_GetTime
 // returns time in 1/70th second tics
 //
+long long	basetime;		// microseconds at tic 0
+
 int  I_GetTime (void)
 {
-    static int      basetime = 0;
-    int             newtics;
-    int             ticks;
+    long long	now;
 
-    ticks = SDL_GetTicks();
+    now = I_GetTimeUS ();
     if (!basetime)
-        basetime = ticks;
-    
-    newtics = (ticks-basetime)*TICRATE/1000;
-              
-    return newtics;
+	basetime = now;
+
+    return (now-basetime)*TICRATE/1000000;
+}
+
+
+
+//
+// I_GetTimeUS
+// returns time in microseconds
+//
+long long I_GetTimeUS (void)
+{
+    Uint64	count;
+    Uint64	freq;
+
+    count = SDL_GetPerformanceCounter ();
+    freq = SDL_GetPerformanceFrequency ();
+
+    // split to keep count*1000000 from overflowing
+    return (count/freq)*1000000 + (count%freq)*1000000/freq;
+}
+
+
+
+//
+// I_MSToTic
+// Milliseconds until I_GetTime reaches tic, rounded up
+// so a sleep of that long never wakes a tic early
+//
+int I_MSToTic (int tic)
+{
+    long long	left;
+
+    if (!basetime)
+	I_GetTime ();
+
+    // the first microsecond of the tic
+    left = basetime + ((long long)tic*1000000 + TICRATE-1)/TICRATE
+	- I_GetTimeUS ();
+    if (left <= 0)
+	return 0;
+    return (left+999)/1000;
+}
+
+
+
+//
+// I_Sleep
+//
+void I_Sleep (int ms)
+{
+    SDL_Delay (ms);
 }
 
 
@@ -105,7 +156,9 @@ int  I_GetTime (void)
 //
 void I_Init (void)
 {
-    I_InitSound();
+    // a dedicated server makes no sound
+    if (!M_CheckParm ("-server"))
+	I_InitSound();
     //  I_InitGraphics();
 }
 
@@ -114,6 +167,8 @@ void I_Init (void)
 //
 void I_Quit (void)
 {
+    M_TraceDump ();
+    P_ChecksumClose ();
     D_QuitNetGame ();
     I_ShutdownSound();
     I_ShutdownMusic();
@@ -164,6 +219,9 @@ void I_Error (char *error, ...)
     fflush( stderr );
 
     // Shutdown. Here might be other errors.
+    M_TraceDump ();
+    P_ChecksumClose ();
+    I_CloseWav ();
     if (demorecording)
 	G_CheckDemoStatus();
 
@@ -44,6 +44,17 @@ byte*	I_ZoneBase (int *size);
 // returns current time in tics.
 int I_GetTime (void);
 
+// Returns a free running microsecond count,
+// for timing code.
+long long I_GetTimeUS (void);
+
+// Milliseconds until I_GetTime returns tic,
+// 0 if it already has.
+int I_MSToTic (int tic);
+
+// Gives up the processor for about ms milliseconds.
+void I_Sleep (int ms);
+
 
 //
 // Called by D_DoomLoop,
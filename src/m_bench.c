@@ -0,0 +1,405 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	-benchdemo <demo> <demo> ... plays the demos as fast as
+//	they go, like -timedemo, and times every frame to the
+//	microsecond, split into the parts of the game loop.
+//	The frames go to -benchout <file>, as CSV if the name
+//	ends in .csv and JSON otherwise, and the game quits.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: m_bench.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_system.h"
+#include "i_sound.h"
+#include "z_zone.h"
+#include "m_argv.h"
+#include "g_game.h"
+
+#ifdef __GNUG__
+#pragma implementation "m_bench.h"
+#endif
+#include "m_bench.h"
+
+
+#define MAXBENCHDEMOS	32
+
+typedef struct
+{
+    int		total;
+    int		phase[NUMBENCHPHASES];
+} benchframe_t;
+
+typedef struct
+{
+    char*	name;
+    int		firstframe;
+    int		numframes;
+    int		gametics;
+    soundstats_t audio;
+} benchrun_t;
+
+typedef struct
+{
+    int		min;
+    int		p50;
+    int		p99;
+    int		max;
+    double	avg;
+} benchstats_t;
+
+static char*	phasenames[NUMBENCHPHASES] =
+{
+    "ticker", "bsp", "segs", "planes", "masked", "hud", "finish"
+};
+
+boolean		benchdemo;
+long long	benchtime[NUMBENCHPHASES];
+
+benchframe_t*	benchframes;
+int		numbenchframes;
+int		maxbenchframes;
+
+benchrun_t	benchruns[MAXBENCHDEMOS];
+int		numbenchruns;
+int		benchrun;		// the one playing
+
+char*		benchout = "bench.json";
+long long	framestart;		// 0 before the first frame
+int		benchskip;		// frames that load a level
+int		rungametic;
+
+
+//
+// M_BenchInit
+//
+void M_BenchInit (int p)
+{
+    int		i;
+
+    while (++p < myargc && myargv[p][0] != '-')
+    {
+	if (numbenchruns == MAXBENCHDEMOS)
+	    I_Error ("M_BenchInit: more than %i demos", MAXBENCHDEMOS);
+	benchruns[numbenchruns++].name = myargv[p];
+    }
+
+    i = M_CheckParm ("-benchout");
+    if (i && i<myargc-1)
+	benchout = myargv[i+1];
+
+    benchdemo = true;
+    benchskip = 1;			// the first one loads the level
+    I_GetSoundStats (&benchruns[0].audio);	// from here on
+    G_TimeDemo (benchruns[0].name);
+}
+
+
+//
+// M_BenchFrame
+// Keeps the frame that just ended
+//
+void M_BenchFrame (void)
+{
+    benchframe_t*	frame;
+    benchframe_t*	newframes;
+    long long		now;
+    int			i;
+
+    now = I_GetTimeUS ();
+
+    if (framestart && benchskip)
+	benchskip--;
+    else if (framestart)
+    {
+	if (numbenchframes == maxbenchframes)
+	{
+	    maxbenchframes = maxbenchframes ? maxbenchframes*2 : 4096;
+	    newframes = Z_Malloc (maxbenchframes*sizeof(*newframes),
+				  PU_STATIC, 0);
+	    if (benchframes)
+	    {
+		memcpy (newframes, benchframes,
+			numbenchframes*sizeof(*newframes));
+		Z_Free (benchframes);
+	    }
+	    benchframes = newframes;
+	}
+
+	frame = &benchframes[numbenchframes++];
+	frame->total = now - framestart;
+	for (i=0 ; i<NUMBENCHPHASES ; i++)
+	    frame->phase[i] = benchtime[i];
+	frame->phase[bench_bsp] -= benchtime[bench_segs];
+    }
+
+    memset (benchtime, 0, sizeof(benchtime));
+    framestart = now;
+}
+
+
+//
+// BenchCompare
+//
+static int BenchCompare (const void* a, const void* b)
+{
+    return *(int *)a - *(int *)b;
+}
+
+
+//
+// BenchStats
+// Over the frames of run, of one phase,
+// or of the whole frame if phase is -1
+//
+void
+BenchStats
+( benchrun_t*	run,
+  int		phase,
+  benchstats_t*	st )
+{
+    int*	times;
+    double	sum;
+    int		n;
+    int		i;
+
+    memset (st, 0, sizeof(*st));
+    n = run->numframes;
+    if (!n)
+	return;
+
+    times = Z_Malloc (n*sizeof(*times), PU_STATIC, 0);
+    sum = 0;
+    for (i=0 ; i<n ; i++)
+    {
+	if (phase == -1)
+	    times[i] = benchframes[run->firstframe+i].total;
+	else
+	    times[i] = benchframes[run->firstframe+i].phase[phase];
+	sum += times[i];
+    }
+    qsort (times, n, sizeof(*times), BenchCompare);
+
+    st->min = times[0];
+    st->p50 = times[n/2];
+    st->p99 = times[n*99/100];
+    st->max = times[n-1];
+    st->avg = sum / n;
+    Z_Free (times);
+}
+
+
+//
+// BenchSeconds
+//
+double BenchSeconds (benchrun_t* run)
+{
+    double	sum;
+    int		i;
+
+    sum = 0;
+    for (i=0 ; i<run->numframes ; i++)
+	sum += benchframes[run->firstframe+i].total;
+    return sum / 1000000.0;
+}
+
+
+//
+// BenchWriteStats
+//
+void
+BenchWriteStats
+( FILE*		f,
+  char*		name,
+  benchstats_t*	st,
+  boolean	last )
+{
+    fprintf (f, "        \"%s\": { \"min\": %i, \"avg\": %.1f, "
+	     "\"p50\": %i, \"p99\": %i, \"max\": %i }%s\n",
+	     name, st->min, st->avg, st->p50, st->p99, st->max,
+	     last ? "" : ",");
+}
+
+
+//
+// BenchWriteJSON
+// Times are in microseconds
+//
+void BenchWriteJSON (FILE* f)
+{
+    benchrun_t*		run;
+    benchstats_t	st;
+    double		seconds;
+    int			r;
+    int			i;
+
+    fprintf (f, "{\n  \"demos\": [\n");
+    for (r=0 ; r<numbenchruns ; r++)
+    {
+	run = &benchruns[r];
+	seconds = BenchSeconds (run);
+
+	fprintf (f, "    {\n");
+	fprintf (f, "      \"name\": \"%s\",\n", run->name);
+	fprintf (f, "      \"gametics\": %i,\n", run->gametics);
+	fprintf (f, "      \"frames\": %i,\n", run->numframes);
+	fprintf (f, "      \"seconds\": %.3f,\n", seconds);
+	fprintf (f, "      \"fps\": %.1f,\n",
+		 seconds > 0 ? run->numframes / seconds : 0.0);
+
+	fprintf (f, "      \"us\": {\n");
+	BenchStats (run, -1, &st);
+	BenchWriteStats (f, "frame", &st, false);
+	for (i=0 ; i<NUMBENCHPHASES ; i++)
+	{
+	    BenchStats (run, i, &st);
+	    BenchWriteStats (f, phasenames[i], &st, i == NUMBENCHPHASES-1);
+	}
+	fprintf (f, "      },\n");
+
+	fprintf (f, "      \"audio\": { \"callbacks\": %i, \"period_us\": %i, "
+		 "\"avg_us\": %.1f, \"max_us\": %i, \"underruns\": %i },\n",
+		 run->audio.callbacks, run->audio.period_us,
+		 run->audio.callbacks ?
+		 (double)run->audio.mix_us / run->audio.callbacks : 0.0,
+		 run->audio.max_us, run->audio.underruns);
+
+	fprintf (f, "      \"frametimes\": [");
+	for (i=0 ; i<run->numframes ; i++)
+	    fprintf (f, "%s%s%i", i ? "," : "", i%16 ? "" : "\n        ",
+		     benchframes[run->firstframe+i].total);
+	fprintf (f, "\n      ]\n");
+	fprintf (f, "    }%s\n", r == numbenchruns-1 ? "" : ",");
+    }
+    fprintf (f, "  ]\n}\n");
+}
+
+
+//
+// BenchWriteCSV
+// A row for every frame
+//
+void BenchWriteCSV (FILE* f)
+{
+    benchframe_t*	frame;
+    benchrun_t*		run;
+    int			r;
+    int			i;
+    int			j;
+
+    fprintf (f, "demo,frame,frame_us");
+    for (j=0 ; j<NUMBENCHPHASES ; j++)
+	fprintf (f, ",%s_us", phasenames[j]);
+    fprintf (f, "\n");
+
+    for (r=0 ; r<numbenchruns ; r++)
+    {
+	run = &benchruns[r];
+	for (i=0 ; i<run->numframes ; i++)
+	{
+	    frame = &benchframes[run->firstframe+i];
+	    fprintf (f, "%s,%i,%i", run->name, i, frame->total);
+	    for (j=0 ; j<NUMBENCHPHASES ; j++)
+		fprintf (f, ",%i", frame->phase[j]);
+	    fprintf (f, "\n");
+	}
+    }
+}
+
+
+//
+// BenchWrite
+//
+void BenchWrite (void)
+{
+    FILE*	f;
+    int		len;
+
+    f = fopen (benchout, "w");
+    if (!f)
+	I_Error ("BenchWrite: couldn't write %s", benchout);
+
+    len = strlen (benchout);
+    if (len > 4 && !strcasecmp (benchout+len-4, ".csv"))
+	BenchWriteCSV (f);
+    else
+	BenchWriteJSON (f);
+    fclose (f);
+
+    printf ("benchmark written to %s\n", benchout);
+}
+
+
+//
+// M_BenchDemoDone
+//
+void M_BenchDemoDone (void)
+{
+    benchrun_t*		run;
+    benchstats_t	st;
+    double		seconds;
+    int			i;
+
+    run = &benchruns[benchrun];
+    run->numframes = numbenchframes - run->firstframe;
+    run->gametics = gametic - rungametic;
+    seconds = BenchSeconds (run);
+
+    BenchStats (run, -1, &st);
+    printf ("%s: %i frames in %.2f s, %.1f fps, frame avg %.0f "
+	    "p50 %i p99 %i max %i us\n",
+	    run->name, run->numframes, seconds,
+	    seconds > 0 ? run->numframes / seconds : 0.0,
+	    st.avg, st.p50, st.p99, st.max);
+    for (i=0 ; i<NUMBENCHPHASES ; i++)
+    {
+	BenchStats (run, i, &st);
+	printf ("  %-7s avg %7.1f  p99 %6i us\n",
+		phasenames[i], st.avg, st.p99);
+    }
+
+    I_GetSoundStats (&run->audio);
+    if (run->audio.callbacks)
+	printf ("  audio   avg %7.1f  max %6i us of %i, %i underruns\n",
+		(double)run->audio.mix_us / run->audio.callbacks,
+		run->audio.max_us, run->audio.period_us,
+		run->audio.underruns);
+
+    // skip the rest of this frame and the one loading the next level
+    benchskip = 2;
+
+    if (++benchrun < numbenchruns)
+    {
+	benchruns[benchrun].firstframe = numbenchframes;
+	rungametic = gametic;
+	G_DeferedPlayDemo (benchruns[benchrun].name);
+	return;
+    }
+
+    BenchWrite ();
+    I_Quit ();
+}
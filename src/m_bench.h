@@ -0,0 +1,69 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	Demo benchmark, per frame timing.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __M_BENCH__
+#define __M_BENCH__
+
+#include "doomtype.h"
+
+
+// Parts of a frame, timed separately.
+typedef enum
+{
+    bench_ticker,	// G_Ticker
+    bench_bsp,		// R_RenderBSPNode, less the segs
+    bench_segs,		// R_StoreWallRange
+    bench_planes,	// R_DrawPlanes
+    bench_masked,	// R_DrawMasked
+    bench_hud,		// status bar and messages
+    bench_finish,	// I_FinishUpdate
+    NUMBENCHPHASES
+
+} benchphase_t;
+
+
+// Set by -benchdemo.
+extern boolean		benchdemo;
+
+// Microseconds spent in each part this frame.
+// Add to these when benchdemo is set.
+extern long long	benchtime[NUMBENCHPHASES];
+
+
+// Takes the demo names after -benchdemo
+// at myargv[p] and starts the first one.
+void M_BenchInit (int p);
+
+// Called at the start of every frame.
+void M_BenchFrame (void);
+
+// Called when a demo ends, plays the next one
+// or writes the results and quits.
+void M_BenchDemoDone (void);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
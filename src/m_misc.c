@@ -210,6 +210,9 @@ extern int	showMessages;
 
 // machine-independent sound params
 extern	int	numChannels;
+extern	int	snd_cachesize;
+extern	int	snd_samplerate;
+extern	int	snd_samplecount;
 
 
 // UNIX hack, to be removed.
@@ -284,7 +287,10 @@ default_t	defaults[] =
     {"screenblocks",&screenblocks, 9},
     {"detaillevel",&detailLevel, 0},
 
-    {"snd_channels",&numChannels, 3},
+    {"snd_channels",&numChannels, 8},
+    {"snd_cachesize",&snd_cachesize, 512},
+    {"snd_samplerate",&snd_samplerate, 22050},
+    {"snd_samplecount",&snd_samplecount, 512},
 
 
 
@@ -0,0 +1,216 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	Streams a file to disk through two buffers: the game
+//	fills one while a thread writes and flushes the other,
+//	so a long file costs no more memory than a short one
+//	and what was handed over survives a crash.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: m_stream.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include <SDL.h>
+
+#include "doomdef.h"
+#include "i_system.h"
+#include "m_trace.h"
+
+#ifdef __GNUG__
+#pragma implementation "m_stream.h"
+#endif
+#include "m_stream.h"
+
+
+static byte		streambuffers[2][STREAMBUFFER];
+static int		streamfill;		// the one the game fills
+
+static FILE*		streamfile;
+static char*		streamname;
+static SDL_Thread*	streamthread;
+static SDL_mutex*	streamlock;
+static SDL_cond*	streamcond;
+
+// Handed to the thread, under streamlock.
+// Only one of the thread and the game ever
+// waits on streamcond at a time.
+static byte*		streamdata;
+static int		streamlength;		// 0 once written
+static boolean		streamquit;
+static int		streamerror;
+
+
+//
+// StreamWrite
+//
+static int StreamWrite (byte* data, int length)
+{
+    int		error;
+
+    TRACE_BEGIN ("demo write");
+    error = 0;
+    if (fwrite (data, 1, length, streamfile) != (size_t)length
+	|| fflush (streamfile))
+	error = errno ? errno : EIO;
+    TRACE_END ();
+    return error;
+}
+
+
+//
+// StreamThread
+//
+static int StreamThread (void* unused)
+{
+    byte*	data;
+    int		length;
+    int		error;
+
+    M_TraceThread ("stream");
+
+    SDL_LockMutex (streamlock);
+    while (1)
+    {
+	while (!streamlength && !streamquit)
+	    SDL_CondWait (streamcond, streamlock);
+	if (!streamlength)
+	    break;
+
+	data = streamdata;
+	length = streamlength;
+	SDL_UnlockMutex (streamlock);
+
+	error = StreamWrite (data, length);
+
+	SDL_LockMutex (streamlock);
+	if (error && !streamerror)
+	    streamerror = error;
+	streamlength = 0;
+	SDL_CondSignal (streamcond);
+    }
+    SDL_UnlockMutex (streamlock);
+    return 0;
+}
+
+
+//
+// M_StreamOpen
+//
+byte* M_StreamOpen (char* name)
+{
+    if (streamfile)
+	I_Error ("M_StreamOpen: %s is still open", streamname);
+
+    streamfile = fopen (name, "wb");
+    if (!streamfile)
+	I_Error ("M_StreamOpen: couldn't write %s: %s", name, strerror(errno));
+    streamname = name;
+    streamfill = 0;
+    streamlength = 0;
+    streamquit = false;
+    streamerror = 0;
+
+    if (!streamlock)
+    {
+	streamlock = SDL_CreateMutex ();
+	streamcond = SDL_CreateCond ();
+    }
+    if (streamlock && streamcond)
+	streamthread = SDL_CreateThread (StreamThread, "stream", NULL);
+    if (!streamthread)
+	printf ("M_StreamOpen: %s, writing %s on the game thread\n",
+		SDL_GetError (), name);
+
+    return streambuffers[0];
+}
+
+
+//
+// M_StreamSwap
+//
+byte* M_StreamSwap (int length)
+{
+    int		error;
+
+    if (!streamfile)
+	I_Error ("M_StreamSwap: nothing open");
+
+    if (!streamthread)
+    {
+	if (length)
+	    streamerror = StreamWrite (streambuffers[streamfill], length);
+	if (streamerror)
+	    I_Error ("M_StreamSwap: couldn't write %s: %s",
+		     streamname, strerror(streamerror));
+	return streambuffers[streamfill];
+    }
+
+    SDL_LockMutex (streamlock);
+    while (streamlength)
+	SDL_CondWait (streamcond, streamlock);
+    error = streamerror;
+    if (length && !error)
+    {
+	streamdata = streambuffers[streamfill];
+	streamlength = length;
+	streamfill ^= 1;
+	SDL_CondSignal (streamcond);
+    }
+    SDL_UnlockMutex (streamlock);
+
+    if (error)
+	I_Error ("M_StreamSwap: couldn't write %s: %s",
+		 streamname, strerror(error));
+    return streambuffers[streamfill];
+}
+
+
+//
+// M_StreamClose
+//
+void M_StreamClose (void)
+{
+    int		error;
+
+    if (!streamfile)
+	return;
+
+    if (streamthread)
+    {
+	SDL_LockMutex (streamlock);
+	streamquit = true;
+	SDL_CondSignal (streamcond);
+	SDL_UnlockMutex (streamlock);
+	SDL_WaitThread (streamthread, NULL);
+	streamthread = NULL;
+    }
+
+    error = streamerror;
+    if (fclose (streamfile) && !error)
+	error = errno ? errno : EIO;
+    streamfile = NULL;
+    if (error)
+	I_Error ("M_StreamClose: couldn't write %s: %s",
+		 streamname, strerror(error));
+}
@@ -0,0 +1,50 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	A file written a buffer at a time on another thread.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __M_STREAM__
+#define __M_STREAM__
+
+#include "doomtype.h"
+
+
+// Size of each of the two buffers.
+#define STREAMBUFFER	(16*1024)
+
+
+// Creates the file and returns the first buffer to fill.
+// Only one file is streamed at a time.
+byte* M_StreamOpen (char* name);
+
+// Hands length bytes of the buffer being filled to the
+// thread and returns the other one, once it is written.
+byte* M_StreamSwap (int length);
+
+// Waits for everything handed over to be written.
+void M_StreamClose (void);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
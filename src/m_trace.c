@@ -0,0 +1,239 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	-trace <file> times zones of the frame on every thread and
+//	writes them in the Chrome trace event format when the game
+//	quits, to be opened in Perfetto or chrome://tracing.
+//	Each thread keeps its own ring of finished zones, so
+//	nothing is shared while tracing and a long game keeps
+//	the last TRACEEVENTS zones of each thread.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: m_trace.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <SDL.h>
+
+#include "doomdef.h"
+#include "i_system.h"
+#include "m_argv.h"
+
+#ifdef __GNUG__
+#pragma implementation "m_trace.h"
+#endif
+#include "m_trace.h"
+
+
+#ifdef _MSC_VER
+#define THREADLOCAL	__declspec(thread)
+#else
+#define THREADLOCAL	__thread
+#endif
+
+#define TRACEEVENTS	(1<<18)		// per thread, a power of two
+#define TRACEDEPTH	32		// deeper zones are not kept
+#define MAXTRACETHREADS	8
+
+typedef struct
+{
+    long long	start;
+    int		dur;
+    const char*	name;
+} traceevent_t;
+
+typedef struct
+{
+    char		name[32];
+    traceevent_t*	events;
+    unsigned		count;		// ever kept
+    int			depth;
+    long long		starts[TRACEDEPTH];
+    const char*		names[TRACEDEPTH];
+} tracering_t;
+
+boolean			tracing;
+char*			tracefile;
+
+tracering_t*		tracerings[MAXTRACETHREADS];
+SDL_atomic_t		numtracerings;
+
+static THREADLOCAL tracering_t*	ring;
+static THREADLOCAL boolean	noring;	// came too late for a ring
+
+
+//
+// M_TraceInit
+//
+void M_TraceInit (void)
+{
+    int		p;
+
+    p = M_CheckParm ("-trace");
+    if (!p || p >= myargc-1)
+	return;
+
+    tracefile = myargv[p+1];
+    tracing = true;
+    M_TraceThread ("main");
+    printf ("M_TraceInit: tracing to %s\n", tracefile);
+}
+
+
+//
+// M_TraceThread
+// Zones on a thread without a ring are not kept
+// once MAXTRACETHREADS threads have one
+//
+void M_TraceThread (const char* name)
+{
+    tracering_t*	newring;
+    int			slot;
+
+    if (!tracing || ring || noring)
+	return;
+
+    slot = SDL_AtomicAdd (&numtracerings, 1);
+    if (slot >= MAXTRACETHREADS)
+    {
+	noring = true;
+	return;
+    }
+
+    // the zone memory is not for other threads
+    newring = calloc (1, sizeof(*newring));
+    if (newring)
+	newring->events = malloc (TRACEEVENTS*sizeof(traceevent_t));
+    if (!newring || !newring->events)
+	I_Error ("M_TraceThread: no memory for %s", name);
+
+    if (name)
+	strncpy (newring->name, name, sizeof(newring->name)-1);
+    else
+	sprintf (newring->name, "thread %i", slot);
+    ring = newring;
+    tracerings[slot] = newring;
+}
+
+
+//
+// M_TraceBegin
+//
+void M_TraceBegin (const char* name)
+{
+    if (!ring)
+    {
+	M_TraceThread (NULL);
+	if (!ring)
+	    return;
+    }
+
+    if (ring->depth < TRACEDEPTH)
+    {
+	ring->names[ring->depth] = name;
+	ring->starts[ring->depth] = I_GetTimeUS ();
+    }
+    ring->depth++;
+}
+
+
+//
+// M_TraceEnd
+//
+void M_TraceEnd (void)
+{
+    traceevent_t*	ev;
+
+    if (!ring || !ring->depth)
+	return;
+
+    ring->depth--;
+    if (ring->depth >= TRACEDEPTH)
+	return;
+
+    ev = &ring->events[ring->count & (TRACEEVENTS-1)];
+    ev->start = ring->starts[ring->depth];
+    ev->dur = I_GetTimeUS () - ev->start;
+    ev->name = ring->names[ring->depth];
+    ring->count++;
+}
+
+
+//
+// M_TraceDump
+// Other threads may still be adding zones,
+// the oldest few of theirs can come out torn
+//
+void M_TraceDump (void)
+{
+    tracering_t*	tr;
+    traceevent_t*	ev;
+    FILE*		f;
+    int			numrings;
+    unsigned		first;
+    unsigned		i;
+    int			t;
+    boolean		comma;
+
+    if (!tracing)
+	return;
+    tracing = false;		// once, even from I_Error
+
+    f = fopen (tracefile, "w");
+    if (!f)
+    {
+	printf ("M_TraceDump: couldn't write %s\n", tracefile);
+	return;
+    }
+
+    numrings = SDL_AtomicGet (&numtracerings);
+    if (numrings > MAXTRACETHREADS)
+	numrings = MAXTRACETHREADS;
+
+    fprintf (f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    comma = false;
+    for (t=0 ; t<numrings ; t++)
+    {
+	tr = tracerings[t];
+	if (!tr)
+	    continue;
+
+	fprintf (f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		 "\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+		 comma ? ",\n" : "", t, tr->name);
+	comma = true;
+
+	first = tr->count > TRACEEVENTS ? tr->count - TRACEEVENTS : 0;
+	for (i=first ; i<tr->count ; i++)
+	{
+	    ev = &tr->events[i & (TRACEEVENTS-1)];
+	    fprintf (f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+		     "\"tid\":%i,\"ts\":%lld,\"dur\":%i}",
+		     ev->name, t, ev->start, ev->dur);
+	}
+    }
+    fprintf (f, "\n]}\n");
+    fclose (f);
+
+    printf ("M_TraceDump: wrote %s\n", tracefile);
+}
@@ -0,0 +1,54 @@
+// Emacs style mode select   -*- C++ -*-
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	Timed zones, written as a Chrome trace.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __M_TRACE__
+#define __M_TRACE__
+
+#include "doomtype.h"
+
+
+// Set by -trace.
+extern boolean	tracing;
+
+// A zone is everything between a begin and the
+// matching end on the same thread.  The name must
+// be a string that is never freed, like a literal.
+#define TRACE_BEGIN(name)	do { if (tracing) M_TraceBegin (name); } while (0)
+#define TRACE_END()		do { if (tracing) M_TraceEnd (); } while (0)
+
+void M_TraceInit (void);
+void M_TraceBegin (const char* name);
+void M_TraceEnd (void);
+
+// Names the calling thread in the trace.
+void M_TraceThread (const char* name);
+
+// Writes the zones kept so far to the -trace file.
+void M_TraceDump (void);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
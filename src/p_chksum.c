@@ -0,0 +1,369 @@
+// Emacs style mode select   -*- C++ -*- 
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// $Log:$
+//
+// DESCRIPTION:
+//	A hash of the level after every tic.  Each mobj is hashed
+//	by P_RunThinkers right after it thinks, while it is still
+//	in the cache, then the sectors, the players and the
+//	random index are added at the end of the tic.
+//	-statelog <file> writes the hash of every tic, and with
+//	-statethings the hash and place of every mobj too.
+//	-statediff <file> <file> finds the first tic two logs
+//	differ in and the thing that went wrong.
+//
+//-----------------------------------------------------------------------------
+
+static const char
+rcsid[] = "$Id: p_chksum.c,v 1.1 1997/02/03 22:45:10 b1 Exp $";
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "doomdef.h"
+#include "doomstat.h"
+#include "i_system.h"
+#include "m_argv.h"
+#include "p_local.h"
+#include "r_state.h"
+
+#ifdef __GNUG__
+#pragma implementation "p_chksum.h"
+#endif
+#include "p_chksum.h"
+
+
+// FNV-1a over whole words.  Every step is one to one in
+// both the hash and the word, so a single changed word
+// always changes the result.
+#define HASHSTART	0x811c9dc5
+#define HASHMIX(h,v)	((h) = ((h) ^ (unsigned)(v)) * 0x01000193)
+
+#define STATELOGMAGIC	0x474c5453	// "STLG"
+
+typedef struct
+{
+    int		gametic;
+    unsigned	hash;
+    int		prndindex;
+    int		rndindex;	// not hashed, sounds and wipes use it
+    int		numthings;	// that follow, with -statethings
+    
+} statetic_t;
+
+typedef struct
+{
+    int		type;
+    fixed_t	x;
+    fixed_t	y;
+    unsigned	hash;
+    
+} statething_t;
+
+extern int	prndindex;
+
+boolean		checksumming;
+unsigned	tichash;
+unsigned	statehash;		// of the tic running
+
+boolean		statelog;
+boolean		statethings;
+FILE*		statefile;
+
+statething_t*	statethinglist;
+int		numstatethings;
+int		maxstatethings;
+
+
+//
+// P_ChecksumInit
+//
+void P_ChecksumInit (void)
+{
+    int		header[2];
+    int		p;
+
+    p = M_CheckParm ("-statelog");
+    if (!p || p >= myargc-1)
+	return;
+
+    statefile = fopen (myargv[p+1], "wb");
+    if (!statefile)
+	I_Error ("P_ChecksumInit: couldn't write %s", myargv[p+1]);
+
+    statethings = M_CheckParm ("-statethings");
+    header[0] = STATELOGMAGIC;
+    header[1] = statethings;
+    fwrite (header, sizeof(header), 1, statefile);
+
+    statelog = true;
+    printf ("P_ChecksumInit: logging the game state to %s\n", myargv[p+1]);
+}
+
+
+//
+// P_ChecksumBegin
+//
+void P_ChecksumBegin (void)
+{
+    statehash = HASHSTART;
+    numstatethings = 0;
+}
+
+
+//
+// P_ChecksumMobj
+// Pointers are left out, they differ between runs.
+//
+void P_ChecksumMobj (mobj_t* mobj)
+{
+    statething_t*	th;
+    unsigned		h;
+
+    h = HASHSTART;
+    HASHMIX (h, mobj->type);
+    HASHMIX (h, mobj->x);
+    HASHMIX (h, mobj->y);
+    HASHMIX (h, mobj->z);
+    HASHMIX (h, mobj->momx);
+    HASHMIX (h, mobj->momy);
+    HASHMIX (h, mobj->momz);
+    HASHMIX (h, mobj->angle);
+    HASHMIX (h, mobj->state - states);
+    HASHMIX (h, mobj->tics);
+    HASHMIX (h, mobj->health);
+    HASHMIX (h, mobj->flags);
+    HASHMIX (h, mobj->movedir);
+    HASHMIX (h, mobj->movecount);
+    HASHMIX (h, mobj->reactiontime);
+    HASHMIX (h, mobj->threshold);
+    HASHMIX (statehash, h);
+
+    if (!statethings || demoseeking)
+	return;
+
+    if (numstatethings == maxstatethings)
+    {
+	maxstatethings = maxstatethings ? maxstatethings*2 : 1024;
+	statethinglist = realloc (statethinglist,
+				  maxstatethings*sizeof(*statethinglist));
+	if (!statethinglist)
+	    I_Error ("P_ChecksumMobj: no memory for %i things", maxstatethings);
+    }
+    th = &statethinglist[numstatethings++];
+    th->type = mobj->type;
+    th->x = mobj->x;
+    th->y = mobj->y;
+    th->hash = h;
+}
+
+
+//
+// P_ChecksumEnd
+//
+void P_ChecksumEnd (void)
+{
+    statetic_t	st;
+    sector_t*	sec;
+    player_t*	player;
+    int		i;
+    int		j;
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	HASHMIX (statehash, sec->floorheight);
+	HASHMIX (statehash, sec->ceilingheight);
+	HASHMIX (statehash, sec->lightlevel | (sec->special<<16));
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+	player = &players[i];
+	HASHMIX (statehash, player->playerstate);
+	HASHMIX (statehash, player->health);
+	HASHMIX (statehash, player->armorpoints);
+	HASHMIX (statehash, player->armortype);
+	HASHMIX (statehash, player->readyweapon);
+	HASHMIX (statehash, player->pendingweapon);
+	HASHMIX (statehash, player->cheats);
+	HASHMIX (statehash, player->refire);
+	for (j=0 ; j<NUMAMMO ; j++)
+	    HASHMIX (statehash, player->ammo[j]);
+	for (j=0 ; j<NUMPOWERS ; j++)
+	    HASHMIX (statehash, player->powers[j]);
+    }
+
+    HASHMIX (statehash, prndindex);
+    HASHMIX (statehash, leveltime);
+    tichash = statehash;
+
+    // a seek runs the same tics again
+    if (!statelog || demoseeking)
+	return;
+
+    st.gametic = gametic;
+    st.hash = tichash;
+    st.prndindex = prndindex;
+    st.rndindex = rndindex;
+    st.numthings = numstatethings;
+    fwrite (&st, sizeof(st), 1, statefile);
+    if (numstatethings)
+	fwrite (statethinglist, sizeof(*statethinglist),
+		numstatethings, statefile);
+}
+
+
+//
+// P_ChecksumClose
+//
+void P_ChecksumClose (void)
+{
+    if (!statelog)
+	return;
+    statelog = false;		// once, even from I_Error
+    fclose (statefile);
+}
+
+
+//
+// P_ReadStateTic
+// Reads a tic and its things, if the log has them.
+//
+static boolean
+P_ReadStateTic
+( FILE*		f,
+  statetic_t*	st,
+  statething_t** list,
+  int*		maxlist )
+{
+    if (fread (st, sizeof(*st), 1, f) != 1)
+	return false;
+
+    if (st->numthings > *maxlist)
+    {
+	*maxlist = st->numthings;
+	*list = realloc (*list, *maxlist*sizeof(**list));
+	if (!*list)
+	    I_Error ("P_ReadStateTic: no memory for %i things", *maxlist);
+    }
+    if (st->numthings
+	&& fread (*list, sizeof(**list), st->numthings, f)
+	   != st->numthings)
+	return false;
+    return true;
+}
+
+
+//
+// P_OpenStateLog
+//
+static FILE*
+P_OpenStateLog
+( char*		name,
+  boolean*	withthings )
+{
+    FILE*	f;
+    int		header[2];
+
+    f = fopen (name, "rb");
+    if (!f)
+	I_Error ("P_OpenStateLog: couldn't read %s", name);
+    if (fread (header, sizeof(header), 1, f) != 1
+	|| header[0] != STATELOGMAGIC)
+	I_Error ("P_OpenStateLog: %s is not a -statelog file", name);
+    *withthings = header[1];
+    return f;
+}
+
+
+//
+// P_ChecksumDiff
+//
+int P_ChecksumDiff (char* name1, char* name2)
+{
+    FILE*		f1;
+    FILE*		f2;
+    statetic_t		st1;
+    statetic_t		st2;
+    statething_t*	list1;
+    statething_t*	list2;
+    statething_t*	t1;
+    statething_t*	t2;
+    int			max1;
+    int			max2;
+    boolean		more1;
+    boolean		more2;
+    boolean		things1;
+    boolean		things2;
+    int			tics;
+    int			i;
+
+    f1 = P_OpenStateLog (name1, &things1);
+    f2 = P_OpenStateLog (name2, &things2);
+    list1 = list2 = NULL;
+    max1 = max2 = 0;
+
+    for (tics=0 ; ; tics++)
+    {
+	more1 = P_ReadStateTic (f1, &st1, &list1, &max1);
+	more2 = P_ReadStateTic (f2, &st2, &list2, &max2);
+	if (!more1 || !more2)
+	{
+	    if (more1 != more2)
+		printf ("%s ends first, ", more1 ? name2 : name1);
+	    printf ("%i tics match\n", tics);
+	    return 0;
+	}
+	if (st1.hash == st2.hash)
+	    continue;
+
+	printf ("tic %i differs", st1.gametic);
+	if (st2.gametic != st1.gametic)
+	    printf (" (tic %i in %s)", st2.gametic, name2);
+	printf (" after %i that match\n", tics);
+	if (st1.prndindex != st2.prndindex)
+	    printf ("  prndindex %i, %i\n", st1.prndindex, st2.prndindex);
+	printf ("  rndindex %i, %i\n", st1.rndindex, st2.rndindex);
+
+	if (!things1 || !things2)
+	{
+	    printf ("  use -statethings to find the thing\n");
+	    return 1;
+	}
+	
+	for (i=0 ; i<st1.numthings && i<st2.numthings ; i++)
+	{
+	    t1 = &list1[i];
+	    t2 = &list2[i];
+	    if (t1->hash == t2->hash)
+		continue;
+	    printf ("  thing %i: type %i at (%i,%i), type %i at (%i,%i)\n",
+		    i, t1->type, t1->x>>FRACBITS, t1->y>>FRACBITS,
+		    t2->type, t2->x>>FRACBITS, t2->y>>FRACBITS);
+	    return 1;
+	}
+	
+	if (st1.numthings != st2.numthings)
+	    printf ("  %i things, %i things\n", st1.numthings, st2.numthings);
+	else
+	    printf ("  the things match, a sector or player differs\n");
+	return 1;
+    }
+}
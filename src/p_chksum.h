@@ -0,0 +1,61 @@
+// Emacs style mode select   -*- C++ -*- 
+//-----------------------------------------------------------------------------
+//
+// $Id:$
+//
+// Copyright (C) 1993-1996 by id Software, Inc.
+//
+// This source is available for distribution and/or modification
+// only under the terms of the DOOM Source Code License as
+// published by id Software. All rights reserved.
+//
+// The source is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// FITNESS FOR A PARTICULAR PURPOSE. See the DOOM Source Code License
+// for more details.
+//
+// DESCRIPTION:
+//	Game state hash per tic, for finding desyncs.
+//
+//-----------------------------------------------------------------------------
+
+
+#ifndef __P_CHKSUM__
+#define __P_CHKSUM__
+
+#include "p_mobj.h"
+
+
+// Set by G_Ticker when the hash is wanted,
+// in net games, demos and with -statelog.
+extern boolean		checksumming;
+
+// The level after the last tic that ran.
+extern unsigned		tichash;
+
+// Set by -statelog.
+extern boolean		statelog;
+
+
+void P_ChecksumInit (void);
+
+// P_Ticker calls these around a tic,
+// and P_RunThinkers gives each mobj
+// once it has thought.
+void P_ChecksumBegin (void);
+void P_ChecksumMobj (mobj_t* mobj);
+void P_ChecksumEnd (void);
+
+// Flushes the -statelog file.
+void P_ChecksumClose (void);
+
+// Compares two -statelog files, returns 0 if they match.
+int P_ChecksumDiff (char* name1, char* name2);
+
+
+#endif
+//-----------------------------------------------------------------------------
+//
+// $Log:$
+//
+//-----------------------------------------------------------------------------
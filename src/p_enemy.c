@@ -1809,6 +1809,7 @@ A_CloseShotgun2
 mobj_t*		braintargets[32];
 int		numbraintargets;
 int		braintargeton;
+int		braineasy;	// on easy, every other spit is skipped
 
 void A_BrainAwake (mobj_t* mo)
 {
@@ -1902,11 +1903,9 @@ void A_BrainSpit (mobj_t*	mo)
 {
     mobj_t*	targ;
     mobj_t*	newmobj;
-    
-    static int	easy = 0;
 	
-    easy ^= 1;
-    if (gameskill <= sk_easy && (!easy))
+    braineasy ^= 1;
+    if (gameskill <= sk_easy && (!braineasy))
 	return;
 		
     // shoot a cube at current target
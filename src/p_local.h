@@ -34,10 +34,18 @@
 #define VIEWHEIGHT		(41*FRACUNIT)
 
 // mapblocks are used to check movement
-// against lines and things
-#define MAPBLOCKUNITS	128
+// against lines and things.
+// They are 128 units unless -blocksize is given,
+// in which case the blockmap is built at load time.
+#define DEFAULTBLOCKBITS	7
+#define MINBLOCKBITS		4
+#define MAXBLOCKBITS		10
+
+extern int	mapblockbits;
+
+#define MAPBLOCKUNITS	(1<<mapblockbits)
 #define MAPBLOCKSIZE	(MAPBLOCKUNITS*FRACUNIT)
-#define MAPBLOCKSHIFT	(FRACBITS+7)
+#define MAPBLOCKSHIFT	(FRACBITS+mapblockbits)
 #define MAPBMASK		(MAPBLOCKSIZE-1)
 #define MAPBTOFRAC		(MAPBLOCKSHIFT-FRACBITS)
 
@@ -87,6 +95,7 @@ void P_DropWeapon (player_t* player);
 // P_USER
 //
 void	P_PlayerThink (player_t* player);
+void	P_PredictPlayer (player_t* player, ticcmd_t* cmd);
 
 
 //
@@ -103,6 +112,9 @@ extern int		itemrespawntime[ITEMQUESIZE];
 extern int		iquehead;
 extern int		iquetail;
 
+// Dead players left in deathmatch, see G_CheckSpot.
+#define BODYQUESIZE		32
+
 
 void P_RespawnSpecials (void);
 
@@ -151,9 +163,10 @@ typedef struct
     }			d;
 } intercept_t;
 
+// initial size, the list grows as needed
 #define MAXINTERCEPTS	128
 
-extern intercept_t	intercepts[MAXINTERCEPTS];
+extern intercept_t*	intercepts;
 extern intercept_t*	intercept_p;
 
 typedef boolean (*traverser_t) (intercept_t *in);
@@ -172,9 +185,77 @@ extern fixed_t		lowfloor;
 
 void 	P_LineOpening (line_t* linedef);
 
+//
+// Things are kept in each mapblock as a packed array,
+// oldest first, so iterating it backwards gives the
+// same newest-first order as the old block links.
+// The position and radius are copied in when the thing
+// is linked, so range checks don't have to touch the mobj_t.
+// The radius can only shrink while linked (crushed bodies),
+// so the copy is always a safe upper bound.
+//
+typedef struct
+{
+    fixed_t	x;
+    fixed_t	y;
+    fixed_t	radius;
+    mobj_t*	mobj;
+    
+} blockthing_t;
+
+typedef struct
+{
+    blockthing_t*	things;
+    int			numthings;
+    int			maxthings;
+    
+} blockthings_t;
+
 boolean P_BlockLinesIterator (int x, int y, boolean(*func)(line_t*) );
 boolean P_BlockThingsIterator (int x, int y, boolean(*func)(mobj_t*) );
 
+boolean
+P_BlockThingsIteratorRange
+( int		x,
+  int		y,
+  fixed_t	cx,
+  fixed_t	cy,
+  fixed_t	range,
+  boolean(*func)(mobj_t*) );
+
+//
+// Batched thing queries.
+// P_GatherThings walks the blocks of all the queries
+// in one pass and lists, for each query, the things
+// P_BlockThingsIteratorRange would have given it,
+// in the same order, when called over the blocks of
+// x,y +- range+MAXRADIUS rows first.
+// The lists are in gatheredthings, starting at
+// firstthing, until P_ReleaseThings is given the
+// mark that P_GatherThings returned.
+// Things removed while a list is being processed are
+// still in it, so check for that before using them.
+//
+typedef struct
+{
+    fixed_t	x;
+    fixed_t	y;
+    fixed_t	range;
+
+    // set by P_GatherThings
+    int		firstthing;
+    int		numthings;
+    
+} thingquery_t;
+
+extern mobj_t**		gatheredthings;
+
+int	P_GatherThings (thingquery_t* queries, int numqueries);
+void	P_ReleaseThings (int mark);
+
+#define P_ThingRemoved(th) \
+    ((th)->thinker.function.acv == (actionf_v)(-1))
+
 #define PT_ADDLINES		1
 #define PT_ADDTHINGS	2
 #define PT_EARLYOUT		4
@@ -193,6 +274,9 @@ P_PathTraverse
 void P_UnsetThingPosition (mobj_t* thing);
 void P_SetThingPosition (mobj_t* thing);
 
+// free msecnode_t list, cleared with the level
+extern msecnode_t*	headsecnode;
+
 
 //
 // P_MAP
@@ -238,19 +322,35 @@ P_RadiusAttack
   mobj_t*	source,
   int		damage );
 
+// Radius attacks and BFG sprays use batched thing
+// queries unless -nobatch is given.
+// -blastbench times them, and the tics, and reports
+// the totals at the end of a timedemo.
+extern boolean		batchqueries;
+extern boolean		blastbench;
+
+extern int		benchtics;
+extern long long	benchtictime;
+extern int		benchblasts;
+extern long long	benchblasttime;
+extern int		benchsprays;
+extern long long	benchspraytime;
+
+void	P_BlastBenchReport (void);
+
 
 
 //
 // P_SETUP
 //
 extern byte*		rejectmatrix;	// for fast sight rejection
-extern short*		blockmaplump;	// offsets in blockmap are from here
-extern short*		blockmap;
+extern int*		blockmaplump;	// offsets in blockmap are from here
+extern int*		blockmap;
 extern int		bmapwidth;
 extern int		bmapheight;	// in mapblocks
 extern fixed_t		bmaporgx;
 extern fixed_t		bmaporgy;	// origin of block map
-extern mobj_t**		blocklinks;	// for thing chains
+extern blockthings_t*	blockthings;	// for thing lists
 
 
 
@@ -159,7 +159,8 @@ P_TeleportMove
 
     for (bx=xl ; bx<=xh ; bx++)
 	for (by=yl ; by<=yh ; by++)
-	    if (!P_BlockThingsIterator(bx,by,PIT_StompThing))
+	    if (!P_BlockThingsIteratorRange(bx,by,tmx,tmy,tmthing->radius,
+					    PIT_StompThing))
 		return false;
     
     // the move is ok,
@@ -331,7 +332,7 @@ boolean PIT_CheckThing (mobj_t* thing)
     if (thing->flags & MF_SPECIAL)
     {
 	solid = thing->flags&MF_SOLID;
-	if (tmflags&MF_PICKUP)
+	if (tmflags&MF_PICKUP && !predicting)
 	{
 	    // can remove thing
 	    P_TouchSpecialThing (thing, tmthing);
@@ -422,9 +423,12 @@ P_CheckPosition
     yl = (tmbbox[BOXBOTTOM] - bmaporgy - MAXRADIUS)>>MAPBLOCKSHIFT;
     yh = (tmbbox[BOXTOP] - bmaporgy + MAXRADIUS)>>MAPBLOCKSHIFT;
 
+    // Things that can't be within blockdist of tmx,tmy
+    // are skipped by the iterator before PIT_CheckThing.
     for (bx=xl ; bx<=xh ; bx++)
 	for (by=yl ; by<=yh ; by++)
-	    if (!P_BlockThingsIterator(bx,by,PIT_CheckThing))
+	    if (!P_BlockThingsIteratorRange(bx,by,tmx,tmy,tmthing->radius,
+					    PIT_CheckThing))
 		return false;
     
     // check lines
@@ -497,7 +501,7 @@ P_TryMove
     P_SetThingPosition (thing);
     
     // if any special lines were hit, do the effect
-    if (! (thing->flags&(MF_TELEPORT|MF_NOCLIP)) )
+    if (! (thing->flags&(MF_TELEPORT|MF_NOCLIP)) && !predicting)
     {
 	while (numspechit--)
 	{
@@ -1217,19 +1221,89 @@ P_RadiusAttack
     int		yh;
     
     fixed_t	dist;
+
+    thingquery_t	query;
+    int			mark;
+    int			i;
+    mobj_t*		thing;
+    long long		start = 0;
+
+    if (blastbench)
+	start = I_GetTimeUS ();
 	
-    dist = (damage+MAXRADIUS)<<FRACBITS;
-    yh = (spot->y + dist - bmaporgy)>>MAPBLOCKSHIFT;
-    yl = (spot->y - dist - bmaporgy)>>MAPBLOCKSHIFT;
-    xh = (spot->x + dist - bmaporgx)>>MAPBLOCKSHIFT;
-    xl = (spot->x - dist - bmaporgx)>>MAPBLOCKSHIFT;
     bombspot = spot;
     bombsource = source;
     bombdamage = damage;
 	
-    for (y=yl ; y<=yh ; y++)
-	for (x=xl ; x<=xh ; x++)
-	    P_BlockThingsIterator (x, y, PIT_RadiusAttack );
+    if (batchqueries)
+    {
+	// Things further than damage from the spot
+	// on either axis are out of range anyway.
+	query.x = spot->x;
+	query.y = spot->y;
+	query.range = damage<<FRACBITS;
+	mark = P_GatherThings (&query, 1);
+	
+	for (i=0 ; i<query.numthings ; i++)
+	{
+	    thing = gatheredthings[query.firstthing+i];
+	    if (!P_ThingRemoved (thing))
+		PIT_RadiusAttack (thing);
+	}
+	
+	P_ReleaseThings (mark);
+    }
+    else
+    {
+	dist = (damage+MAXRADIUS)<<FRACBITS;
+	yh = (spot->y + dist - bmaporgy)>>MAPBLOCKSHIFT;
+	yl = (spot->y - dist - bmaporgy)>>MAPBLOCKSHIFT;
+	xh = (spot->x + dist - bmaporgx)>>MAPBLOCKSHIFT;
+	xl = (spot->x - dist - bmaporgx)>>MAPBLOCKSHIFT;
+	
+	for (y=yl ; y<=yh ; y++)
+	    for (x=xl ; x<=xh ; x++)
+		P_BlockThingsIterator (x, y, PIT_RadiusAttack );
+    }
+
+    if (blastbench)
+    {
+	benchblasts++;
+	benchblasttime += I_GetTimeUS () - start;
+    }
+}
+
+
+//
+// BLAST BENCHMARK
+//
+boolean		batchqueries = true;
+boolean		blastbench;
+
+int		benchtics;
+long long	benchtictime;
+int		benchblasts;
+long long	benchblasttime;
+int		benchsprays;
+long long	benchspraytime;
+
+
+//
+// P_BlastBenchReport
+//
+void P_BlastBenchReport (void)
+{
+    printf ("blastbench (%s queries):\n",
+	    batchqueries ? "batched" : "unbatched");
+    printf ("  %i tics, %lli us, %lli us/tic\n",
+	    benchtics, benchtictime,
+	    benchtics ? benchtictime/benchtics : 0);
+    printf ("  %i radius attacks, %lli us, %lli us each\n",
+	    benchblasts, benchblasttime,
+	    benchblasts ? benchblasttime/benchblasts : 0);
+    printf ("  %i bfg sprays, %lli us, %lli us each\n",
+	    benchsprays, benchspraytime,
+	    benchsprays ? benchspraytime/benchsprays : 0);
 }
 
 
@@ -1316,6 +1390,11 @@ boolean PIT_ChangeSector (mobj_t*	thing)
 
 //
 // P_ChangeSector
+// With -fastsectors only the things touching the
+// sector are checked. The original walk over the
+// sector's blocks also height clips things nowhere
+// near it, which can pick up items or call P_Random,
+// so it stays the default for demos and net games.
 //
 boolean
 P_ChangeSector
@@ -1324,16 +1403,39 @@ P_ChangeSector
 {
     int		x;
     int		y;
+    msecnode_t*	node;
 	
     nofit = false;
     crushchange = crunch;
-	
-    // re-check heights for all things near the moving sector
-    for (x=sector->blockbox[BOXLEFT] ; x<= sector->blockbox[BOXRIGHT] ; x++)
-	for (y=sector->blockbox[BOXBOTTOM];y<= sector->blockbox[BOXTOP] ; y++)
-	    P_BlockThingsIterator (x, y, PIT_ChangeSector);
-	
+
+    if (compatlevel == compat_vanilla)
+    {
+	// re-check heights for all things near the moving sector
+	for (x=sector->blockbox[BOXLEFT] ; x<= sector->blockbox[BOXRIGHT] ; x++)
+	    for (y=sector->blockbox[BOXBOTTOM];y<= sector->blockbox[BOXTOP] ; y++)
+		P_BlockThingsIterator (x, y, PIT_ChangeSector);
+
+	return nofit;
+    }
+
+    // re-check heights for all things touching the sector
+    for (node = sector->touching_thinglist ; node ; node = node->m_snext)
+	node->visited = false;
+
+    // PIT_ChangeSector can remove or move things,
+    // which frees their nodes, so start over after each
+    do
+    {
+	for (node = sector->touching_thinglist ; node ; node = node->m_snext)
+	{
+	    if (!node->visited)
+	    {
+		node->visited = true;
+		PIT_ChangeSector (node->m_thing);
+		break;
+	    }
+	}
+    } while (node);
 	
     return nofit;
 }
-
@@ -29,15 +29,18 @@ rcsid[] = "$Id: p_maputl.c,v 1.5 1997/02/03 22:45:11 b1 Exp $";
 
 
 #include <stdlib.h>
+#include <string.h>
 
 
 #include "m_bbox.h"
+#include "z_zone.h"
 
 #include "doomdef.h"
 #include "p_local.h"
 
 
 // State.
+#include "doomstat.h"
 #include "r_state.h"
 
 //
@@ -337,6 +340,231 @@ void P_LineOpening (line_t* linedef)
 //
 
 
+//
+// P_LinkToBlock
+// Appends a thing to the packed list of a mapblock,
+// growing the list from the zone when it is full.
+//
+static void
+P_LinkToBlock
+( blockthings_t*	block,
+  mobj_t*		thing )
+{
+    blockthing_t*	newthings;
+    blockthing_t*	bt;
+
+    if (block->numthings == block->maxthings)
+    {
+	block->maxthings = block->maxthings ? block->maxthings*2 : 8;
+	newthings = Z_Malloc (block->maxthings*sizeof(*newthings),
+			      PU_LEVEL, 0);
+	if (block->things)
+	{
+	    memcpy (newthings, block->things,
+		    block->numthings*sizeof(*newthings));
+	    Z_Free (block->things);
+	}
+	block->things = newthings;
+    }
+
+    bt = &block->things[block->numthings++];
+    bt->x = thing->x;
+    bt->y = thing->y;
+    bt->radius = thing->radius;
+    bt->mobj = thing;
+}
+
+
+//
+// P_UnlinkFromBlock
+// Removes a thing from a mapblock list,
+// keeping the remaining things in order.
+//
+static void
+P_UnlinkFromBlock
+( blockthings_t*	block,
+  mobj_t*		thing )
+{
+    int		i;
+
+    // moving things were usually linked last
+    for (i=block->numthings-1 ; i>=0 ; i--)
+    {
+	if (block->things[i].mobj == thing)
+	{
+	    block->numthings--;
+	    memmove (&block->things[i], &block->things[i+1],
+		     (block->numthings-i)*sizeof(*block->things));
+	    return;
+	}
+    }
+}
+
+
+//
+// SECTOR NODES
+// Every thing in the blockmap keeps a list of the
+// sectors its box touches, linked both ways,
+// see msecnode_t.
+//
+
+// free list of nodes, cleared with the level
+msecnode_t*	headsecnode;
+
+
+//
+// P_GetSecnode
+//
+static msecnode_t* P_GetSecnode (void)
+{
+    msecnode_t*	node;
+
+    if (headsecnode)
+    {
+	node = headsecnode;
+	headsecnode = headsecnode->m_snext;
+    }
+    else
+	node = Z_Malloc (sizeof(*node), PU_LEVEL, 0);
+    
+    return node;
+}
+
+
+//
+// P_AddSecnode
+// Links the thing into the sector, unless it already is.
+//
+static void
+P_AddSecnode
+( sector_t*	sec,
+  mobj_t*	thing )
+{
+    msecnode_t*	node;
+
+    for (node = thing->touching_sectorlist ; node ; node = node->m_tnext)
+	if (node->m_sector == sec)
+	    return;
+
+    node = P_GetSecnode ();
+
+    // Things added while P_ChangeSector walks
+    // the sector are not visited by it.
+    node->visited = true;
+    node->m_sector = sec;
+    node->m_thing = thing;
+
+    node->m_tprev = NULL;
+    node->m_tnext = thing->touching_sectorlist;
+    if (node->m_tnext)
+	node->m_tnext->m_tprev = node;
+    thing->touching_sectorlist = node;
+
+    node->m_sprev = NULL;
+    node->m_snext = sec->touching_thinglist;
+    if (node->m_snext)
+	node->m_snext->m_sprev = node;
+    sec->touching_thinglist = node;
+}
+
+
+//
+// P_DelSecnodes
+// Unlinks the thing from all the sectors it touches.
+//
+static void P_DelSecnodes (mobj_t* thing)
+{
+    msecnode_t*	node;
+    msecnode_t*	next;
+
+    for (node = thing->touching_sectorlist ; node ; node = next)
+    {
+	next = node->m_tnext;
+	
+	if (node->m_snext)
+	    node->m_snext->m_sprev = node->m_sprev;
+
+	if (node->m_sprev)
+	    node->m_sprev->m_snext = node->m_snext;
+	else
+	    node->m_sector->touching_thinglist = node->m_snext;
+
+	node->m_snext = headsecnode;
+	headsecnode = node;
+    }
+    thing->touching_sectorlist = NULL;
+}
+
+
+//
+// P_CreateSecnodes
+// Links the thing into its own sector and every sector
+// on either side of a line crossing its box, the same
+// lines PIT_CheckLine would clip its floor and ceiling to.
+// Lines in several blocks just add the same sectors again,
+// so there is no need for validcount here.
+//
+static void P_CreateSecnodes (mobj_t* thing)
+{
+    int		bx;
+    int		by;
+    int		xl;
+    int		xh;
+    int		yl;
+    int		yh;
+    int*	list;
+    line_t*	ld;
+    fixed_t	bbox[4];
+
+    bbox[BOXTOP] = thing->y + thing->radius;
+    bbox[BOXBOTTOM] = thing->y - thing->radius;
+    bbox[BOXRIGHT] = thing->x + thing->radius;
+    bbox[BOXLEFT] = thing->x - thing->radius;
+
+    P_AddSecnode (thing->subsector->sector, thing);
+    
+    xl = (bbox[BOXLEFT] - bmaporgx)>>MAPBLOCKSHIFT;
+    xh = (bbox[BOXRIGHT] - bmaporgx)>>MAPBLOCKSHIFT;
+    yl = (bbox[BOXBOTTOM] - bmaporgy)>>MAPBLOCKSHIFT;
+    yh = (bbox[BOXTOP] - bmaporgy)>>MAPBLOCKSHIFT;
+
+    if (xl < 0)
+	xl = 0;
+    if (yl < 0)
+	yl = 0;
+    if (xh >= bmapwidth)
+	xh = bmapwidth-1;
+    if (yh >= bmapheight)
+	yh = bmapheight-1;
+
+    for (bx=xl ; bx<=xh ; bx++)
+    {
+	for (by=yl ; by<=yh ; by++)
+	{
+	    for (list = blockmaplump+blockmap[by*bmapwidth+bx] ;
+		 *list != -1 ;
+		 list++)
+	    {
+		ld = &lines[*list];
+
+		if (bbox[BOXRIGHT] <= ld->bbox[BOXLEFT]
+		    || bbox[BOXLEFT] >= ld->bbox[BOXRIGHT]
+		    || bbox[BOXTOP] <= ld->bbox[BOXBOTTOM]
+		    || bbox[BOXBOTTOM] >= ld->bbox[BOXTOP] )
+		    continue;
+
+		if (P_BoxOnLineSide (bbox, ld) != -1)
+		    continue;
+
+		P_AddSecnode (ld->frontsector, thing);
+		if (ld->backsector)
+		    P_AddSecnode (ld->backsector, thing);
+	    }
+	}
+    }
+}
+
+
 //
 // P_UnsetThingPosition
 // Unlinks a thing from block map and sectors.
@@ -349,6 +577,11 @@ void P_UnsetThingPosition (mobj_t* thing)
     int		blockx;
     int		blocky;
 
+    // a predicted move stays out of the lists,
+    // so undoing it leaves them in the same order
+    if (predicting)
+	return;
+
     if ( ! (thing->flags & MF_NOSECTOR) )
     {
 	// inert things don't need to be in blockmap?
@@ -366,23 +599,19 @@ void P_UnsetThingPosition (mobj_t* thing)
     {
 	// inert things don't need to be in blockmap
 	// unlink from block map
-	if (thing->bnext)
-	    thing->bnext->bprev = thing->bprev;
-	
-	if (thing->bprev)
-	    thing->bprev->bnext = thing->bnext;
-	else
-	{
-	    blockx = (thing->x - bmaporgx)>>MAPBLOCKSHIFT;
-	    blocky = (thing->y - bmaporgy)>>MAPBLOCKSHIFT;
+	blockx = (thing->x - bmaporgx)>>MAPBLOCKSHIFT;
+	blocky = (thing->y - bmaporgy)>>MAPBLOCKSHIFT;
 
-	    if (blockx>=0 && blockx < bmapwidth
-		&& blocky>=0 && blocky <bmapheight)
-	    {
-		blocklinks[blocky*bmapwidth+blockx] = thing->bnext;
-	    }
+	if (blockx>=0 && blockx < bmapwidth
+	    && blocky>=0 && blocky <bmapheight)
+	{
+	    P_UnlinkFromBlock (&blockthings[blocky*bmapwidth+blockx], thing);
 	}
     }
+
+    // unlink from the sectors it touches
+    if (thing->touching_sectorlist)
+	P_DelSecnodes (thing);
 }
 
 
@@ -399,12 +628,14 @@ P_SetThingPosition (mobj_t* thing)
     sector_t*		sec;
     int			blockx;
     int			blocky;
-    mobj_t**		link;
 
     
     // link into subsector
     ss = R_PointInSubsector (thing->x,thing->y);
     thing->subsector = ss;
+
+    if (predicting)
+	return;
     
     if ( ! (thing->flags & MF_NOSECTOR) )
     {
@@ -428,24 +659,17 @@ P_SetThingPosition (mobj_t* thing)
 	blockx = (thing->x - bmaporgx)>>MAPBLOCKSHIFT;
 	blocky = (thing->y - bmaporgy)>>MAPBLOCKSHIFT;
 
+	// things off the map are not linked anywhere
 	if (blockx>=0
 	    && blockx < bmapwidth
 	    && blocky>=0
 	    && blocky < bmapheight)
 	{
-	    link = &blocklinks[blocky*bmapwidth+blockx];
-	    thing->bprev = NULL;
-	    thing->bnext = *link;
-	    if (*link)
-		(*link)->bprev = thing;
-
-	    *link = thing;
-	}
-	else
-	{
-	    // thing is off the map
-	    thing->bnext = thing->bprev = NULL;
+	    P_LinkToBlock (&blockthings[blocky*bmapwidth+blockx], thing);
 	}
+
+	// link into the sectors it touches
+	P_CreateSecnodes (thing);
     }
 }
 
@@ -475,7 +699,7 @@ P_BlockLinesIterator
   boolean(*func)(line_t*) )
 {
     int			offset;
-    short*		list;
+    int*		list;
     line_t*		ld;
 	
     if (x<0
@@ -506,6 +730,75 @@ P_BlockLinesIterator
 }
 
 
+//
+// P_BlockThingsIteratorRange
+// Calls func for the things in the block whose origin is
+// closer than their radius + range to cx,cy on both axes,
+// newest first, matching the old block link order.
+// Things outside the range are rejected from the packed
+// list without touching the mobj_t, so this can only be
+// used with PIT_* functions that ignore them anyway.
+// The func may unlink the thing it is given, or spawn new
+// things, without disturbing the rest of the walk.
+//
+boolean
+P_BlockThingsIteratorRange
+( int			x,
+  int			y,
+  fixed_t		cx,
+  fixed_t		cy,
+  fixed_t		range,
+  boolean(*func)(mobj_t*) )
+{
+    blockthings_t*	block;
+    blockthing_t*	bt;
+    mobj_t*		mobj;
+    fixed_t		dist;
+    int			i;
+	
+    if ( x<0
+	 || y<0
+	 || x>=bmapwidth
+	 || y>=bmapheight)
+    {
+	return true;
+    }
+
+    block = &blockthings[y*bmapwidth+x];
+
+    for (i=block->numthings-1 ; i>=0 ; i--)
+    {
+	// things below the current one may have been unlinked
+	if (i >= block->numthings)
+	    i = block->numthings-1;
+	if (i < 0)
+	    break;
+	
+	bt = &block->things[i];
+	dist = bt->radius + range;
+	
+	if ( abs(bt->x - cx) >= dist
+	     || abs(bt->y - cy) >= dist )
+	{
+	    continue;
+	}
+
+	mobj = bt->mobj;
+	if (!func( mobj ) )
+	    return false;
+
+	// an earlier thing was unlinked, so this one moved down
+	if (i > 0
+	    && i <= block->numthings
+	    && block->things[i-1].mobj == mobj)
+	{
+	    i--;
+	}
+    }
+    return true;
+}
+
+
 //
 // P_BlockThingsIterator
 //
@@ -515,7 +808,9 @@ P_BlockThingsIterator
   int			y,
   boolean(*func)(mobj_t*) )
 {
+    blockthings_t*	block;
     mobj_t*		mobj;
+    int			i;
 	
     if ( x<0
 	 || y<0
@@ -525,29 +820,258 @@ P_BlockThingsIterator
 	return true;
     }
     
+    block = &blockthings[y*bmapwidth+x];
 
-    for (mobj = blocklinks[y*bmapwidth+x] ;
-	 mobj ;
-	 mobj = mobj->bnext)
+    // same walk as P_BlockThingsIteratorRange, without the range
+    for (i=block->numthings-1 ; i>=0 ; i--)
     {
+	if (i >= block->numthings)
+	    i = block->numthings-1;
+	if (i < 0)
+	    break;
+
+	mobj = block->things[i].mobj;
 	if (!func( mobj ) )
 	    return false;
+
+	if (i > 0
+	    && i <= block->numthings
+	    && block->things[i-1].mobj == mobj)
+	{
+	    i--;
+	}
     }
     return true;
 }
 
 
 
+//
+// BATCHED THING QUERIES
+//
+mobj_t**	gatheredthings;
+int		numgathered;
+int		maxgathered;
+
+// query of each gathered thing, before they are grouped
+static int*	gatheredquery;
+
+
+//
+// P_AddGatheredThing
+//
+static void
+P_AddGatheredThing
+( mobj_t*	thing,
+  int		query )
+{
+    mobj_t**	newthings;
+    int*	newquery;
+
+    if (numgathered == maxgathered)
+    {
+	maxgathered = maxgathered ? maxgathered*2 : 256;
+	newthings = Z_Malloc (maxgathered*sizeof(*newthings), PU_STATIC, 0);
+	newquery = Z_Malloc (maxgathered*sizeof(*newquery), PU_STATIC, 0);
+	if (gatheredthings)
+	{
+	    memcpy (newthings, gatheredthings,
+		    numgathered*sizeof(*newthings));
+	    memcpy (newquery, gatheredquery,
+		    numgathered*sizeof(*newquery));
+	    Z_Free (gatheredthings);
+	    Z_Free (gatheredquery);
+	}
+	gatheredthings = newthings;
+	gatheredquery = newquery;
+    }
+
+    gatheredthings[numgathered] = thing;
+    gatheredquery[numgathered] = query;
+    numgathered++;
+}
+
+
+//
+// P_GatherThings
+// Returns the mark to release the lists with.
+// Queries may overlap, a thing is listed
+// for each query it is in range of.
+//
+int
+P_GatherThings
+( thingquery_t*	queries,
+  int		numqueries )
+{
+    int			mark;
+    int			q;
+    int			i;
+    int			x;
+    int			y;
+    int			xl;
+    int			xh;
+    int			yl;
+    int			yh;
+    int			count;
+    thingquery_t*	query;
+    blockthings_t*	block;
+    blockthing_t*	bt;
+    fixed_t		dist;
+    fixed_t		reach;
+
+    mark = numgathered;
+    
+    // union of the blocks of all queries
+    xl = yl = MAXINT;
+    xh = yh = MININT;
+    for (q=0, query=queries ; q<numqueries ; q++, query++)
+    {
+	reach = query->range + MAXRADIUS;
+	if ((query->x - reach - bmaporgx)>>MAPBLOCKSHIFT < xl)
+	    xl = (query->x - reach - bmaporgx)>>MAPBLOCKSHIFT;
+	if ((query->x + reach - bmaporgx)>>MAPBLOCKSHIFT > xh)
+	    xh = (query->x + reach - bmaporgx)>>MAPBLOCKSHIFT;
+	if ((query->y - reach - bmaporgy)>>MAPBLOCKSHIFT < yl)
+	    yl = (query->y - reach - bmaporgy)>>MAPBLOCKSHIFT;
+	if ((query->y + reach - bmaporgy)>>MAPBLOCKSHIFT > yh)
+	    yh = (query->y + reach - bmaporgy)>>MAPBLOCKSHIFT;
+    }
+
+    if (xl < 0)
+	xl = 0;
+    if (yl < 0)
+	yl = 0;
+    if (xh >= bmapwidth)
+	xh = bmapwidth-1;
+    if (yh >= bmapheight)
+	yh = bmapheight-1;
+
+    // Rows first, each block newest first,
+    // so every query sees its own blocks
+    // in the order it would have walked them.
+    for (y=yl ; y<=yh ; y++)
+    {
+	for (x=xl ; x<=xh ; x++)
+	{
+	    block = &blockthings[y*bmapwidth+x];
+	    if (!block->numthings)
+		continue;
+	    
+	    for (q=0, query=queries ; q<numqueries ; q++, query++)
+	    {
+		reach = query->range + MAXRADIUS;
+		if (x < (query->x - reach - bmaporgx)>>MAPBLOCKSHIFT
+		    || x > (query->x + reach - bmaporgx)>>MAPBLOCKSHIFT
+		    || y < (query->y - reach - bmaporgy)>>MAPBLOCKSHIFT
+		    || y > (query->y + reach - bmaporgy)>>MAPBLOCKSHIFT)
+		{
+		    continue;
+		}
+		
+		for (i=block->numthings-1 ; i>=0 ; i--)
+		{
+		    bt = &block->things[i];
+		    dist = bt->radius + query->range;
+		    
+		    if ( abs(bt->x - query->x) >= dist
+			 || abs(bt->y - query->y) >= dist )
+		    {
+			continue;
+		    }
+		    P_AddGatheredThing (bt->mobj, q);
+		}
+	    }
+	}
+    }
+
+    count = numgathered - mark;
+
+    if (numqueries == 1)
+    {
+	queries->firstthing = mark;
+	queries->numthings = count;
+	return mark;
+    }
+    
+    // Group the things by query, keeping their order.
+    // The space past the end of the lists is free
+    // to sort through.
+    for (i=0 ; i<count ; i++)
+	P_AddGatheredThing (gatheredthings[mark+i], gatheredquery[mark+i]);
+
+    numgathered = mark;
+    for (q=0, query=queries ; q<numqueries ; q++, query++)
+    {
+	query->firstthing = numgathered;
+	for (i=0 ; i<count ; i++)
+	{
+	    if (gatheredquery[mark+count+i] == q)
+		gatheredthings[numgathered++] = gatheredthings[mark+count+i];
+	}
+	query->numthings = numgathered - query->firstthing;
+    }
+
+    return mark;
+}
+
+
+//
+// P_ReleaseThings
+// Frees the lists gathered since the mark.
+//
+void P_ReleaseThings (int mark)
+{
+    numgathered = mark;
+}
+
+
+
 //
 // INTERCEPT ROUTINES
 //
-intercept_t	intercepts[MAXINTERCEPTS];
+intercept_t*	intercepts;
 intercept_t*	intercept_p;
+int		maxintercepts;
+
+// indexes into intercepts, as a heap by frac
+int*		interceptheap;
+
 
 divline_t 	trace;
 boolean 	earlyout;
 int		ptflags;
 
+//
+// P_CheckIntercepts
+// Makes room for one more intercept,
+// doubling the list when it is full.
+//
+static void P_CheckIntercepts (void)
+{
+    int			count;
+    intercept_t*	newintercepts;
+
+    count = intercept_p - intercepts;
+
+    if (count < maxintercepts)
+	return;
+
+    maxintercepts = maxintercepts ? maxintercepts*2 : MAXINTERCEPTS;
+    newintercepts = Z_Malloc (maxintercepts*sizeof(*newintercepts),
+			      PU_STATIC, 0);
+    if (intercepts)
+    {
+	memcpy (newintercepts, intercepts, count*sizeof(*newintercepts));
+	Z_Free (intercepts);
+	Z_Free (interceptheap);
+    }
+    interceptheap = Z_Malloc (maxintercepts*sizeof(*interceptheap),
+			      PU_STATIC, 0);
+    intercepts = newintercepts;
+    intercept_p = intercepts + count;
+}
+
+
 //
 // PIT_AddLineIntercepts.
 // Looks for lines in the given block
@@ -600,6 +1124,7 @@ PIT_AddLineIntercepts (line_t* ld)
     }
     
 	
+    P_CheckIntercepts ();
     intercept_p->frac = frac;
     intercept_p->isaline = true;
     intercept_p->d.line = ld;
@@ -665,6 +1190,7 @@ boolean PIT_AddThingIntercepts (mobj_t* thing)
     if (frac < 0)
 	return true;		// behind source
 
+    P_CheckIntercepts ();
     intercept_p->frac = frac;
     intercept_p->isaline = false;
     intercept_p->d.thing = thing;
@@ -674,10 +1200,56 @@ boolean PIT_AddThingIntercepts (mobj_t* thing)
 }
 
 
+//
+// P_InterceptBefore
+// Heap order: nearest first, and the one
+// added first when two are equally near.
+//
+#define P_InterceptBefore(a,b) \
+    (intercepts[a].frac < intercepts[b].frac \
+     || (intercepts[a].frac == intercepts[b].frac && (a) < (b)))
+
+
+//
+// P_SiftIntercept
+// Moves the heap entry at i down to its place.
+//
+static void
+P_SiftIntercept
+( int		i,
+  int		count )
+{
+    int		child;
+    int		in;
+
+    in = interceptheap[i];
+    
+    while ((child = i*2+1) < count)
+    {
+	if (child+1 < count
+	    && P_InterceptBefore (interceptheap[child+1], interceptheap[child]))
+	{
+	    child++;
+	}
+	
+	if (!P_InterceptBefore (interceptheap[child], in))
+	    break;
+
+	interceptheap[i] = interceptheap[child];
+	i = child;
+    }
+    interceptheap[i] = in;
+}
+
+
 //
 // P_TraverseIntercepts
 // Returns true if the traverser function returns true
 // for all lines.
+// The intercepts are handed out nearest first, ties in
+// the order they were added, as the old repeated scan
+// for the smallest frac did. A heap keeps that cheap when
+// the traverser stops early, which most of them do.
 // 
 boolean
 P_TraverseIntercepts
@@ -685,45 +1257,30 @@ P_TraverseIntercepts
   fixed_t	maxfrac )
 {
     int			count;
-    fixed_t		dist;
-    intercept_t*	scan;
+    int			i;
     intercept_t*	in;
 	
     count = intercept_p - intercepts;
+
+    for (i=0 ; i<count ; i++)
+	interceptheap[i] = i;
     
-    in = 0;			// shut up compiler warning
+    for (i=count/2-1 ; i>=0 ; i--)
+	P_SiftIntercept (i, count);
 	
-    while (count--)
+    while (count)
     {
-	dist = MAXINT;
-	for (scan = intercepts ; scan<intercept_p ; scan++)
-	{
-	    if (scan->frac < dist)
-	    {
-		dist = scan->frac;
-		in = scan;
-	    }
-	}
+	in = &intercepts[interceptheap[0]];
 	
-	if (dist > maxfrac)
+	// the old scan never picked a MAXINT frac
+	if (in->frac > maxfrac || in->frac == MAXINT)
 	    return true;	// checked everything in range		
 
-#if 0  // UNUSED
-    {
-	// don't check these yet, there may be others inserted
-	in = scan = intercepts;
-	for ( scan = intercepts ; scan<intercept_p ; scan++)
-	    if (scan->frac > maxfrac)
-		*in++ = *scan;
-	intercept_p = in;
-	return false;
-    }
-#endif
-
         if ( !func (in) )
 	    return false;	// don't bother going farther
 
-	in->frac = MAXINT;
+	interceptheap[0] = interceptheap[--count];
+	P_SiftIntercept (0, count);
     }
 	
     return true;		// everything was traversed
@@ -840,10 +1397,11 @@ P_PathTraverse
     // Step through map blocks.
     // Count is present to prevent a round off error
     // from skipping the break.
+    // It covers the same distance at any block size.
     mapx = xt1;
     mapy = yt1;
 	
-    for (count = 0 ; count < 64 ; count++)
+    for (count = 0 ; count < (64<<DEFAULTBLOCKBITS)>>mapblockbits ; count++)
     {
 	if (flags & PT_ADDLINES)
 	{
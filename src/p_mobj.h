@@ -73,7 +73,7 @@
 // The sound code uses the x,y, and subsector fields
 // to do stereo positioning of any sound effited by the mobj_t.
 //
-// The play simulation uses the blocklinks, x,y,z, radius, height
+// The play simulation uses the blockthings, x,y,z, radius, height
 // to determine when mobj_ts are touching each other,
 // touching lines in the map, or hit by trace lines (gunshots,
 // lines of sight, etc).
@@ -91,7 +91,7 @@
 // in the play world (block movement, be shot, etc) will also
 // need to be linked into the blockmap.
 // If the thing has the MF_NOBLOCK flag set, it will not use
-// the block links. It can still interact with other things,
+// the block lists. It can still interact with other things,
 // but only as the instigator (missiles will run into other
 // things, but nothing can run into a missile).
 // Each block in the grid is 128*128 units, and knows about
@@ -124,7 +124,7 @@ typedef enum
     MF_SHOOTABLE	= 4,
     // Don't use the sector links (invisible but touchable).
     MF_NOSECTOR		= 8,
-    // Don't use the blocklinks (inert but displayable)
+    // Don't use the blockthings (inert but displayable)
     MF_NOBLOCKMAP	= 16,                    
 
     // Not to be activated by sound, deaf monster.
@@ -223,13 +223,11 @@ typedef struct mobj_s
     spritenum_t		sprite;	// used to find patch_t and flip value
     int			frame;	// might be ORed with FF_FULLBRIGHT
 
-    // Interaction info, by BLOCKMAP.
-    // Links in blocks (if needed).
-    struct mobj_s*	bnext;
-    struct mobj_s*	bprev;
-    
     struct subsector_s*	subsector;
 
+    // Sectors touched by the thing's box (if in blockmap).
+    struct msecnode_s*	touching_sectorlist;
+
     // The closest interval over all contacted Sectors.
     fixed_t		floorz;
     fixed_t		ceilingz;
@@ -25,11 +25,14 @@
 static const char
 rcsid[] = "$Id: p_pspr.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
+#include <stdlib.h>
+
 #include "doomdef.h"
 #include "d_event.h"
 
 
 #include "m_random.h"
+#include "i_system.h"
 #include "p_local.h"
 #include "s_sound.h"
 
@@ -774,6 +777,99 @@ void A_Light2 (player_t *player, pspdef_t *psp)
 }
 
 
+//
+// P_BFGSprayAngles
+// Marks which of the 40 spray angles could hit
+// a shootable thing, from one batched query
+// around the player instead of 40 traces.
+// The traces can't find anything else,
+// so the other angles can be skipped.
+//
+void
+P_BFGSprayAngles
+( mobj_t*	mo,
+  boolean*	hit )
+{
+    thingquery_t	query;
+    mobj_t*		source;
+    mobj_t*		th;
+    int			mark;
+    int			i;
+    int			j;
+    int			mindelta;
+    int			maxdelta;
+    int			delta;
+    fixed_t		near;
+    fixed_t		x;
+    fixed_t		y;
+    angle_t		center;
+    angle_t		an;
+
+    source = mo->target;
+
+    // A trace reaches 16*64 units, and hits things by
+    // the diagonal of their box, which sticks out up to
+    // radius*sqrt(2). The extra 64 covers that up to the
+    // spider's radius.
+    query.x = source->x;
+    query.y = source->y;
+    query.range = 16*64*FRACUNIT + 64*FRACUNIT;
+    mark = P_GatherThings (&query, 1);
+    
+    memset (hit, 0, 40*sizeof(*hit));
+    
+    for (i=0 ; i<query.numthings ; i++)
+    {
+	th = gatheredthings[query.firstthing+i];
+
+	// Things only stop being shootable during the spray,
+	// so anything not shootable now can't be hit.
+	if (th == source || !(th->flags & MF_SHOOTABLE))
+	    continue;
+
+	// Too close for the angles to be trusted,
+	// the trace start is nudged off block edges.
+	near = th->radius + 64*FRACUNIT;
+	if (abs(th->x - source->x) < near
+	    && abs(th->y - source->y) < near)
+	{
+	    for (j=0 ; j<40 ; j++)
+		hit[j] = true;
+	    break;
+	}
+
+	// angular extent of the box,
+	// around the angle to its center
+	center = R_PointToAngle2 (source->x, source->y, th->x, th->y);
+	mindelta = maxdelta = 0;
+	for (j=0 ; j<4 ; j++)
+	{
+	    x = th->x + ((j&1) ? th->radius : -th->radius);
+	    y = th->y + ((j&2) ? th->radius : -th->radius);
+	    delta = (int)(R_PointToAngle2 (source->x, source->y, x, y) - center);
+	    if (delta < mindelta)
+		mindelta = delta;
+	    if (delta > maxdelta)
+		maxdelta = delta;
+	}
+
+	// slack for the fine angle and table rounding
+	mindelta -= ANG45/45*2;
+	maxdelta += ANG45/45*2;
+	
+	for (j=0 ; j<40 ; j++)
+	{
+	    an = mo->angle - ANG90/2 + ANG90/40*j;
+	    delta = (int)(an - center);
+	    if (delta >= mindelta && delta <= maxdelta)
+		hit[j] = true;
+	}
+    }
+
+    P_ReleaseThings (mark);
+}
+
+
 //
 // A_BFGSpray
 // Spawn a BFG explosion on every monster in view
@@ -784,10 +880,26 @@ void A_BFGSpray (mobj_t* mo)
     int			j;
     int			damage;
     angle_t		an;
+    boolean		hit[40];
+    long long		start = 0;
+
+    if (blastbench)
+	start = I_GetTimeUS ();
+
+    if (batchqueries)
+	P_BFGSprayAngles (mo, hit);
+    else
+	memset (hit, 1, sizeof(hit));
 	
     // offset angles from its attack angle
     for (i=0 ; i<40 ; i++)
     {
+	if (!hit[i])
+	{
+	    linetarget = NULL;
+	    continue;
+	}
+	
 	an = mo->angle - ANG90/2 + ANG90/40*i;
 
 	// mo->target is the originator (player)
@@ -808,6 +920,12 @@ void A_BFGSpray (mobj_t* mo)
 
 	P_DamageMobj (linetarget, mo->target,mo->target, damage);
     }
+
+    if (blastbench)
+    {
+	benchsprays++;
+	benchspraytime += I_GetTimeUS () - start;
+    }
 }
 
 
@@ -24,11 +24,16 @@
 static const char
 rcsid[] = "$Id: p_tick.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "i_system.h"
 #include "z_zone.h"
 #include "p_local.h"
+#include "p_saveg.h"
+#include "s_sound.h"
 
 // State.
 #include "doomstat.h"
@@ -303,6 +308,7 @@ void P_UnArchiveThinkers (void)
 	    save_p += sizeof(*mobj);
 	    mobj->state = &states[(int)mobj->state];
 	    mobj->target = NULL;
+	    mobj->touching_sectorlist = NULL;
 	    if (mobj->player)
 	    {
 		mobj->player = &players[(int)mobj->player-1];
@@ -586,3 +592,769 @@ void P_UnArchiveSpecials (void)
 
 }
 
+
+
+//
+// P_SnapshotPlayer
+// Unlike the archives, a snapshot copies the player and
+// its mobj as they are, pointers and all. It goes back
+// into the same level a frame later, where the archive
+// fixups would lose targets and relink things in a new
+// order, and put the game out of sync.
+//
+extern int	prndindex;
+
+void
+P_SnapshotPlayer
+( player_t*	player,
+  playersnap_t*	snap )
+{
+    snap->playernum = player - players;
+    snap->player = *player;
+    snap->mo = *player->mo;
+    snap->rndindex = rndindex;
+    snap->prndindex = prndindex;
+}
+
+
+//
+// P_RestorePlayer
+//
+void P_RestorePlayer (playersnap_t* snap)
+{
+    player_t*	player;
+
+    player = &players[snap->playernum];
+    *player = snap->player;
+    *player->mo = snap->mo;
+    rndindex = snap->rndindex;
+    prndindex = snap->prndindex;
+}
+
+
+
+//
+// DEMO SNAPSHOTS
+// A snapshot keeps the whole level as it is, for seeking
+// in demos.  The archives above round heights, drop the
+// targets, and relink things in a new order, so a demo
+// played on from them goes out of sync.  A snapshot is
+// only read back by the program that took it, so pointers
+// to states, info and players are kept as they are, and
+// only what goes with the level is numbered.
+//
+extern mobj_t*		braintargets[32];
+extern int		numbraintargets;
+extern int		braintargeton;
+extern int		braineasy;
+extern mobj_t*		bodyque[BODYQUESIZE];
+extern int		bodyqueslot;
+
+// The kinds of thinker, by think function.
+typedef struct
+{
+    actionf_p1	function;
+    int		size;
+    int		sectoroffset;	// of the sector_t*, -1 for none
+    
+} snapclass_t;
+
+static snapclass_t	snapclasses[] =
+{
+    {(actionf_p1)P_MobjThinker, sizeof(mobj_t), -1},
+    {(actionf_p1)T_MoveCeiling, sizeof(ceiling_t), offsetof(ceiling_t,sector)},
+    {(actionf_p1)T_VerticalDoor, sizeof(vldoor_t), offsetof(vldoor_t,sector)},
+    {(actionf_p1)T_MoveFloor, sizeof(floormove_t), offsetof(floormove_t,sector)},
+    {(actionf_p1)T_PlatRaise, sizeof(plat_t), offsetof(plat_t,sector)},
+    {(actionf_p1)T_LightFlash, sizeof(lightflash_t), offsetof(lightflash_t,sector)},
+    {(actionf_p1)T_StrobeFlash, sizeof(strobe_t), offsetof(strobe_t,sector)},
+    {(actionf_p1)T_Glow, sizeof(glow_t), offsetof(glow_t,sector)},
+    {(actionf_p1)T_FireFlicker, sizeof(fireflicker_t), offsetof(fireflicker_t,sector)}
+};
+
+#define NUMSNAPCLASSES	(sizeof(snapclasses)/sizeof(*snapclasses))
+#define SC_MOBJ		0
+#define SC_CEILING	1
+#define SC_PLAT		4
+
+// The changing parts of the map.
+typedef struct
+{
+    fixed_t	floorheight;
+    fixed_t	ceilingheight;
+    short	floorpic;
+    short	ceilingpic;
+    short	lightlevel;
+    short	special;
+    short	tag;
+    int		soundtraversed;
+    int		soundtarget;
+    int		specialdata;
+    
+} snapsector_t;
+
+typedef struct
+{
+    short	flags;
+    short	special;
+    short	tag;
+    
+} snapline_t;
+
+typedef struct
+{
+    fixed_t	textureoffset;
+    fixed_t	rowoffset;
+    short	toptexture;
+    short	bottomtexture;
+    short	midtexture;
+    
+} snapside_t;
+
+// Grows as needed, the snapshot is copied out of it.
+static byte*		snapbuffer;
+static int		snapbuffersize;
+
+// Thinker numbers start from 1, 0 is none.
+static thinker_t**	snapthinkers;
+static int		numsnapthinkers;
+static int		maxsnapthinkers;
+
+
+//
+// P_SnapReserve
+// Makes room for size more bytes at save_p.
+//
+static void P_SnapReserve (int size)
+{
+    int		used;
+
+    used = save_p - snapbuffer;
+    size += used + 4;		// and the padding
+    if (size <= snapbuffersize)
+	return;
+
+    while (snapbuffersize < size)
+	snapbuffersize = snapbuffersize ? snapbuffersize*2 : 0x40000;
+    snapbuffer = realloc (snapbuffer, snapbuffersize);
+    if (!snapbuffer)
+	I_Error ("P_SnapReserve: no memory for %i bytes", snapbuffersize);
+    save_p = snapbuffer + used;
+}
+
+
+static void P_SnapWrite (void* data, int size)
+{
+    P_SnapReserve (size);
+    PADSAVEP();
+    memcpy (save_p, data, size);
+    save_p += size;
+}
+
+static void P_SnapRead (void* data, int size)
+{
+    PADSAVEP();
+    memcpy (data, save_p, size);
+    save_p += size;
+}
+
+static void P_SnapInt (int value)
+{
+    P_SnapWrite (&value, sizeof(value));
+}
+
+static int P_SnapGetInt (void)
+{
+    int		value;
+
+    P_SnapRead (&value, sizeof(value));
+    return value;
+}
+
+
+//
+// P_SnapAddThinker
+// Gives th the next number.
+//
+static void P_SnapAddThinker (thinker_t* th)
+{
+    if (numsnapthinkers == maxsnapthinkers)
+    {
+	maxsnapthinkers = maxsnapthinkers ? maxsnapthinkers*2 : 1024;
+	snapthinkers = realloc (snapthinkers,
+				maxsnapthinkers*sizeof(*snapthinkers));
+	if (!snapthinkers)
+	    I_Error ("P_SnapAddThinker: no memory for %i thinkers",
+		     maxsnapthinkers);
+    }
+    snapthinkers[numsnapthinkers++] = th;
+}
+
+
+//
+// P_SnapNumber
+// While archiving, every thinker has its number in its
+// prev link.  Pointers to thinkers that were already
+// freed come out as 0, the game treats those like
+// a dead target.
+//
+static int P_SnapNumber (void* ptr)
+{
+    thinker_t*	th;
+    intptr_t	n;
+
+    th = ptr;
+    if (!th)
+	return 0;
+    n = (intptr_t)th->prev;
+    if (n < 1 || n > numsnapthinkers || snapthinkers[n-1] != th)
+	return 0;
+    return n;
+}
+
+
+//
+// P_SnapThinker
+// The thinker with number n, or NULL.
+//
+static void* P_SnapThinker (int n)
+{
+    if (n < 1 || n > numsnapthinkers)
+	return NULL;
+    return snapthinkers[n-1];
+}
+
+
+//
+// P_SnapClass
+//
+static int P_SnapClass (thinker_t* th)
+{
+    int		i;
+
+    for (i=0 ; i<NUMSNAPCLASSES ; i++)
+	if (th->function.acp1 == snapclasses[i].function)
+	    return i;
+
+    // in stasis
+    if (!th->function.acp1)
+    {
+	for (i=0 ; i<MAXCEILINGS ; i++)
+	    if (activeceilings[i] == (ceiling_t *)th)
+		return SC_CEILING;
+	for (i=0 ; i<MAXPLATS ; i++)
+	    if (activeplats[i] == (plat_t *)th)
+		return SC_PLAT;
+    }
+    
+    I_Error ("P_SnapClass: unknown thinker");
+    return 0;
+}
+
+
+//
+// P_SnapSecnode
+// Like P_GetSecnode.
+//
+static msecnode_t* P_SnapSecnode (void)
+{
+    msecnode_t*	node;
+
+    if (headsecnode)
+    {
+	node = headsecnode;
+	headsecnode = headsecnode->m_snext;
+    }
+    else
+	node = Z_Malloc (sizeof(*node), PU_LEVEL, 0);
+    return node;
+}
+
+
+//
+// P_ArchiveSnapshot
+// Returns the snapshot, from malloc.
+//
+byte* P_ArchiveSnapshot (int* length)
+{
+    thinker_t*		th;
+    thinker_t*		prev;
+    mobj_t*		mobj;
+    mobj_t		mocopy;
+    player_t		playercopy;
+    sector_t*		sec;
+    line_t*		li;
+    side_t*		si;
+    button_t*		button;
+    blockthings_t*	block;
+    blockthing_t	bt;
+    msecnode_t*		node;
+    snapsector_t	ss;
+    snapline_t		sl;
+    snapside_t		sd;
+    snapclass_t*	sc;
+    byte*		snapshot;
+    sector_t*		sector;
+    int			class;
+    int			n;
+    int			i;
+    int			j;
+
+    // number the thinkers, in their prev links for now
+    numsnapthinkers = 0;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	if (th->function.acv == (actionf_v)(-1))
+	{
+	    th->prev = NULL;	// freed on its next turn anyway
+	    continue;
+	}
+	P_SnapAddThinker (th);
+	th->prev = (thinker_t *)(intptr_t)numsnapthinkers;
+    }
+
+    save_p = snapbuffer;
+
+    P_SnapInt (leveltime);
+    P_SnapInt (totalkills);
+    P_SnapInt (totalitems);
+    P_SnapInt (totalsecret);
+    P_SnapInt (respawnmonsters);
+    P_SnapInt (levelTimer);
+    P_SnapInt (levelTimeCount);
+    P_SnapInt (paused);
+    P_SnapInt (rndindex);
+    P_SnapInt (prndindex);
+    P_SnapInt (braineasy);
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+	playercopy = players[i];
+	playercopy.mo = (mobj_t *)(intptr_t)P_SnapNumber (players[i].mo);
+	playercopy.attacker =
+	    (mobj_t *)(intptr_t)P_SnapNumber (players[i].attacker);
+	P_SnapWrite (&playercopy, sizeof(playercopy));
+    }
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	ss.floorheight = sec->floorheight;
+	ss.ceilingheight = sec->ceilingheight;
+	ss.floorpic = sec->floorpic;
+	ss.ceilingpic = sec->ceilingpic;
+	ss.lightlevel = sec->lightlevel;
+	ss.special = sec->special;
+	ss.tag = sec->tag;
+	ss.soundtraversed = sec->soundtraversed;
+	ss.soundtarget = P_SnapNumber (sec->soundtarget);
+	ss.specialdata = P_SnapNumber (sec->specialdata);
+	P_SnapWrite (&ss, sizeof(ss));
+    }
+
+    for (i=0, li=lines ; i<numlines ; i++, li++)
+    {
+	sl.flags = li->flags;
+	sl.special = li->special;
+	sl.tag = li->tag;
+	P_SnapWrite (&sl, sizeof(sl));
+    }
+
+    for (i=0, si=sides ; i<numsides ; i++, si++)
+    {
+	sd.textureoffset = si->textureoffset;
+	sd.rowoffset = si->rowoffset;
+	sd.toptexture = si->toptexture;
+	sd.bottomtexture = si->bottomtexture;
+	sd.midtexture = si->midtexture;
+	P_SnapWrite (&sd, sizeof(sd));
+    }
+
+    // the thinkers, in the order they run
+    for (n=0 ; n<numsnapthinkers ; n++)
+    {
+	th = snapthinkers[n];
+	class = P_SnapClass (th);
+	sc = &snapclasses[class];
+	P_SnapInt (class);
+
+	if (class == SC_MOBJ)
+	{
+	    mocopy = *(mobj_t *)th;
+	    mocopy.thinker.prev = mocopy.thinker.next = NULL;
+	    mocopy.snext = mocopy.sprev = NULL;
+	    mocopy.touching_sectorlist = NULL;
+	    mocopy.subsector =
+		(subsector_t *)(mocopy.subsector - subsectors);
+	    mocopy.target =
+		(mobj_t *)(intptr_t)P_SnapNumber (mocopy.target);
+	    mocopy.tracer =
+		(mobj_t *)(intptr_t)P_SnapNumber (mocopy.tracer);
+	    P_SnapWrite (&mocopy, sizeof(mocopy));
+	    continue;
+	}
+
+	P_SnapWrite (th, sc->size);
+	memset (save_p - sc->size, 0, offsetof(thinker_t,function));
+	memcpy (&sector, (byte *)th + sc->sectoroffset, sizeof(sector));
+	sector = (sector_t *)(sector - sectors);
+	memcpy (save_p - sc->size + sc->sectoroffset, &sector, sizeof(sector));
+    }
+    P_SnapInt (-1);
+
+    // what points into the thinkers
+    for (i=0 ; i<MAXCEILINGS ; i++)
+	P_SnapInt (P_SnapNumber (activeceilings[i]));
+    for (i=0 ; i<MAXPLATS ; i++)
+	P_SnapInt (P_SnapNumber (activeplats[i]));
+
+    for (i=0, button=buttonlist ; i<MAXBUTTONS ; i++, button++)
+    {
+	P_SnapInt (button->line ? button->line - lines + 1 : 0);
+	P_SnapInt (button->where);
+	P_SnapInt (button->btexture);
+	P_SnapInt (button->btimer);
+	P_SnapInt (button->soundorg ?
+		   (sector_t *)((byte *)button->soundorg
+				- offsetof(sector_t,soundorg)) - sectors + 1 :
+		   0);
+    }
+
+    P_SnapInt (iquehead);
+    P_SnapInt (iquetail);
+    P_SnapWrite (itemrespawnque, sizeof(itemrespawnque));
+    P_SnapWrite (itemrespawntime, sizeof(itemrespawntime));
+
+    P_SnapInt (numbraintargets);
+    P_SnapInt (braintargeton);
+    for (i=0 ; i<numbraintargets ; i++)
+	P_SnapInt (P_SnapNumber (braintargets[i]));
+
+    P_SnapInt (bodyqueslot);
+    for (i=0 ; i<BODYQUESIZE ; i++)
+	P_SnapInt (P_SnapNumber (bodyque[i]));
+
+    // the orders things are linked in
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	for (mobj = sec->thinglist ; mobj ; mobj = mobj->snext)
+	    P_SnapInt (P_SnapNumber (mobj));
+	P_SnapInt (0);
+    }
+
+    for (n=0 ; n<numsnapthinkers ; n++)
+    {
+	if (snapthinkers[n]->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mobj = (mobj_t *)snapthinkers[n];
+	for (node = mobj->touching_sectorlist ; node ; node = node->m_tnext)
+	    P_SnapInt (node->m_sector - sectors);
+	P_SnapInt (-1);
+    }
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	for (node = sec->touching_thinglist ; node ; node = node->m_snext)
+	    P_SnapInt (P_SnapNumber (node->m_thing));
+	P_SnapInt (0);
+    }
+
+    for (i=0, block=blockthings ; i<bmapwidth*bmapheight ; i++, block++)
+    {
+	P_SnapInt (block->numthings);
+	for (j=0 ; j<block->numthings ; j++)
+	{
+	    bt = block->things[j];
+	    bt.mobj = (mobj_t *)(intptr_t)P_SnapNumber (bt.mobj);
+	    P_SnapWrite (&bt, sizeof(bt));
+	}
+    }
+
+    // put the prev links back
+    prev = &thinkercap;
+    for (th = thinkercap.next ; th != &thinkercap ; th = th->next)
+    {
+	th->prev = prev;
+	prev = th;
+    }
+
+    *length = save_p - snapbuffer;
+    snapshot = malloc (*length);
+    if (!snapshot)
+	I_Error ("P_ArchiveSnapshot: no memory for %i bytes", *length);
+    memcpy (snapshot, snapbuffer, *length);
+    return snapshot;
+}
+
+
+//
+// P_UnArchiveSnapshot
+// Puts the level back as it was when the snapshot was
+// taken.  The map must be the same, already loaded.
+//
+void P_UnArchiveSnapshot (byte* snapshot)
+{
+    thinker_t*		th;
+    thinker_t*		next;
+    mobj_t*		mobj;
+    sector_t*		sec;
+    line_t*		li;
+    side_t*		si;
+    button_t*		button;
+    blockthings_t*	block;
+    blockthing_t*	newthings;
+    msecnode_t*		node;
+    msecnode_t*		snode;
+    msecnode_t*		tnode;
+    mobj_t*		prevmobj;
+    snapsector_t	ss;
+    snapline_t		sl;
+    snapside_t		sd;
+    snapclass_t*	sc;
+    sector_t*		sector;
+    int			class;
+    int			count;
+    int			n;
+    int			i;
+    int			j;
+
+    // take out everything that is linked or thinking now
+    for (th = thinkercap.next ; th != &thinkercap ; th = next)
+    {
+	next = th->next;
+	if (th->function.acp1 == (actionf_p1)P_MobjThinker)
+	{
+	    mobj = (mobj_t *)th;
+	    S_StopSound (mobj);
+	    while (mobj->touching_sectorlist)
+	    {
+		node = mobj->touching_sectorlist;
+		mobj->touching_sectorlist = node->m_tnext;
+		node->m_snext = headsecnode;
+		headsecnode = node;
+	    }
+	}
+	Z_Free (th);
+    }
+    P_InitThinkers ();
+
+    for (i=0, block=blockthings ; i<bmapwidth*bmapheight ; i++, block++)
+	block->numthings = 0;
+
+    save_p = snapshot;
+
+    leveltime = P_SnapGetInt ();
+    totalkills = P_SnapGetInt ();
+    totalitems = P_SnapGetInt ();
+    totalsecret = P_SnapGetInt ();
+    respawnmonsters = P_SnapGetInt ();
+    levelTimer = P_SnapGetInt ();
+    levelTimeCount = P_SnapGetInt ();
+    paused = P_SnapGetInt ();
+    rndindex = P_SnapGetInt ();
+    prndindex = P_SnapGetInt ();
+    braineasy = P_SnapGetInt ();
+
+    // the players and sectors get their pointers
+    // once the thinkers are back
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+	P_SnapRead (&players[i], sizeof(players[i]));
+    }
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	P_SnapRead (&ss, sizeof(ss));
+	sec->floorheight = ss.floorheight;
+	sec->ceilingheight = ss.ceilingheight;
+	sec->floorpic = ss.floorpic;
+	sec->ceilingpic = ss.ceilingpic;
+	sec->lightlevel = ss.lightlevel;
+	sec->special = ss.special;
+	sec->tag = ss.tag;
+	sec->soundtraversed = ss.soundtraversed;
+	sec->soundtarget = (mobj_t *)(intptr_t)ss.soundtarget;
+	sec->specialdata = (void *)(intptr_t)ss.specialdata;
+	sec->thinglist = NULL;
+	sec->touching_thinglist = NULL;
+    }
+
+    for (i=0, li=lines ; i<numlines ; i++, li++)
+    {
+	P_SnapRead (&sl, sizeof(sl));
+	li->flags = sl.flags;
+	li->special = sl.special;
+	li->tag = sl.tag;
+    }
+
+    for (i=0, si=sides ; i<numsides ; i++, si++)
+    {
+	P_SnapRead (&sd, sizeof(sd));
+	si->textureoffset = sd.textureoffset;
+	si->rowoffset = sd.rowoffset;
+	si->toptexture = sd.toptexture;
+	si->bottomtexture = sd.bottomtexture;
+	si->midtexture = sd.midtexture;
+    }
+
+    numsnapthinkers = 0;
+    while ( (class = P_SnapGetInt ()) != -1)
+    {
+	if (class < 0 || class >= NUMSNAPCLASSES)
+	    I_Error ("P_UnArchiveSnapshot: unknown class %i", class);
+	sc = &snapclasses[class];
+	
+	th = Z_Malloc (sc->size, PU_LEVEL, NULL);
+	P_SnapRead (th, sc->size);
+	P_SnapAddThinker (th);
+	P_AddThinker (th);
+
+	if (class == SC_MOBJ)
+	{
+	    mobj = (mobj_t *)th;
+	    mobj->subsector = &subsectors[(intptr_t)mobj->subsector];
+	    continue;
+	}
+	
+	memcpy (&sector, (byte *)th + sc->sectoroffset, sizeof(sector));
+	sector = &sectors[(intptr_t)sector];
+	memcpy ((byte *)th + sc->sectoroffset, &sector, sizeof(sector));
+    }
+
+    // now the numbers can become pointers
+    for (n=0 ; n<numsnapthinkers ; n++)
+    {
+	if (snapthinkers[n]->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mobj = (mobj_t *)snapthinkers[n];
+	mobj->target = P_SnapThinker ((intptr_t)mobj->target);
+	mobj->tracer = P_SnapThinker ((intptr_t)mobj->tracer);
+    }
+
+    for (i=0 ; i<MAXPLAYERS ; i++)
+    {
+	if (!playeringame[i])
+	    continue;
+	players[i].mo = P_SnapThinker ((intptr_t)players[i].mo);
+	players[i].attacker = P_SnapThinker ((intptr_t)players[i].attacker);
+    }
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	sec->soundtarget = P_SnapThinker ((intptr_t)sec->soundtarget);
+	sec->specialdata = P_SnapThinker ((intptr_t)sec->specialdata);
+    }
+
+    for (i=0 ; i<MAXCEILINGS ; i++)
+	activeceilings[i] = P_SnapThinker (P_SnapGetInt ());
+    for (i=0 ; i<MAXPLATS ; i++)
+	activeplats[i] = P_SnapThinker (P_SnapGetInt ());
+
+    for (i=0, button=buttonlist ; i<MAXBUTTONS ; i++, button++)
+    {
+	n = P_SnapGetInt ();
+	button->line = n ? &lines[n-1] : NULL;
+	button->where = P_SnapGetInt ();
+	button->btexture = P_SnapGetInt ();
+	button->btimer = P_SnapGetInt ();
+	n = P_SnapGetInt ();
+	button->soundorg = n ? (mobj_t *)&sectors[n-1].soundorg : NULL;
+    }
+
+    iquehead = P_SnapGetInt ();
+    iquetail = P_SnapGetInt ();
+    P_SnapRead (itemrespawnque, sizeof(itemrespawnque));
+    P_SnapRead (itemrespawntime, sizeof(itemrespawntime));
+
+    numbraintargets = P_SnapGetInt ();
+    braintargeton = P_SnapGetInt ();
+    for (i=0 ; i<numbraintargets ; i++)
+	braintargets[i] = P_SnapThinker (P_SnapGetInt ());
+
+    bodyqueslot = P_SnapGetInt ();
+    for (i=0 ; i<BODYQUESIZE ; i++)
+	bodyque[i] = P_SnapThinker (P_SnapGetInt ());
+
+    // link everything back in the same orders
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	prevmobj = NULL;
+	while ( (n = P_SnapGetInt ()) )
+	{
+	    mobj = P_SnapThinker (n);
+	    mobj->sprev = prevmobj;
+	    mobj->snext = NULL;
+	    if (prevmobj)
+		prevmobj->snext = mobj;
+	    else
+		sec->thinglist = mobj;
+	    prevmobj = mobj;
+	}
+    }
+
+    for (n=0 ; n<numsnapthinkers ; n++)
+    {
+	if (snapthinkers[n]->function.acp1 != (actionf_p1)P_MobjThinker)
+	    continue;
+	mobj = (mobj_t *)snapthinkers[n];
+	tnode = NULL;
+	while ( (j = P_SnapGetInt ()) != -1)
+	{
+	    node = P_SnapSecnode ();
+	    node->visited = true;
+	    node->m_sector = &sectors[j];
+	    node->m_thing = mobj;
+	    node->m_tprev = tnode;
+	    node->m_tnext = NULL;
+	    node->m_sprev = node->m_snext = NULL;
+	    if (tnode)
+		tnode->m_tnext = node;
+	    else
+		mobj->touching_sectorlist = node;
+	    tnode = node;
+	}
+    }
+
+    for (i=0, sec=sectors ; i<numsectors ; i++, sec++)
+    {
+	snode = NULL;
+	while ( (n = P_SnapGetInt ()) )
+	{
+	    mobj = P_SnapThinker (n);
+	    for (node = mobj->touching_sectorlist ; node ; node = node->m_tnext)
+		if (node->m_sector == sec)
+		    break;
+	    if (!node)
+		I_Error ("P_UnArchiveSnapshot: bad sector node");
+	    node->m_sprev = snode;
+	    if (snode)
+		snode->m_snext = node;
+	    else
+		sec->touching_thinglist = node;
+	    snode = node;
+	}
+    }
+
+    for (i=0, block=blockthings ; i<bmapwidth*bmapheight ; i++, block++)
+    {
+	count = P_SnapGetInt ();
+	if (count > block->maxthings)
+	{
+	    newthings = Z_Malloc (count*sizeof(*newthings), PU_LEVEL, 0);
+	    if (block->things)
+		Z_Free (block->things);
+	    block->things = newthings;
+	    block->maxthings = count;
+	}
+	for (j=0 ; j<count ; j++)
+	{
+	    P_SnapRead (&block->things[j], sizeof(block->things[j]));
+	    block->things[j].mobj =
+		P_SnapThinker ((intptr_t)block->things[j].mobj);
+	}
+	block->numthings = count;
+    }
+}
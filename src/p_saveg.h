@@ -24,6 +24,8 @@
 #define __P_SAVEG__
 
 
+#include "d_player.h"
+
 #ifdef __GNUG__
 #pragma interface
 #endif
@@ -43,6 +45,26 @@ void P_UnArchiveSpecials (void);
 extern byte*		save_p; 
 
 
+// Prediction snapshots, see P_SnapshotPlayer.
+typedef struct
+{
+    int		playernum;
+    player_t	player;
+    mobj_t	mo;
+    int		rndindex;
+    int		prndindex;
+    
+} playersnap_t;
+
+void P_SnapshotPlayer (player_t* player, playersnap_t* snap);
+void P_RestorePlayer (playersnap_t* snap);
+
+// Demo snapshots, the whole level in memory,
+// see P_ArchiveSnapshot.
+byte* P_ArchiveSnapshot (int* length);
+void P_UnArchiveSnapshot (byte* snapshot);
+
+
 #endif
 //-----------------------------------------------------------------------------
 //
@@ -27,11 +27,13 @@ rcsid[] = "$Id: p_setup.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
 
 #include <math.h>
+#include <stdlib.h>
 
 #include "z_zone.h"
 
 #include "m_swap.h"
 #include "m_bbox.h"
+#include "m_argv.h"
 
 #include "g_game.h"
 
@@ -85,14 +87,18 @@ side_t*		sides;
 // Blockmap size.
 int		bmapwidth;
 int		bmapheight;	// size in mapblocks
-short*		blockmap;	// int for larger maps
+int*		blockmap;
 // offsets in blockmap are from here
-short*		blockmaplump;		
+int*		blockmaplump;		
+// log2 of the mapblock size in map units
+int		mapblockbits = DEFAULTBLOCKBITS;
+// build the blockmap instead of using the lump
+boolean		genblockmap;
 // origin of block map
 fixed_t		bmaporgx;
 fixed_t		bmaporgy;
-// for thing chains
-mobj_t**	blocklinks;		
+// for thing lists
+blockthings_t*	blockthings;
 
 
 // REJECT
@@ -463,6 +469,132 @@ void P_LoadSideDefs (int lump)
 }
 
 
+//
+// P_CreateBlockMap
+// Builds the blockmap from the linedefs,
+// at the current mapblock size and with
+// 32 bit offsets, in the same layout as the lump.
+//
+void P_CreateBlockMap (void)
+{
+    int		i;
+    int		x;
+    int		y;
+    int		minx;
+    int		miny;
+    int		maxx;
+    int		maxy;
+    int		numblocks;
+    int		count;
+    int		pass;
+    int		xl;
+    int		xh;
+    int		yl;
+    int		yh;
+    int*	counts;
+    line_t*	ld;
+    fixed_t	bbox[4];
+    
+    minx = miny = MAXINT;
+    maxx = maxy = MININT;
+    for (i=0 ; i<numvertexes ; i++)
+    {
+	x = vertexes[i].x>>FRACBITS;
+	y = vertexes[i].y>>FRACBITS;
+	if (x < minx)
+	    minx = x;
+	if (x > maxx)
+	    maxx = x;
+	if (y < miny)
+	    miny = y;
+	if (y > maxy)
+	    maxy = y;
+    }
+
+    // same margin the node builders leave
+    bmaporgx = (minx-8)<<FRACBITS;
+    bmaporgy = (miny-8)<<FRACBITS;
+    bmapwidth = ((maxx-minx+8)>>mapblockbits) + 1;
+    bmapheight = ((maxy-miny+8)>>mapblockbits) + 1;
+    numblocks = bmapwidth*bmapheight;
+
+    counts = Z_Malloc (numblocks*sizeof(*counts), PU_STATIC, 0);
+    memset (counts, 0, numblocks*sizeof(*counts));
+
+    // The first pass counts the lines in each block,
+    // the second one writes them into the lists.
+    for (pass=0 ; pass<2 ; pass++)
+    {
+	if (pass == 1)
+	{
+	    // Every list starts with line 0 and ends with -1.
+	    // Node builders always started the lists with 0,
+	    // and the iterator has always checked it,
+	    // so keep it for the same behavior as the lump.
+	    count = 4 + numblocks;
+	    for (i=0 ; i<numblocks ; i++)
+		count += counts[i] + 2;
+
+	    blockmaplump = Z_Malloc (count*sizeof(*blockmaplump),
+				     PU_LEVEL, 0);
+	    blockmap = blockmaplump+4;
+	    blockmaplump[0] = minx-8;
+	    blockmaplump[1] = miny-8;
+	    blockmaplump[2] = bmapwidth;
+	    blockmaplump[3] = bmapheight;
+
+	    // lay the lists out one after another,
+	    // and turn each count into the write position
+	    count = 4 + numblocks;
+	    for (i=0 ; i<numblocks ; i++)
+	    {
+		blockmap[i] = count;
+		blockmaplump[count] = 0;
+		blockmaplump[count+counts[i]+1] = -1;
+		count += counts[i] + 2;
+		counts[i] = blockmap[i]+1;
+	    }
+	}
+	
+	ld = lines;
+	for (i=0 ; i<numlines ; i++, ld++)
+	{
+	    xl = (ld->bbox[BOXLEFT]-bmaporgx)>>MAPBLOCKSHIFT;
+	    xh = (ld->bbox[BOXRIGHT]-bmaporgx)>>MAPBLOCKSHIFT;
+	    yl = (ld->bbox[BOXBOTTOM]-bmaporgy)>>MAPBLOCKSHIFT;
+	    yh = (ld->bbox[BOXTOP]-bmaporgy)>>MAPBLOCKSHIFT;
+
+	    for (y=yl ; y<=yh ; y++)
+	    {
+		for (x=xl ; x<=xh ; x++)
+		{
+		    // diagonal lines only cross
+		    // some blocks of their bounding box
+		    if (ld->slopetype == ST_POSITIVE
+			|| ld->slopetype == ST_NEGATIVE)
+		    {
+			bbox[BOXLEFT] = bmaporgx + (x<<MAPBLOCKSHIFT);
+			bbox[BOXRIGHT] = bbox[BOXLEFT] + MAPBLOCKSIZE;
+			bbox[BOXBOTTOM] = bmaporgy + (y<<MAPBLOCKSHIFT);
+			bbox[BOXTOP] = bbox[BOXBOTTOM] + MAPBLOCKSIZE;
+
+			if (P_BoxOnLineSide (bbox, ld) != -1)
+			    continue;
+		    }
+
+		    if (pass == 0)
+			counts[y*bmapwidth+x]++;
+		    else
+			blockmaplump[counts[y*bmapwidth+x]++] = i;
+		}
+	    }
+	}
+    }
+
+    Z_Free (counts);
+}
+
+
 //
 // P_LoadBlockMap
 //
@@ -470,23 +602,46 @@ void P_LoadBlockMap (int lump)
 {
     int		i;
     int		count;
+    short*	data;
 	
-    blockmaplump = W_CacheLumpNum (lump,PU_LEVEL);
-    blockmap = blockmaplump+4;
     count = W_LumpLength (lump)/2;
 
-    for (i=0 ; i<count ; i++)
-	blockmaplump[i] = SHORT(blockmaplump[i]);
-		
-    bmaporgx = blockmaplump[0]<<FRACBITS;
-    bmaporgy = blockmaplump[1]<<FRACBITS;
-    bmapwidth = blockmaplump[2];
-    bmapheight = blockmaplump[3];
-	
-    // clear out mobj chains
-    count = sizeof(*blocklinks)* bmapwidth*bmapheight;
-    blocklinks = Z_Malloc (count,PU_LEVEL, 0);
-    memset (blocklinks, 0, count);
+    // Use the lump unless asked not to,
+    // or the map is too big for 16 bit offsets.
+    if (genblockmap
+	|| count < 4
+	|| count > 0x10000)
+    {
+	P_CreateBlockMap ();
+    }
+    else
+    {
+	data = W_CacheLumpNum (lump,PU_STATIC);
+	blockmaplump = Z_Malloc (count*sizeof(*blockmaplump),PU_LEVEL, 0);
+	blockmap = blockmaplump+4;
+
+	// The header is signed, the offsets
+	// and line numbers are unsigned.
+	for (i=0 ; i<4 ; i++)
+	    blockmaplump[i] = SHORT(data[i]);
+	for ( ; i<count ; i++)
+	{
+	    blockmaplump[i] = (unsigned short)SHORT(data[i]);
+	    if (blockmaplump[i] == 0xffff)
+		blockmaplump[i] = -1;
+	}
+	Z_Free (data);
+	
+	bmaporgx = blockmaplump[0]<<FRACBITS;
+	bmaporgy = blockmaplump[1]<<FRACBITS;
+	bmapwidth = blockmaplump[2];
+	bmapheight = blockmaplump[3];
+    }
+	
+    // clear out mobj lists
+    count = sizeof(*blockthings)* bmapwidth*bmapheight;
+    blockthings = Z_Malloc (count,PU_LEVEL, 0);
+    memset (blockthings, 0, count);
 }
 
 
@@ -617,6 +772,8 @@ P_SetupLevel
 #endif
 	Z_FreeTags (PU_LEVEL, PU_PURGELEVEL-1);
 
+    // the free sector nodes went with the level
+    headsecnode = NULL;
 
     // UNUSED W_Profile ();
     P_InitThinkers ();
@@ -646,12 +803,13 @@ P_SetupLevel
     leveltime = 0;
 	
     // note: most of this ordering is important	
-    P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
     P_LoadVertexes (lumpnum+ML_VERTEXES);
     P_LoadSectors (lumpnum+ML_SECTORS);
     P_LoadSideDefs (lumpnum+ML_SIDEDEFS);
 
     P_LoadLineDefs (lumpnum+ML_LINEDEFS);
+    // after the lines, in case it has to be built
+    P_LoadBlockMap (lumpnum+ML_BLOCKMAP);
     P_LoadSubsectors (lumpnum+ML_SSECTORS);
     P_LoadNodes (lumpnum+ML_NODES);
     P_LoadSegs (lumpnum+ML_SEGS);
@@ -699,6 +857,38 @@ P_SetupLevel
 //
 void P_Init (void)
 {
+    int		p;
+    int		units;
+    
+    // -blocksize <units>
+    p = M_CheckParm ("-blocksize");
+    if (p && p < myargc-1)
+    {
+	units = atoi (myargv[p+1]);
+	for (mapblockbits=MINBLOCKBITS ;
+	     mapblockbits<=MAXBLOCKBITS ;
+	     mapblockbits++)
+	{
+	    if (units == 1<<mapblockbits)
+		break;
+	}
+	if (mapblockbits > MAXBLOCKBITS)
+	    I_Error ("P_Init: -blocksize must be a power of two from %i to %i",
+		     1<<MINBLOCKBITS, 1<<MAXBLOCKBITS);
+	genblockmap = true;
+    }
+    
+    if (M_CheckParm ("-genblockmap"))
+	genblockmap = true;
+
+    if (genblockmap)
+	printf ("P_Init: building blockmaps with %i unit blocks\n",
+		MAPBLOCKUNITS);
+
+    if (M_CheckParm ("-nobatch"))
+	batchqueries = false;
+    blastbench = M_CheckParm ("-blastbench");
+	
     P_InitSwitchList ();
     P_InitPicAnims ();
     R_InitSprites (sprnames);
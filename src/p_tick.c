@@ -26,7 +26,10 @@ static const char
 rcsid[] = "$Id: p_tick.c,v 1.4 1997/02/03 16:47:55 b1 Exp $";
 
 #include "z_zone.h"
+#include "i_system.h"
+#include "m_trace.h"
 #include "p_local.h"
+#include "p_chksum.h"
 
 #include "doomstat.h"
 
@@ -116,6 +119,12 @@ void P_RunThinkers (void)
 	{
 	    if (currentthinker->function.acp1)
 		currentthinker->function.acp1 (currentthinker);
+
+	    // hashed while it is still in the cache
+	    if (checksumming
+		&& currentthinker->function.acp1
+		   == (actionf_p1)P_MobjThinker)
+		P_ChecksumMobj ((mobj_t *)currentthinker);
 	}
 	currentthinker = currentthinker->next;
     }
@@ -130,6 +139,7 @@ void P_RunThinkers (void)
 void P_Ticker (void)
 {
     int		i;
+    long long	start = 0;
     
     // run the tic
     if (paused)
@@ -144,15 +154,32 @@ void P_Ticker (void)
 	return;
     }
     
+
+    if (blastbench)
+	start = I_GetTimeUS ();
+
+    if (checksumming)
+	P_ChecksumBegin ();
 		
     for (i=0 ; i<MAXPLAYERS ; i++)
 	if (playeringame[i])
 	    P_PlayerThink (&players[i]);
 			
+    TRACE_BEGIN ("P_RunThinkers");
     P_RunThinkers ();
+    TRACE_END ();
     P_UpdateSpecials ();
     P_RespawnSpecials ();
 
+    if (blastbench)
+    {
+	benchtics++;
+	benchtictime += I_GetTimeUS () - start;
+    }
+
     // for par times
     leveltime++;	
+
+    if (checksumming)
+	P_ChecksumEnd ();
 }
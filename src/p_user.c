@@ -271,7 +271,7 @@ void P_PlayerThink (player_t* player)
     
     P_CalcHeight (player);
 
-    if (player->mo->subsector->sector->special)
+    if (player->mo->subsector->sector->special && !predicting)
 	P_PlayerInSpecialSector (player);
     
     // Check for weapon change.
@@ -330,8 +330,10 @@ void P_PlayerThink (player_t* player)
     else
 	player->usedown = false;
     
-    // cycle psprites
-    P_MovePsprites (player);
+    // cycle psprites, unless only predicting,
+    // the weapon actions act on the world
+    if (!predicting)
+	P_MovePsprites (player);
     
     // Counters, time dependend power ups.
 
@@ -384,3 +386,25 @@ void P_PlayerThink (player_t* player)
 }
 
 
+//
+// P_PredictPlayer
+// Runs the player one tic ahead of the game, for the
+// display only. Buttons that act on the world are left
+// out, and the rest of it is kept as it was by the
+// checks of predicting, see G_Predict.
+//
+void
+P_PredictPlayer
+( player_t*	player,
+  ticcmd_t*	cmd )
+{
+    player->cmd = *cmd;
+    if (player->cmd.buttons & BT_SPECIAL)
+	player->cmd.buttons = 0;
+    player->cmd.buttons &= ~(BT_ATTACK|BT_USE);
+    
+    P_PlayerThink (player);
+    P_MobjThinker (player->mo);
+}
+
+
@@ -126,6 +126,9 @@ typedef	struct
     // list of mobjs in sector
     mobj_t*	thinglist;
 
+    // list of mobjs touching the sector
+    struct msecnode_s*	touching_thinglist;
+
     // thinker_t for reversable actions
     void*	specialdata;
 
@@ -136,6 +139,25 @@ typedef	struct
 
 
 
+//
+// A thing touching a sector.
+// Each node is on two lists, the sectors a thing touches
+// and the things touching a sector, so moving sectors
+// only have to look at the things they can affect.
+//
+typedef struct msecnode_s
+{
+    sector_t*		m_sector;	// a sector containing this object
+    struct mobj_s*	m_thing;	// this object
+    struct msecnode_s*	m_tprev;	// prev msecnode_t for this thing
+    struct msecnode_s*	m_tnext;	// next msecnode_t for this thing
+    struct msecnode_s*	m_sprev;	// prev msecnode_t for this sector
+    struct msecnode_s*	m_snext;	// next msecnode_t for this sector
+    boolean		visited;	// used in P_ChangeSector
+    
+} msecnode_t;
+
+
 
 //
 // The SideDef.
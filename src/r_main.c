@@ -34,8 +34,11 @@ static const char rcsid[] = "$Id: r_main.c,v 1.5 1997/02/03 22:45:12 b1 Exp $";
 
 #include "doomdef.h"
 #include "d_net.h"
+#include "i_system.h"
 
 #include "m_bbox.h"
+#include "m_bench.h"
+#include "m_trace.h"
 
 #include "r_local.h"
 #include "r_sky.h"
@@ -869,6 +872,8 @@ void R_SetupFrame (player_t* player)
 //
 void R_RenderPlayerView (player_t* player)
 {	
+    long long	start = 0;
+    
     R_SetupFrame (player);
 
     // Clear buffers.
@@ -881,17 +886,35 @@ void R_RenderPlayerView (player_t* player)
     NetUpdate ();
 
     // The head node is the last node output.
+    if (benchdemo)
+	start = I_GetTimeUS ();
+    TRACE_BEGIN ("R_RenderBSPNode");
     R_RenderBSPNode (numnodes-1);
+    TRACE_END ();
+    if (benchdemo)
+	benchtime[bench_bsp] += I_GetTimeUS () - start;
     
     // Check for new console commands.
     NetUpdate ();
     
+    if (benchdemo)
+	start = I_GetTimeUS ();
+    TRACE_BEGIN ("R_DrawPlanes");
     R_DrawPlanes ();
+    TRACE_END ();
+    if (benchdemo)
+	benchtime[bench_planes] += I_GetTimeUS () - start;
     
     // Check for new console commands.
     NetUpdate ();
     
+    if (benchdemo)
+	start = I_GetTimeUS ();
+    TRACE_BEGIN ("R_DrawMasked");
     R_DrawMasked ();
+    TRACE_END ();
+    if (benchdemo)
+	benchtime[bench_masked] += I_GetTimeUS () - start;
 
     // Check for new console commands.
     NetUpdate ();				
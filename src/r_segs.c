@@ -35,6 +35,7 @@ rcsid[] = "$Id: r_segs.c,v 1.3 1997/01/29 20:10:19 b1 Exp $";
 
 #include "doomdef.h"
 #include "doomstat.h"
+#include "m_bench.h"
 
 #include "r_local.h"
 #include "r_sky.h"
@@ -381,10 +382,14 @@ R_StoreWallRange
     angle_t		distangle, offsetangle;
     fixed_t		vtop;
     int			lightnum;
+    long long		benchstart = 0;
 
     // don't overflow and crash
     if (ds_p == &drawsegs[MAXDRAWSEGS])
 	return;		
+
+    if (benchdemo)
+	benchstart = I_GetTimeUS ();
 		
 #ifdef RANGECHECK
     if (start >=viewwidth || start > stop)
@@ -742,5 +747,8 @@ R_StoreWallRange
 	ds_p->bsilheight = MAXINT;
     }
     ds_p++;
+
+    if (benchdemo)
+	benchtime[bench_segs] += I_GetTimeUS () - benchstart;
 }
 
@@ -29,6 +29,10 @@ rcsid[] = "$Id: s_sound.c,v 1.6 1997/02/03 22:45:12 b1 Exp $";
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "i_system.h"
 #include "i_sound.h"
 #include "sounds.h"
@@ -130,6 +134,26 @@ int			numChannels;
 
 static int		nextcleanup;
 
+// The positional sounds S_UpdateSounds moves each tic,
+// gathered with an array for each field so the passes
+// over them are straight loops.
+typedef struct
+{
+    int*	cnum;
+    fixed_t*	x;
+    fixed_t*	y;
+    fixed_t*	dist;
+    int*	vol;
+    int*	sep;
+    int*	pitch;
+    int*	handle;
+
+} soundbatch_t;
+
+#define BATCHFIELDS		8
+
+static soundbatch_t	batch;
+
 
 
 //
@@ -149,6 +173,11 @@ S_AdjustSoundParams
   int*		sep,
   int*		pitch );
 
+void
+S_AdjustSoundBatch
+( mobj_t*	listener,
+  int		count );
+
 void S_StopChannel(int cnum);
 
 
@@ -166,8 +195,9 @@ void S_Init
 
   fprintf( stderr, "S_Init: default sfx volume %d\n", sfxVolume);
 
-  // Whatever these did with DMX, these are rather dummies now.
-  I_SetChannels();
+  // As many channels as the mixer has voices, so a sound
+  // kicked out here is the one the mixer would drop.
+  numChannels = I_SetChannels(numChannels);
   
   S_SetSfxVolume(sfxVolume);
   // No music with Linux - another dummy.
@@ -182,6 +212,17 @@ void S_Init
   // Free all channels for use
   for (i=0 ; i<numChannels ; i++)
     channels[i].sfxinfo = 0;
+
+  // and the arrays to move them in
+  batch.cnum = (int *) Z_Malloc(BATCHFIELDS*numChannels*sizeof(int),
+				PU_STATIC, 0);
+  batch.x = batch.cnum + numChannels;
+  batch.y = batch.x + numChannels;
+  batch.dist = batch.y + numChannels;
+  batch.vol = batch.dist + numChannels;
+  batch.sep = batch.vol + numChannels;
+  batch.pitch = batch.sep + numChannels;
+  batch.handle = batch.pitch + numChannels;
   
   // no sounds are playing, and they are not mus_paused
   mus_paused = 0;
@@ -267,6 +308,14 @@ S_StartSoundAtVolume
   
   mobj_t*	origin = (mobj_t *) origin_p;
   
+  // predicted moves play their sounds
+  // when the game gets to them
+  if (predicting)
+    return;
+
+  // nor is anything heard while seeking a demo
+  if (demoseeking)
+    return;
   
   // Debug.
   /*fprintf( stderr,
@@ -515,16 +564,21 @@ void S_ResumeSound(void)
 
 //
 // Updates music & sounds
+// The sounds that move are gathered, their volume and
+// separation worked out in one pass, and they go to
+// the mixer as a single block.
 //
 void S_UpdateSounds(void* listener_p)
 {
-    int		audible;
     int		cnum;
+    int		count;
     int		volume;
-    int		sep;
     int		pitch;
+    int		i;
+    int		n;
     sfxinfo_t*	sfx;
     channel_t*	c;
+    mobj_t*	origin;
     
     mobj_t*	listener = (mobj_t*)listener_p;
 
@@ -550,61 +604,73 @@ void S_UpdateSounds(void* listener_p)
 	nextcleanup = gametic + 15;
     }*/
     
+    count = 0;
     for (cnum=0 ; cnum<numChannels ; cnum++)
     {
 	c = &channels[cnum];
 	sfx = c->sfxinfo;
 
-	if (c->sfxinfo)
+	if (!sfx)
+	    continue;
+
+	// if channel is allocated but sound has stopped,
+	//  free it
+	if (!I_SoundIsPlaying(c->handle))
 	{
-	    if (I_SoundIsPlaying(c->handle))
-	    {
-		// initialize parameters
-		volume = snd_SfxVolume;
-		pitch = NORM_PITCH;
-		sep = NORM_SEP;
+	    S_StopChannel(cnum);
+	    continue;
+	}
 
-		if (sfx->link)
-		{
-		    pitch = sfx->pitch;
-		    volume += sfx->volume;
-		    if (volume < 1)
-		    {
-			S_StopChannel(cnum);
-			continue;
-		    }
-		    else if (volume > snd_SfxVolume)
-		    {
-			volume = snd_SfxVolume;
-		    }
-		}
+	// initialize parameters
+	volume = snd_SfxVolume;
+	pitch = NORM_PITCH;
 
-		// check non-local sounds for distance clipping
-		//  or modify their params
-		if (c->origin && listener_p != c->origin)
-		{
-		    audible = S_AdjustSoundParams(listener,
-						  c->origin,
-						  &volume,
-						  &sep,
-						  &pitch);
-		    
-		    if (!audible)
-		    {
-			S_StopChannel(cnum);
-		    }
-		    else
-			I_UpdateSoundParams(c->handle, volume, sep, pitch);
-		}
-	    }
-	    else
+	if (sfx->link)
+	{
+	    pitch = sfx->pitch;
+	    volume += sfx->volume;
+	    if (volume < 1)
 	    {
-		// if channel is allocated but sound has stopped,
-		//  free it
 		S_StopChannel(cnum);
+		continue;
 	    }
 	}
+
+	// non-local sounds are distance clipped
+	//  or have their params modified
+	if (!c->origin || listener_p == c->origin)
+	    continue;
+
+	origin = (mobj_t *)c->origin;
+	batch.cnum[count] = cnum;
+	batch.x[count] = origin->x;
+	batch.y[count] = origin->y;
+	batch.pitch[count] = pitch;
+	count++;
     }
+
+    if (!count)
+	return;
+
+    S_AdjustSoundBatch (listener, count);
+
+    n = 0;
+    for (i=0 ; i<count ; i++)
+    {
+	if (batch.vol[i] <= 0)
+	{
+	    S_StopChannel(batch.cnum[i]);
+	    continue;
+	}
+	batch.handle[n] = channels[batch.cnum[i]].handle;
+	batch.vol[n] = batch.vol[i];
+	batch.sep[n] = batch.sep[i];
+	batch.pitch[n] = batch.pitch[i];
+	n++;
+    }
+
+    I_UpdateSoundBlock (n, batch.handle, batch.vol, batch.sep, batch.pitch);
+
     // kill music if it is a single-play && finished
     // if (	mus_playing
     //      && !I_QrySongPlaying(mus_playing->handle)
@@ -677,7 +743,8 @@ S_ChangeMusic
 
     // load & register it
     music->data = (void *) W_CacheLumpNum(music->lumpnum, PU_MUSIC);
-    music->handle = I_RegisterSong(music->data);
+    music->handle = I_RegisterSong(music->data,
+				   W_LumpLength(music->lumpnum));
 
     // play it
     I_PlaySong(music->handle, looping);
@@ -744,43 +811,34 @@ void S_StopChannel(int cnum)
 
 
 //
-// Changes volume, stereo-separation, and pitch variables
-//  from the norm of a sound effect to be played.
+// S_DistanceParams
+// The volume and separation of a sound at x,y
+//  and approx_dist from the listener.
 // If the sound is not audible, returns a 0.
-// Otherwise, modifies parameters and returns 1.
 //
 int
-S_AdjustSoundParams
+S_DistanceParams
 ( mobj_t*	listener,
-  mobj_t*	source,
+  fixed_t	x,
+  fixed_t	y,
+  fixed_t	approx_dist,
   int*		vol,
-  int*		sep,
-  int*		pitch )
+  int*		sep )
 {
-    fixed_t	approx_dist;
-    fixed_t	adx;
-    fixed_t	ady;
     angle_t	angle;
 
-    // calculate the distance to sound origin
-    //  and clip it if necessary
-    adx = abs(listener->x - source->x);
-    ady = abs(listener->y - source->y);
-
-    // From _GG1_ p.428. Appox. eucledian distance fast.
-    approx_dist = adx + ady - ((adx < ady ? adx : ady)>>1);
-    
     if (gamemap != 8
 	&& approx_dist > S_CLIPPING_DIST)
     {
+	*vol = 0;
 	return 0;
     }
     
     // angle of source to listener
     angle = R_PointToAngle2(listener->x,
 			    listener->y,
-			    source->x,
-			    source->y);
+			    x,
+			    y);
 
     if (angle > listener->angle)
 	angle = angle - listener->angle;
@@ -818,6 +876,96 @@ S_AdjustSoundParams
 }
 
 
+//
+// Changes volume, stereo-separation, and pitch variables
+//  from the norm of a sound effect to be played.
+// If the sound is not audible, returns a 0.
+// Otherwise, modifies parameters and returns 1.
+//
+int
+S_AdjustSoundParams
+( mobj_t*	listener,
+  mobj_t*	source,
+  int*		vol,
+  int*		sep,
+  int*		pitch )
+{
+    fixed_t	approx_dist;
+    fixed_t	adx;
+    fixed_t	ady;
+
+    // calculate the distance to sound origin
+    //  and clip it if necessary
+    adx = abs(listener->x - source->x);
+    ady = abs(listener->y - source->y);
+
+    // From _GG1_ p.428. Appox. eucledian distance fast.
+    approx_dist = adx + ady - ((adx < ady ? adx : ady)>>1);
+    
+    return S_DistanceParams (listener, source->x, source->y,
+			     approx_dist, vol, sep);
+}
+
+
+//
+// S_AdjustSoundBatch
+// S_AdjustSoundParams for the first count sounds
+//  gathered in batch, setting their vol and sep.
+// A vol of 0 is out of hearing.
+//
+void
+S_AdjustSoundBatch
+( mobj_t*	listener,
+  int		count )
+{
+    fixed_t	adx;
+    fixed_t	ady;
+    int		i;
+
+    // all the distances first, four at a time
+    i = 0;
+#ifdef __SSE2__
+    {
+	__m128i	lx = _mm_set1_epi32 (listener->x);
+	__m128i	ly = _mm_set1_epi32 (listener->y);
+	__m128i	dx;
+	__m128i	dy;
+	__m128i	sign;
+	__m128i	less;
+	__m128i	least;
+
+	for ( ; i+4 <= count ; i += 4)
+	{
+	    dx = _mm_sub_epi32 (lx, _mm_loadu_si128 ((__m128i *)&batch.x[i]));
+	    dy = _mm_sub_epi32 (ly, _mm_loadu_si128 ((__m128i *)&batch.y[i]));
+
+	    sign = _mm_srai_epi32 (dx, 31);
+	    dx = _mm_sub_epi32 (_mm_xor_si128 (dx, sign), sign);
+	    sign = _mm_srai_epi32 (dy, 31);
+	    dy = _mm_sub_epi32 (_mm_xor_si128 (dy, sign), sign);
+
+	    less = _mm_cmplt_epi32 (dx, dy);
+	    least = _mm_or_si128 (_mm_and_si128 (less, dx),
+				  _mm_andnot_si128 (less, dy));
+	    _mm_storeu_si128 ((__m128i *)&batch.dist[i],
+			      _mm_sub_epi32 (_mm_add_epi32 (dx, dy),
+					     _mm_srai_epi32 (least, 1)));
+	}
+    }
+#endif
+    for ( ; i<count ; i++)
+    {
+	adx = abs(listener->x - batch.x[i]);
+	ady = abs(listener->y - batch.y[i]);
+	batch.dist[i] = adx + ady - ((adx < ady ? adx : ady)>>1);
+    }
+
+    for (i=0 ; i<count ; i++)
+	S_DistanceParams (listener, batch.x[i], batch.y[i], batch.dist[i],
+			  &batch.vol[i], &batch.sep[i]);
+}
+
+
 
 
 //
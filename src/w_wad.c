@@ -54,6 +54,7 @@ rcsid[] = "$Id: w_wad.c,v 1.5 1997/02/03 16:47:57 b1 Exp $";
 #include "m_swap.h"
 #include "i_system.h"
 #include "z_zone.h"
+#include "m_trace.h"
 
 #ifdef __GNUG__
 #pragma implementation "w_wad.h"
@@ -458,7 +459,7 @@ W_ReadLump
 
     l = lumpinfo+lump;
 	
-    // ??? I_BeginRead ();
+    TRACE_BEGIN ("W_ReadLump");
 	
     if (l->handle == -1)
     {
@@ -478,7 +479,7 @@ W_ReadLump
     if (l->handle == -1)
 	close (handle);
 		
-    // ??? I_EndRead ();
+    TRACE_END ();
 }
 
 
@@ -29,6 +29,7 @@ rcsid[] = "$Id: z_zone.c,v 1.4 1997/02/03 16:47:58 b1 Exp $";
 #include "z_zone.h"
 #include "i_system.h"
 #include "doomdef.h"
+#include "m_trace.h"
 
 
 //
@@ -193,6 +194,7 @@ Z_Malloc
     memblock_t* rover;
     memblock_t* newblock;
     memblock_t*	base;
+    boolean	purging;
 
     size = (size + 7) & ~7;
     
@@ -213,6 +215,7 @@ Z_Malloc
 	
     rover = base;
     start = base->prev;
+    purging = false;
 	
     do
     {
@@ -233,6 +236,11 @@ Z_Malloc
 	    else
 	    {
 		// free the rover block (adding the size to base)
+		if (!purging)
+		{
+		    TRACE_BEGIN ("Z_Malloc purge");
+		    purging = true;
+		}
 
 		// the rover can be the base block
 		base = base->prev;
@@ -245,6 +253,9 @@ Z_Malloc
 	    rover = rover->next;
     } while (base->user || base->size < size);
 
+    if (purging)
+	TRACE_END ();
+
     
     // found a block big enough
     extra = base->size - size;